@@ -82,3 +82,11 @@
 #define VFPOPDESC_UNUSED_BIT	(24)
 #define VFPOPDESC_UNUSED_MASK	(0xFF << VFPOPDESC_UNUSED_BIT)
 #define VFPOPDESC_OPDESC_MASK	(~(VFPOPDESC_LENGTH_MASK | VFPOPDESC_UNUSED_MASK))
+
+#ifndef __ASSEMBLY__
+#if defined(CONFIG_VFP) && defined(CONFIG_PM)
+extern void vfp_pm_save_context(void);
+#else
+static inline void vfp_pm_save_context(void) { }
+#endif
+#endif
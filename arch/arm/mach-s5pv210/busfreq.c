@@ -0,0 +1,352 @@
+/* linux/arch/arm/mach-s5pv210/busfreq.c
+ *
+ * Copyright (c) 2010 Samsung Electronics Co., Ltd.
+ *		http://www.samsung.com/
+ *
+ * S5PV210 - DMC/bus frequency scaling
+ *
+ * The MPLL based ONEDRAM(DMC0), HCLK_DSYS and HCLK_PSYS clocks are scaled
+ * on their own, independently of the ARM level. The load input is the
+ * AXI read/write activity of the Cortex-A8, sampled through the
+ * performance monitor. Bus masters that the core does not see (FIMC,
+ * MFC, FIMD) lock the bus at BUS_L0 while they are active; sampling stops
+ * and the PMU counters are given back for as long as any lock is held.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/err.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/cpufreq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/perf_event.h>
+#include <linux/sysfs.h>
+
+#include <mach/busfreq.h>
+
+/* Cortex-A8 PMU events, see armv7_a8_perf_types */
+#define A8_AXI_READ_CYCLES	0x45
+#define A8_AXI_WRITE_CYCLES	0x46
+
+#define DEFAULT_UP_THRESHOLD	30
+#define DEFAULT_DOWN_THRESHOLD	10
+#define DEFAULT_SAMPLING_RATE	(50 * USEC_PER_MSEC)
+
+static DEFINE_MUTEX(busfreq_lock);
+
+static unsigned long busfreq_locks;	/* bitmask of enum busfreq_client */
+static enum busfreq_level load_level;	/* what the load alone asks for */
+static enum busfreq_level cur_level;
+static unsigned int cur_load;
+
+static unsigned int up_threshold = DEFAULT_UP_THRESHOLD;
+static unsigned int down_threshold = DEFAULT_DOWN_THRESHOLD;
+static unsigned int sampling_rate = DEFAULT_SAMPLING_RATE;	/* us */
+
+static struct perf_event *axi_event[2];	/* NULL while not sampling */
+static u64 axi_last;
+static ktime_t last_sample;
+
+static struct delayed_work busfreq_work;
+static bool busfreq_started;	/* busfreq_work is set up */
+
+static struct perf_event_attr axi_event_attr[2] = {
+	{
+		.type		= PERF_TYPE_RAW,
+		.config		= A8_AXI_READ_CYCLES,
+		.size		= sizeof(struct perf_event_attr),
+		.pinned		= 1,
+	}, {
+		.type		= PERF_TYPE_RAW,
+		.config		= A8_AXI_WRITE_CYCLES,
+		.size		= sizeof(struct perf_event_attr),
+		.pinned		= 1,
+	},
+};
+
+/* Called with busfreq_lock held */
+static void s5pv210_busfreq_update(void)
+{
+	enum busfreq_level level = busfreq_locks ? BUS_L0 : load_level;
+
+	if (level == cur_level)
+		return;
+
+	if (!s5pv210_cpufreq_set_bus_level(level))
+		cur_level = level;
+}
+
+/* Called with busfreq_lock held */
+static void s5pv210_busfreq_put_axi(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(axi_event); i++) {
+		if (axi_event[i])
+			perf_event_release_kernel(axi_event[i]);
+		axi_event[i] = NULL;
+	}
+}
+
+/* Called with busfreq_lock held */
+static int s5pv210_busfreq_get_axi(void)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(axi_event); i++) {
+		axi_event[i] = perf_event_create_kernel_counter(
+				&axi_event_attr[i], 0, -1, NULL);
+		if (IS_ERR(axi_event[i])) {
+			ret = PTR_ERR(axi_event[i]);
+			axi_event[i] = NULL;
+			s5pv210_busfreq_put_axi();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static u64 s5pv210_busfreq_read_axi(void)
+{
+	u64 enabled, running, total = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(axi_event); i++)
+		total += perf_event_read_value(axi_event[i],
+					       &enabled, &running);
+
+	return total;
+}
+
+/*
+ * Bus load is the share of the sampling period in which the AXI port of
+ * the core was busy. The AXI event counters tick with the ARM clock.
+ *
+ * The counters are only held while the load decides the level. A locked
+ * bus stops the sampling until the last lock goes away.
+ */
+static void s5pv210_busfreq_sample(struct work_struct *work)
+{
+	unsigned int khz = cpufreq_quick_get(0);
+	ktime_t now = ktime_get();
+	u64 axi, cycles;
+	s64 delta_us;
+	int ret;
+
+	mutex_lock(&busfreq_lock);
+
+	if (busfreq_locks) {
+		s5pv210_busfreq_put_axi();
+		mutex_unlock(&busfreq_lock);
+		return;
+	}
+
+	if (!axi_event[0]) {
+		ret = s5pv210_busfreq_get_axi();
+		if (ret) {
+			/* the bus stays where it is */
+			pr_err("%s: cannot create AXI counter (%d)\n",
+					__func__, ret);
+			mutex_unlock(&busfreq_lock);
+			return;
+		}
+		axi_last = s5pv210_busfreq_read_axi();
+		last_sample = now;
+		goto out;
+	}
+
+	axi = s5pv210_busfreq_read_axi();
+	delta_us = ktime_us_delta(now, last_sample);
+
+	if (khz && delta_us > 0) {
+		cycles = (u64)delta_us * (khz / 1000);
+		cur_load = div64_u64((axi - axi_last) * 100, cycles);
+
+		if (cur_load >= up_threshold)
+			load_level = BUS_L0;
+		else if (cur_load < down_threshold)
+			load_level = BUS_L1;
+
+		s5pv210_busfreq_update();
+	}
+
+	axi_last = axi;
+	last_sample = now;
+
+out:
+	mutex_unlock(&busfreq_lock);
+
+	schedule_delayed_work(&busfreq_work, usecs_to_jiffies(sampling_rate));
+}
+
+void s5pv210_busfreq_lock(enum busfreq_client client)
+{
+	mutex_lock(&busfreq_lock);
+	busfreq_locks |= 1 << client;
+	s5pv210_busfreq_update();
+	mutex_unlock(&busfreq_lock);
+}
+EXPORT_SYMBOL_GPL(s5pv210_busfreq_lock);
+
+void s5pv210_busfreq_unlock(enum busfreq_client client)
+{
+	mutex_lock(&busfreq_lock);
+	busfreq_locks &= ~(1 << client);
+	s5pv210_busfreq_update();
+	/* restart the sampling; a no-op if it never stopped */
+	if (!busfreq_locks && busfreq_started)
+		schedule_delayed_work(&busfreq_work, 0);
+	mutex_unlock(&busfreq_lock);
+}
+EXPORT_SYMBOL_GPL(s5pv210_busfreq_unlock);
+
+static ssize_t show_up_threshold(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", up_threshold);
+}
+
+static ssize_t store_up_threshold(struct kobject *kobj,
+				  struct attribute *attr, const char *buf,
+				  size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val > 100 || val <= down_threshold)
+		return -EINVAL;
+	up_threshold = val;
+	return count;
+}
+
+static struct global_attr up_threshold_attr = __ATTR(up_threshold, 0644,
+		show_up_threshold, store_up_threshold);
+
+static ssize_t show_down_threshold(struct kobject *kobj,
+				   struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", down_threshold);
+}
+
+static ssize_t store_down_threshold(struct kobject *kobj,
+				    struct attribute *attr, const char *buf,
+				    size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val >= up_threshold)
+		return -EINVAL;
+	down_threshold = val;
+	return count;
+}
+
+static struct global_attr down_threshold_attr = __ATTR(down_threshold, 0644,
+		show_down_threshold, store_down_threshold);
+
+static ssize_t show_sampling_rate(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", sampling_rate);
+}
+
+static ssize_t store_sampling_rate(struct kobject *kobj,
+				   struct attribute *attr, const char *buf,
+				   size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val < 10 * USEC_PER_MSEC)
+		return -EINVAL;
+	sampling_rate = val;
+	return count;
+}
+
+static struct global_attr sampling_rate_attr = __ATTR(sampling_rate, 0644,
+		show_sampling_rate, store_sampling_rate);
+
+static ssize_t show_cur_level(struct kobject *kobj,
+			      struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", cur_level);
+}
+
+static struct global_attr cur_level_attr = __ATTR(cur_level, 0444,
+		show_cur_level, NULL);
+
+static ssize_t show_load(struct kobject *kobj,
+			 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", cur_load);
+}
+
+static struct global_attr load_attr = __ATTR(load, 0444, show_load, NULL);
+
+static ssize_t show_locks(struct kobject *kobj,
+			  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "0x%lx\n", busfreq_locks);
+}
+
+static struct global_attr locks_attr = __ATTR(locks, 0444, show_locks, NULL);
+
+static struct attribute *busfreq_attributes[] = {
+	&up_threshold_attr.attr,
+	&down_threshold_attr.attr,
+	&sampling_rate_attr.attr,
+	&cur_level_attr.attr,
+	&load_attr.attr,
+	&locks_attr.attr,
+	NULL,
+};
+
+static struct attribute_group busfreq_attr_group = {
+	.attrs = busfreq_attributes,
+	.name = "busfreq",
+};
+
+static int __init s5pv210_busfreq_init(void)
+{
+	int ret;
+
+	INIT_DELAYED_WORK_DEFERRABLE(&busfreq_work, s5pv210_busfreq_sample);
+
+	/* Start from the full speed bus until the first sample */
+	cur_level = BUS_LEVEL_MAX;
+	load_level = BUS_L0;
+	mutex_lock(&busfreq_lock);
+	s5pv210_busfreq_update();
+	mutex_unlock(&busfreq_lock);
+
+	ret = sysfs_create_group(cpufreq_global_kobject, &busfreq_attr_group);
+	if (ret)
+		return ret;
+
+	/* the first run takes the AXI counters */
+	mutex_lock(&busfreq_lock);
+	busfreq_started = true;
+	schedule_delayed_work(&busfreq_work, 0);
+	mutex_unlock(&busfreq_lock);
+
+	pr_info("S5PV210 BUSFREQ Initialised\n");
+
+	return 0;
+}
+late_initcall(s5pv210_busfreq_init);
@@ -22,12 +22,15 @@
 #include <linux/regulator/consumer.h>
 #include <linux/gpio.h>
 #include <linux/platform_device.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <asm/system.h>
 
 #include <mach/map.h>
 #include <mach/cpu-freq-v210.h>
 #include <mach/regs-clock.h>
 #include <mach/regs-gpio.h>
+#include <mach/busfreq.h>
 
 #include <plat/cpu-freq.h>
 #include <plat/pll.h>
@@ -36,6 +39,26 @@
 #include <plat/regs-fb.h>
 #include <plat/pm.h>
 
+#include <trace/events/power.h>
+
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE_1400
+#define OD_FREQ			1400000
+#define OD_APLL_VAL		APLL_VAL_1400
+#define OD_ARM_VOLT		1350000
+#define OD_INT_VOLT		1150000
+#define OD_A2M_DIV		6
+#else
+#define OD_FREQ			1200000
+#define OD_APLL_VAL		APLL_VAL_1200
+#define OD_ARM_VOLT		1300000
+#define OD_INT_VOLT		1100000
+#define OD_A2M_DIV		5
+#endif
+
+/* Battery temperature hysteresis for the overdrive level, in 0.1 degC */
+#define OD_ALLOW_TEMP		400
+#define OD_REVOKE_TEMP		450
+
 static struct clk *mpu_clk;
 static struct regulator *arm_regulator;
 static struct regulator *internal_regulator;
@@ -53,6 +76,9 @@ static DEFINE_MUTEX(set_freq_lock);
 
 /* frequency */
 static struct cpufreq_frequency_table freq_table[] = {
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	{L_OD, OD_FREQ},
+#endif
 	{L0, 1000*1000},
 	{L1, 800*1000},
 	{L2, 400*1000},
@@ -70,6 +96,12 @@ const unsigned long arm_volt_max = 1350000;
 const unsigned long int_volt_max = 1250000;
 
 static struct s5pv210_dvs_conf dvs_conf[] = {
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	[L_OD] = {
+		.arm_volt   = OD_ARM_VOLT,
+		.int_volt   = OD_INT_VOLT,
+	},
+#endif
 	[L0] = {
 		.arm_volt   = 1250000,
 		.int_volt   = 1100000,
@@ -92,24 +124,106 @@ static struct s5pv210_dvs_conf dvs_conf[] = {
 	},
 };
 
-static u32 clkdiv_val[5][11] = {
+/*
+ * Adaptive supply voltage (ASV)
+ *
+ * The chip ID block carries the speed group the part was sorted into at
+ * test time: the IDS (leakage current) and HPM (hardware performance
+ * monitor) readings. Fast, leaky parts close timing at a lower voltage,
+ * so they get their own table. Unfused parts keep dvs_conf[] as is.
+ */
+#define S5PV210_ASV_INFO	(S5P_VA_CHIPID + 0x4)
+#define S5PV210_ASV_IDS_SHIFT	(24)
+#define S5PV210_ASV_IDS_MASK	(0xFF)
+#define S5PV210_ASV_HPM_SHIFT	(12)
+#define S5PV210_ASV_HPM_MASK	(0x1F)
+
+#define ASV_VOLT_MIN		750000	/* uV, lowest max8998 buck setting */
+#define ASV_VOLT_STEP		25000	/* uV, max8998 buck step */
+
+enum s5pv210_asv_group {
+	ASV_GROUP_TYPICAL = 0,
+	ASV_GROUP_FAST,
+	ASV_GROUP_FASTEST,
+	ASV_GROUP_MAX,
+};
+
+/* { IDS, HPM } lower bounds of each group */
+static const unsigned int asv_group_limit[ASV_GROUP_MAX][2] = {
+	[ASV_GROUP_TYPICAL]	= { 0, 0 },
+	[ASV_GROUP_FAST]	= { 16, 12 },
+	[ASV_GROUP_FASTEST]	= { 32, 18 },
+};
+
+static const struct s5pv210_dvs_conf
+asv_dvs_conf[ASV_GROUP_MAX][ARRAY_SIZE(dvs_conf)] = {
+	[ASV_GROUP_FAST] = {
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+		[L_OD] = { .arm_volt = OD_ARM_VOLT - 50000,
+			   .int_volt = OD_INT_VOLT - 25000, },
+#endif
+		[L0] = { .arm_volt = 1200000, .int_volt = 1075000, },
+		[L1] = { .arm_volt = 1150000, .int_volt = 1075000, },
+		[L2] = { .arm_volt = 1000000, .int_volt = 1075000, },
+		[L3] = { .arm_volt =  925000, .int_volt = 1075000, },
+		[L4] = { .arm_volt =  925000, .int_volt =  975000, },
+	},
+	[ASV_GROUP_FASTEST] = {
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+		[L_OD] = { .arm_volt = OD_ARM_VOLT - 100000,
+			   .int_volt = OD_INT_VOLT - 50000, },
+#endif
+		[L0] = { .arm_volt = 1150000, .int_volt = 1050000, },
+		[L1] = { .arm_volt = 1100000, .int_volt = 1050000, },
+		[L2] = { .arm_volt =  975000, .int_volt = 1050000, },
+		[L3] = { .arm_volt =  900000, .int_volt = 1050000, },
+		[L4] = { .arm_volt =  900000, .int_volt =  950000, },
+	},
+};
+
+static enum s5pv210_asv_group cur_asv_group;
+
+/* Per-level offsets set from sysfs, applied on top of dvs_conf[] */
+static struct {
+	long	arm_volt;	/* uV */
+	long	int_volt;	/* uV */
+} dvs_offset[ARRAY_SIZE(dvs_conf)];
+
+static u32 clkdiv_val[][11] = {
 	/*{ APLL, A2M, HCLK_MSYS, PCLK_MSYS,
 	 * HCLK_DSYS, PCLK_DSYS, HCLK_PSYS, PCLK_PSYS, ONEDRAM,
 	 * MFC, G3D }
 	 */
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	/* L_OD : [1200 or 1400/200/200/100][166/83][133/66][200/200] */
+	[L_OD] = {0, OD_A2M_DIV, OD_A2M_DIV, 1, 3, 1, 4, 1, 3, 0, 0},
+#endif
 	/* L0 : [1000/200/200/100][166/83][133/66][200/200] */
-	{0, 4, 4, 1, 3, 1, 4, 1, 3, 0, 0},
+	[L0] = {0, 4, 4, 1, 3, 1, 4, 1, 3, 0, 0},
 	/* L1 : [800/200/200/100][166/83][133/66][200/200] */
-	{0, 3, 3, 1, 3, 1, 4, 1, 3, 0, 0},
+	[L1] = {0, 3, 3, 1, 3, 1, 4, 1, 3, 0, 0},
 	/* L2 : [400/200/200/100][166/83][133/66][200/200] */
-	{1, 3, 1, 1, 3, 1, 4, 1, 3, 0, 0},
+	[L2] = {1, 3, 1, 1, 3, 1, 4, 1, 3, 0, 0},
 	/* L3 : [200/200/200/100][166/83][133/66][200/200] */
-	{3, 3, 0, 1, 3, 1, 4, 1, 3, 0, 0},
+	[L3] = {3, 3, 0, 1, 3, 1, 4, 1, 3, 0, 0},
 	/* L4 : [100/100/100/100][83/83][66/66][100/100] */
-	{7, 7, 0, 0, 7, 0, 9, 0, 7, 0, 0},
+	[L4] = {7, 7, 0, 0, 7, 0, 9, 0, 7, 0, 0},
 };
 
 static struct s3c_freq clk_info[] = {
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	[L_OD] = {	/* L_OD: 1.2GHz or 1.4GHz */
+		.fclk       = OD_FREQ,
+		.armclk     = OD_FREQ,
+		.hclk_tns   = 0,
+		.hclk       = 133000,
+		.pclk       = 66000,
+		.hclk_msys  = 200000,
+		.pclk_msys  = 100000,
+		.hclk_dsys  = 166750,
+		.pclk_dsys  = 83375,
+	},
+#endif
 	[L0] = {	/* L0: 1GHz */
 		.fclk       = 1000000,
 		.armclk     = 1000000,
@@ -269,6 +383,12 @@ static void s5pv210_cpufreq_clksrcs_MPLL2APLL(unsigned int index,
 	 * 2. Turn on APLL
 	 * 2-1. Set PMS values
 	 */
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	if (index == L_OD)
+		/* APLL FOUT becomes 1200 or 1400 Mhz */
+		__raw_writel(OD_APLL_VAL, S5P_APLL_CON);
+	else
+#endif
 	if (index == L0)
 		/* APLL FOUT becomes 1000 Mhz */
 		__raw_writel(PLL45XX_APLL_VAL_1000, S5P_APLL_CON);
@@ -319,6 +439,225 @@ static void s5pv210_cpufreq_clksrcs_MPLL2APLL(unsigned int index,
 	} while (reg & S5P_CLKMUX_STAT0_MUX200);
 }
 
+/*
+ * Transition plan between two levels. Everything that only depends on
+ * the source and destination level is computed once at init time, so
+ * that s5pv210_cpufreq_target() only replays register writes.
+ */
+struct s5pv210_dvfs_plan {
+	unsigned int	pll_changing:1;
+	unsigned int	bus_speed_changing:1;
+	unsigned int	onedram_changing:1;
+	unsigned int	dmc0_slowing:1;
+	unsigned int	dmc1_slowing:1;
+	u16		dmc0_trans_refresh;	/* DMC0 refresh during change */
+	u16		dmc1_trans_refresh;	/* DMC1 refresh during change */
+};
+
+#define CLKDIV0_MSYS_MASK	(S5P_CLKDIV0_APLL_MASK | S5P_CLKDIV0_A2M_MASK \
+				| S5P_CLKDIV0_HCLK200_MASK \
+				| S5P_CLKDIV0_PCLK100_MASK)
+#define CLKDIV0_DPSYS_MASK	(S5P_CLKDIV0_HCLK166_MASK \
+				| S5P_CLKDIV0_PCLK83_MASK \
+				| S5P_CLKDIV0_HCLK133_MASK \
+				| S5P_CLKDIV0_PCLK66_MASK)
+
+/*
+ * With the bus DVFS driver, the MPLL based DSYS/PSYS and ONEDRAM(DMC0)
+ * dividers follow the bus level instead of the ARM level and are only
+ * programmed by s5pv210_cpufreq_set_bus_level().
+ */
+#ifdef CONFIG_S5PV210_BUSFREQ
+#define CLKDIV0_CPUFREQ_MASK	CLKDIV0_MSYS_MASK
+#else
+#define CLKDIV0_CPUFREQ_MASK	(CLKDIV0_MSYS_MASK | CLKDIV0_DPSYS_MASK)
+#endif
+
+static struct s5pv210_dvfs_plan dvfs_plan[ARRAY_SIZE(clk_info)]
+					[ARRAY_SIZE(clk_info)];
+static u32 clkdiv0_reg[ARRAY_SIZE(clk_info)];
+static u16 dmc0_refresh[ARRAY_SIZE(clk_info)];
+static u16 dmc1_refresh[ARRAY_SIZE(clk_info)];
+
+static unsigned int cur_level;
+static unsigned long previous_int_volt;
+
+/*
+ * Set until a transition has run with the hardware state untrusted: at
+ * boot, and again after a resume, when the clocks and the regulators may
+ * hold what the bootloader or the PMIC left in them.
+ */
+static bool hw_resync = true;
+
+/*
+ * Build the plan for going from @old to @index. With @first_run, the
+ * current hardware state is not trusted and every step is taken.
+ */
+static void s5pv210_cpufreq_build_plan(struct s5pv210_dvfs_plan *plan,
+		unsigned int old, unsigned int index, bool first_run)
+{
+	unsigned int reg;
+
+	memset(plan, 0, sizeof(*plan));
+
+	if (clk_info[index].fclk != clk_info[old].fclk || first_run)
+		plan->pll_changing = 1;
+
+	if (clk_info[index].hclk_msys != clk_info[old].hclk_msys || first_run)
+		plan->bus_speed_changing = 1;
+
+#ifndef CONFIG_S5PV210_BUSFREQ
+	if (clkdiv_val[index][8] != clkdiv_val[old][8] || first_run)
+		plan->onedram_changing = 1;
+
+	/*
+	 * If ONEDRAM(DMC0)'s clock is getting slower, DMC0's
+	 * refresh counter should decrease before slowing down
+	 * DMC0 clock. We assume that DMC0's source clock never
+	 * changes. This is a temporary setting for the transition.
+	 * Stable setting is done at the end of the transition.
+	 */
+	if (first_run)
+		reg = (__raw_readl(S5P_CLK_DIV6) & S5P_CLKDIV6_ONEDRAM_MASK)
+			>> S5P_CLKDIV6_ONEDRAM_SHIFT;
+	else
+		reg = clkdiv_val[old][8];
+	if (clkdiv_val[index][8] > reg) {
+		reg = backup_dmc0_reg * (reg + 1) / (clkdiv_val[index][8] + 1);
+		WARN_ON(reg > 0xFFFF);
+		plan->dmc0_slowing = 1;
+		plan->dmc0_trans_refresh = reg & 0xFFFF;
+	}
+#endif
+
+	/*
+	 * If hclk_msys (for DMC1) is getting slower, DMC1's
+	 * refresh counter should decrease before slowing down
+	 * hclk_msys in order to get rid of glitches in the
+	 * transition. This is temporary setting for the transition.
+	 * Stable setting is done at the end of the transition.
+	 *
+	 * Besides, we need to consider the case when PLL speed changes,
+	 * where the DMC1's source clock hclk_msys is changed from ARMCLK
+	 * to MPLL temporarily. DMC1 needs to be ready for this
+	 * transition as well.
+	 */
+	if (clk_info[index].hclk_msys < clk_info[old].hclk_msys ||
+	    first_run) {
+		/*
+		 * hclk_msys is up to 12bit. (200000)
+		 * reg is 16bit. so no overflow, yet.
+		 *
+		 * May need to use div64.h later with larger hclk_msys or
+		 * DMCx refresh counter. But, we have bugs in do_div and
+		 * that should be fixed before.
+		 */
+		reg = backup_dmc1_reg * clk_info[index].hclk_msys;
+		reg /= clk_info[backup_freq_level].hclk_msys;
+
+		/*
+		 * When ARM_CLK is absed on APLL->MPLL,
+		 * hclk_msys becomes hclk_msys *= MPLL/APLL;
+		 *
+		 * Based on the worst case scenario, we use MPLL/APLL_MAX
+		 * assuming that MPLL clock speed does not change.
+		 *
+		 * Multiplied first in order to reduce rounding error.
+		 * because reg has 15b length, using 64b should be enough to
+		 * prevent overflow.
+		 */
+		if (plan->pll_changing) {
+			reg *= mpll_freq;
+			reg /= apll_freq_max;
+		}
+		WARN_ON(reg > 0xFFFF);
+		plan->dmc1_slowing = 1;
+		plan->dmc1_trans_refresh = reg & 0xFFFF;
+	}
+}
+
+static void s5pv210_cpufreq_build_plans(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(clk_info); i++) {
+		clkdiv0_reg[i] = (clkdiv_val[i][0] << S5P_CLKDIV0_APLL_SHIFT)
+			| (clkdiv_val[i][1] << S5P_CLKDIV0_A2M_SHIFT)
+			| (clkdiv_val[i][2] << S5P_CLKDIV0_HCLK200_SHIFT)
+			| (clkdiv_val[i][3] << S5P_CLKDIV0_PCLK100_SHIFT)
+			| (clkdiv_val[i][4] << S5P_CLKDIV0_HCLK166_SHIFT)
+			| (clkdiv_val[i][5] << S5P_CLKDIV0_PCLK83_SHIFT)
+			| (clkdiv_val[i][6] << S5P_CLKDIV0_HCLK133_SHIFT)
+			| (clkdiv_val[i][7] << S5P_CLKDIV0_PCLK66_SHIFT);
+		clkdiv0_reg[i] &= CLKDIV0_CPUFREQ_MASK;
+
+		/*
+		 * If DMC0 clock gets slower (by orginal clock speed / n),
+		 * then, the refresh rate should decrease
+		 * (by original refresh count / n) (n: divider)
+		 */
+		dmc0_refresh[i] = (backup_dmc0_reg *
+			(clkdiv_val[backup_freq_level][8] + 1)
+			/ (clkdiv_val[i][8] + 1)) & 0xFFFF;
+
+		/*
+		 * If DMC1 clock gets slower (by original clock speed * n),
+		 * then, the refresh rate should decrease
+		 * (by original refresh count * n) (n : clock rate)
+		 */
+		dmc1_refresh[i] = (backup_dmc1_reg * clk_info[i].hclk_msys
+			/ clk_info[backup_freq_level].hclk_msys) & 0xFFFF;
+
+		for (j = 0; j < ARRAY_SIZE(clk_info); j++)
+			s5pv210_cpufreq_build_plan(&dvfs_plan[i][j], i, j,
+						   false);
+	}
+}
+
+static void s5pv210_cpufreq_get_volt(unsigned int index,
+		unsigned long *arm_volt, unsigned long *int_volt)
+{
+	*arm_volt = dvs_conf[index].arm_volt + dvs_offset[index].arm_volt;
+	*int_volt = dvs_conf[index].int_volt + dvs_offset[index].int_volt;
+}
+
+static int s5pv210_cpufreq_set_volt(unsigned long arm_volt,
+		unsigned long int_volt, bool arm_first)
+{
+	int ret;
+
+	if (IS_ERR_OR_NULL(arm_regulator) ||
+	    IS_ERR_OR_NULL(internal_regulator))
+		return 0;
+
+	/* Skip the regulator round trip for rails that do not move */
+	if (arm_first && arm_volt != previous_arm_volt) {
+		ret = regulator_set_voltage(arm_regulator,
+					    arm_volt, arm_volt_max);
+		if (ret)
+			return ret;
+		previous_arm_volt = arm_volt;
+	}
+
+	if (int_volt != previous_int_volt) {
+		ret = regulator_set_voltage(internal_regulator,
+					    int_volt, int_volt_max);
+		if (ret)
+			return ret;
+		previous_int_volt = int_volt;
+	}
+
+	if (!arm_first && arm_volt != previous_arm_volt) {
+		ret = regulator_set_voltage(arm_regulator,
+					    arm_volt, arm_volt_max);
+		if (ret)
+			return ret;
+		previous_arm_volt = arm_volt;
+	}
+
+	return 0;
+}
+
 static int no_cpufreq_access;
 /*
  * s5pv210_cpufreq_target: relation has an additional symantics other than
@@ -330,15 +669,18 @@ static int s5pv210_cpufreq_target(struct cpufreq_policy *policy,
 		unsigned int target_freq,
 		unsigned int relation)
 {
-	static bool first_run = true;
 	int ret = 0;
 	unsigned long arm_clk;
-	unsigned int index, reg, arm_volt, int_volt;
-	unsigned int pll_changing = 0;
-	unsigned int bus_speed_changing = 0;
+	unsigned int index, reg;
+	unsigned long arm_volt, int_volt;
+	struct s5pv210_dvfs_plan first_plan;
+	struct s5pv210_dvfs_plan *plan;
+	ktime_t start;
 
 	mutex_lock(&set_freq_lock);
 
+	start = ktime_get();
+
 	cpufreq_debug_printk(CPUFREQ_DEBUG_DRIVER, KERN_INFO,
 			"cpufreq: Entering for %dkHz\n", target_freq);
 
@@ -365,28 +707,37 @@ static int s5pv210_cpufreq_target(struct cpufreq_policy *policy,
 		no_cpufreq_access = 1;
 	relation &= ~MASK_FURTHER_CPUFREQ;
 
-	s3c_freqs.freqs.old = s5pv210_cpufreq_getspeed(0);
-
 	if (cpufreq_frequency_table_target(policy, freq_table,
 				target_freq, relation, &index)) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	arm_clk = freq_table[index].frequency;
-
-	s3c_freqs.freqs.new = arm_clk;
-	s3c_freqs.freqs.cpu = 0;
-
 	/*
 	 * Run this function unconditionally until s3c_freqs.freqs.new
 	 * and s3c_freqs.freqs.old are both set by this function.
 	 */
-	if (s3c_freqs.freqs.new == s3c_freqs.freqs.old && !first_run)
+	if (index == cur_level && !hw_resync)
 		goto out;
 
-	arm_volt = dvs_conf[index].arm_volt;
-	int_volt = dvs_conf[index].int_volt;
+	arm_clk = freq_table[index].frequency;
+
+	s3c_freqs.freqs.old = hw_resync ? s5pv210_cpufreq_getspeed(0) :
+		freq_table[cur_level].frequency;
+	s3c_freqs.freqs.new = arm_clk;
+	s3c_freqs.freqs.cpu = 0;
+
+	if (hw_resync) {
+		s5pv210_cpufreq_build_plan(&first_plan, cur_level, index, true);
+		plan = &first_plan;
+		/* Regulators may still hold the bootloader or resume setting */
+		previous_arm_volt = 0;
+		previous_int_volt = 0;
+	} else {
+		plan = &dvfs_plan[cur_level][index];
+	}
+
+	s5pv210_cpufreq_get_volt(index, &arm_volt, &int_volt);
 
 	/* New clock information update */
 	memcpy(&s3c_freqs.new, &clk_info[index],
@@ -394,93 +745,29 @@ static int s5pv210_cpufreq_target(struct cpufreq_policy *policy,
 
 	if (s3c_freqs.freqs.new >= s3c_freqs.freqs.old) {
 		/* Voltage up code: increase ARM first */
-		if (!IS_ERR_OR_NULL(arm_regulator) &&
-				!IS_ERR_OR_NULL(internal_regulator)) {
-			ret = regulator_set_voltage(arm_regulator,
-						    arm_volt, arm_volt_max);
-			if (ret)
-				goto out;
-			ret = regulator_set_voltage(internal_regulator,
-						    int_volt, int_volt_max);
-			if (ret)
-				goto out;
-		}
+		ret = s5pv210_cpufreq_set_volt(arm_volt, int_volt, true);
+		if (ret)
+			goto out;
 	}
 	cpufreq_notify_transition(&s3c_freqs.freqs, CPUFREQ_PRECHANGE);
 
-	if (s3c_freqs.new.fclk != s3c_freqs.old.fclk || first_run)
-		pll_changing = 1;
-
-	if (s3c_freqs.new.hclk_msys != s3c_freqs.old.hclk_msys || first_run)
-		bus_speed_changing = 1;
-
-	/*
-	 * If ONEDRAM(DMC0)'s clock is getting slower, DMC0's
-	 * refresh counter should decrease before slowing down
-	 * DMC0 clock. We assume that DMC0's source clock never
-	 * changes. This is a temporary setting for the transition.
-	 * Stable setting is done at the end of this function.
-	 */
-	reg = (__raw_readl(S5P_CLK_DIV6) & S5P_CLKDIV6_ONEDRAM_MASK)
-		>> S5P_CLKDIV6_ONEDRAM_SHIFT;
-	if (clkdiv_val[index][8] > reg) {
-		reg = backup_dmc0_reg * (reg + 1) / (clkdiv_val[index][8] + 1);
-		WARN_ON(reg > 0xFFFF);
-		reg &= 0xFFFF;
-		__raw_writel(reg, S5P_VA_DMC0 + 0x30);
-	}
-
-	/*
-	 * If hclk_msys (for DMC1) is getting slower, DMC1's
-	 * refresh counter should decrease before slowing down
-	 * hclk_msys in order to get rid of glitches in the
-	 * transition. This is temporary setting for the transition.
-	 * Stable setting is done at the end of this function.
-	 *
-	 * Besides, we need to consider the case when PLL speed changes,
-	 * where the DMC1's source clock hclk_msys is changed from ARMCLK
-	 * to MPLL temporarily. DMC1 needs to be ready for this
-	 * transition as well.
-	 */
-	if (s3c_freqs.new.hclk_msys < s3c_freqs.old.hclk_msys || first_run) {
-		/*
-		 * hclk_msys is up to 12bit. (200000)
-		 * reg is 16bit. so no overflow, yet.
-		 *
-		 * May need to use div64.h later with larger hclk_msys or
-		 * DMCx refresh counter. But, we have bugs in do_div and
-		 * that should be fixed before.
-		 */
-		reg = backup_dmc1_reg * s3c_freqs.new.hclk_msys;
-		reg /= clk_info[backup_freq_level].hclk_msys;
+	if (plan->dmc0_slowing)
+		__raw_writel(plan->dmc0_trans_refresh, S5P_VA_DMC0 + 0x30);
 
-		/*
-		 * When ARM_CLK is absed on APLL->MPLL,
-		 * hclk_msys becomes hclk_msys *= MPLL/APLL;
-		 *
-		 * Based on the worst case scenario, we use MPLL/APLL_MAX
-		 * assuming that MPLL clock speed does not change.
-		 *
-		 * Multiplied first in order to reduce rounding error.
-		 * because reg has 15b length, using 64b should be enough to
-		 * prevent overflow.
-		 */
-		if (pll_changing) {
-			reg *= mpll_freq;
-			reg /= apll_freq_max;
-		}
-		WARN_ON(reg > 0xFFFF);
-		__raw_writel(reg & 0xFFFF, S5P_VA_DMC1 + 0x30);
-	}
+	if (plan->dmc1_slowing)
+		__raw_writel(plan->dmc1_trans_refresh, S5P_VA_DMC1 + 0x30);
 
 	/*
 	 * APLL should be changed in this level
 	 * APLL -> MPLL(for stable transition) -> APLL
 	 * Some clock source's clock API  are not prepared. Do not use clock API
 	 * in below code.
+	 * Levels sharing the same APLL rate only change dividers and skip
+	 * the MPLL detour.
 	 */
-	if (pll_changing)
-		s5pv210_cpufreq_clksrcs_APLL2MPLL(index, bus_speed_changing);
+	if (plan->pll_changing)
+		s5pv210_cpufreq_clksrcs_APLL2MPLL(index,
+				plan->bus_speed_changing);
 
 	/* ARM MCS value changed */
 	if (index <= L2) {
@@ -491,21 +778,8 @@ static int s5pv210_cpufreq_target(struct cpufreq_policy *policy,
 	}
 
 	reg = __raw_readl(S5P_CLK_DIV0);
-
-	reg &= ~(S5P_CLKDIV0_APLL_MASK | S5P_CLKDIV0_A2M_MASK
-			| S5P_CLKDIV0_HCLK200_MASK | S5P_CLKDIV0_PCLK100_MASK
-			| S5P_CLKDIV0_HCLK166_MASK | S5P_CLKDIV0_PCLK83_MASK
-			| S5P_CLKDIV0_HCLK133_MASK | S5P_CLKDIV0_PCLK66_MASK);
-
-	reg |= ((clkdiv_val[index][0]<<S5P_CLKDIV0_APLL_SHIFT)
-			| (clkdiv_val[index][1] << S5P_CLKDIV0_A2M_SHIFT)
-			| (clkdiv_val[index][2] << S5P_CLKDIV0_HCLK200_SHIFT)
-			| (clkdiv_val[index][3] << S5P_CLKDIV0_PCLK100_SHIFT)
-			| (clkdiv_val[index][4] << S5P_CLKDIV0_HCLK166_SHIFT)
-			| (clkdiv_val[index][5] << S5P_CLKDIV0_PCLK83_SHIFT)
-			| (clkdiv_val[index][6] << S5P_CLKDIV0_HCLK133_SHIFT)
-			| (clkdiv_val[index][7] << S5P_CLKDIV0_PCLK66_SHIFT));
-
+	reg &= ~CLKDIV0_CPUFREQ_MASK;
+	reg |= clkdiv0_reg[index];
 	__raw_writel(reg, S5P_CLK_DIV0);
 
 	do {
@@ -520,67 +794,123 @@ static int s5pv210_cpufreq_target(struct cpufreq_policy *policy,
 		__raw_writel(reg, S5P_ARM_MCS_CON);
 	}
 
-	if (pll_changing)
-		s5pv210_cpufreq_clksrcs_MPLL2APLL(index, bus_speed_changing);
+	if (plan->pll_changing)
+		s5pv210_cpufreq_clksrcs_MPLL2APLL(index,
+				plan->bus_speed_changing);
 
 	/*
 	 * Adjust DMC0 refresh ratio according to the rate of DMC0
 	 * The DIV value of DMC0 clock changes and SRC value is not controlled.
 	 * We assume that no one changes SRC value of DMC0 clock, either.
 	 */
-	reg = __raw_readl(S5P_CLK_DIV6);
-	reg &= ~S5P_CLKDIV6_ONEDRAM_MASK;
-	reg |= (clkdiv_val[index][8] << S5P_CLKDIV6_ONEDRAM_SHIFT);
-	/* ONEDRAM(DMC0) Clock Divider Ratio: 7+1 for L4, 3+1 for Others */
-	__raw_writel(reg, S5P_CLK_DIV6);
-	do {
-		reg = __raw_readl(S5P_CLK_DIV_STAT1);
-	} while (reg & (1 << 15));
-
-	/*
-	 * If DMC0 clock gets slower (by orginal clock speed / n),
-	 * then, the refresh rate should decrease
-	 * (by original refresh count / n) (n: divider)
-	 */
-	reg = backup_dmc0_reg * (clkdiv_val[backup_freq_level][8] + 1)
-		/ (clkdiv_val[index][8] + 1);
-	__raw_writel(reg & 0xFFFF, S5P_VA_DMC0 + 0x30);
+	if (plan->onedram_changing) {
+		reg = __raw_readl(S5P_CLK_DIV6);
+		reg &= ~S5P_CLKDIV6_ONEDRAM_MASK;
+		reg |= (clkdiv_val[index][8] << S5P_CLKDIV6_ONEDRAM_SHIFT);
+		/* ONEDRAM(DMC0) Clock Divider Ratio: 7+1 for L4, 3+1 for Others */
+		__raw_writel(reg, S5P_CLK_DIV6);
+		do {
+			reg = __raw_readl(S5P_CLK_DIV_STAT1);
+		} while (reg & (1 << 15));
+
+		__raw_writel(dmc0_refresh[index], S5P_VA_DMC0 + 0x30);
+	}
 
 	/*
 	 * Adjust DMC1 refresh ratio according to the rate of hclk_msys
 	 * (L0~L3: 200 <-> L4: 100)
-	 * If DMC1 clock gets slower (by original clock speed * n),
-	 * then, the refresh rate should decrease
-	 * (by original refresh count * n) (n : clock rate)
 	 */
-	reg = backup_dmc1_reg * clk_info[index].hclk_msys;
-	reg /= clk_info[backup_freq_level].hclk_msys;
-	__raw_writel(reg & 0xFFFF, S5P_VA_DMC1 + 0x30);
+	__raw_writel(dmc1_refresh[index], S5P_VA_DMC1 + 0x30);
 	cpufreq_notify_transition(&s3c_freqs.freqs, CPUFREQ_POSTCHANGE);
 
 	if (s3c_freqs.freqs.new < s3c_freqs.freqs.old) {
 		/* Voltage down: decrease INT first.*/
-		if (!IS_ERR_OR_NULL(arm_regulator) &&
-				!IS_ERR_OR_NULL(internal_regulator)) {
-			regulator_set_voltage(internal_regulator,
-					int_volt, int_volt_max);
-			regulator_set_voltage(arm_regulator,
-					arm_volt, arm_volt_max);
-		}
+		s5pv210_cpufreq_set_volt(arm_volt, int_volt, false);
 	}
 
 	memcpy(&s3c_freqs.old, &s3c_freqs.new, sizeof(struct s3c_freq));
 	cpufreq_debug_printk(CPUFREQ_DEBUG_DRIVER, KERN_INFO,
 			"cpufreq: Performance changed[L%d]\n", index);
-	previous_arm_volt = dvs_conf[index].arm_volt;
 
-	if (first_run)
-		first_run = false;
+	trace_cpu_frequency_transition(s3c_freqs.freqs.old,
+			s3c_freqs.freqs.new,
+			ktime_to_us(ktime_sub(ktime_get(), start)),
+			plan->pll_changing);
+
+	cur_level = index;
+
+	hw_resync = false;
 out:
 	mutex_unlock(&set_freq_lock);
 	return ret;
 }
 
+#ifdef CONFIG_S5PV210_BUSFREQ
+/* clkdiv_val row whose DSYS/PSYS/ONEDRAM dividers make up a bus level */
+static const unsigned int bus_level_row[BUS_LEVEL_MAX] = {
+	[BUS_L0] = L0,
+	[BUS_L1] = L4,
+};
+
+static enum busfreq_level cur_bus_level;
+static bool bus_level_ready;	/* dmc0_refresh[] is valid */
+
+int s5pv210_cpufreq_set_bus_level(enum busfreq_level level)
+{
+	unsigned int row, old_row, reg;
+
+	if (level >= BUS_LEVEL_MAX)
+		return -EINVAL;
+
+	mutex_lock(&set_freq_lock);
+
+	if (!bus_level_ready) {
+		mutex_unlock(&set_freq_lock);
+		return -ENODEV;
+	}
+
+	if (level == cur_bus_level)
+		goto out;
+
+	row = bus_level_row[level];
+	old_row = bus_level_row[cur_bus_level];
+
+	/* DMC0 gets slower: refresh more often before the switch */
+	if (clkdiv_val[row][8] > clkdiv_val[old_row][8])
+		__raw_writel(dmc0_refresh[row], S5P_VA_DMC0 + 0x30);
+
+	reg = __raw_readl(S5P_CLK_DIV0);
+	reg &= ~CLKDIV0_DPSYS_MASK;
+	reg |= (clkdiv_val[row][4] << S5P_CLKDIV0_HCLK166_SHIFT)
+		| (clkdiv_val[row][5] << S5P_CLKDIV0_PCLK83_SHIFT)
+		| (clkdiv_val[row][6] << S5P_CLKDIV0_HCLK133_SHIFT)
+		| (clkdiv_val[row][7] << S5P_CLKDIV0_PCLK66_SHIFT);
+	__raw_writel(reg, S5P_CLK_DIV0);
+
+	do {
+		reg = __raw_readl(S5P_CLK_DIV_STAT0);
+	} while (reg & 0xff);
+
+	reg = __raw_readl(S5P_CLK_DIV6);
+	reg &= ~S5P_CLKDIV6_ONEDRAM_MASK;
+	reg |= (clkdiv_val[row][8] << S5P_CLKDIV6_ONEDRAM_SHIFT);
+	__raw_writel(reg, S5P_CLK_DIV6);
+
+	do {
+		reg = __raw_readl(S5P_CLK_DIV_STAT1);
+	} while (reg & (1 << 15));
+
+	/* DMC0 got faster: refresh less often after the switch */
+	if (clkdiv_val[row][8] <= clkdiv_val[old_row][8])
+		__raw_writel(dmc0_refresh[row], S5P_VA_DMC0 + 0x30);
+
+	cur_bus_level = level;
+out:
+	mutex_unlock(&set_freq_lock);
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_PM
 static int s5pv210_cpufreq_suspend(struct cpufreq_policy *policy,
 		pm_message_t pmsg)
@@ -615,7 +945,11 @@ static int s5pv210_cpufreq_resume(struct cpufreq_policy *policy)
 
 	memcpy(&s3c_freqs.old, &clk_info[level],
 			sizeof(struct s3c_freq));
-	previous_arm_volt = dvs_conf[level].arm_volt;
+	cur_level = level;
+	/* Don't trust the cached voltages, the next transition sets them */
+	previous_arm_volt = 0;
+	previous_int_volt = 0;
+	hw_resync = true;
 
 	return ret;
 }
@@ -683,7 +1017,18 @@ static int __init s5pv210_cpufreq_driver_init(struct cpufreq_policy *policy)
 
 	memcpy(&s3c_freqs.old, &clk_info[level],
 			sizeof(struct s3c_freq));
-	previous_arm_volt = dvs_conf[level].arm_volt;
+	s5pv210_cpufreq_get_volt(level, &previous_arm_volt,
+				 &previous_int_volt);
+	cur_level = level;
+#ifdef CONFIG_S5PV210_BUSFREQ
+	cur_bus_level = clkdiv_val[level][8] == clkdiv_val[L4][8] ?
+		BUS_L1 : BUS_L0;
+#endif
+
+	s5pv210_cpufreq_build_plans();
+#ifdef CONFIG_S5PV210_BUSFREQ
+	bus_level_ready = true;
+#endif
 
 	return cpufreq_frequency_table_cpuinfo(policy, freq_table);
 }
@@ -709,6 +1054,194 @@ static int s5pv210_cpufreq_notifier_event(struct notifier_block *this,
 	return NOTIFY_DONE;
 }
 
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+/*
+ * The overdrive level stays in the frequency table so that it shows up
+ * in cpuinfo_max_freq, but policy->max is clamped to L0 unless the
+ * battery driver has told us that it is cool enough.
+ */
+static bool od_allowed;
+
+static void s5pv210_cpufreq_od_work(struct work_struct *work)
+{
+	cpufreq_update_policy(0);
+}
+
+static DECLARE_WORK(od_work, s5pv210_cpufreq_od_work);
+
+void s5pv210_cpufreq_update_temp(int temp)
+{
+	bool allowed = od_allowed;
+
+	if (temp >= OD_REVOKE_TEMP)
+		allowed = false;
+	else if (temp <= OD_ALLOW_TEMP)
+		allowed = true;
+
+	if (allowed == od_allowed)
+		return;
+
+	od_allowed = allowed;
+	pr_info("S5PV210 CPUFREQ: overdrive %s at %d.%d C\n",
+			allowed ? "allowed" : "revoked", temp / 10,
+			abs(temp % 10));
+	schedule_work(&od_work);
+}
+EXPORT_SYMBOL_GPL(s5pv210_cpufreq_update_temp);
+
+static int s5pv210_cpufreq_policy_notifier(struct notifier_block *nb,
+		unsigned long event, void *data)
+{
+	struct cpufreq_policy *policy = data;
+
+	if (event != CPUFREQ_ADJUST || od_allowed)
+		return NOTIFY_DONE;
+
+	cpufreq_verify_within_limits(policy, 0, clk_info[L0].armclk);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block s5pv210_cpufreq_policy_nb = {
+	.notifier_call = s5pv210_cpufreq_policy_notifier,
+};
+#endif
+
+static void __init s5pv210_cpufreq_asv_init(void)
+{
+	u32 reg = __raw_readl(S5PV210_ASV_INFO);
+	unsigned int ids, hpm;
+	int i;
+
+	ids = (reg >> S5PV210_ASV_IDS_SHIFT) & S5PV210_ASV_IDS_MASK;
+	hpm = (reg >> S5PV210_ASV_HPM_SHIFT) & S5PV210_ASV_HPM_MASK;
+
+	cur_asv_group = ASV_GROUP_TYPICAL;
+	for (i = ASV_GROUP_MAX - 1; i > ASV_GROUP_TYPICAL; i--) {
+		if (ids >= asv_group_limit[i][0] &&
+		    hpm >= asv_group_limit[i][1]) {
+			cur_asv_group = i;
+			break;
+		}
+	}
+
+	pr_info("S5PV210 CPUFREQ: IDS %u HPM %u, ASV group %d\n",
+			ids, hpm, cur_asv_group);
+
+	if (cur_asv_group == ASV_GROUP_TYPICAL)
+		return;
+
+	/* Never go above what the board asked for */
+	for (i = 0; i < ARRAY_SIZE(dvs_conf); i++) {
+		dvs_conf[i].arm_volt = min(dvs_conf[i].arm_volt,
+				asv_dvs_conf[cur_asv_group][i].arm_volt);
+		dvs_conf[i].int_volt = min(dvs_conf[i].int_volt,
+				asv_dvs_conf[cur_asv_group][i].int_volt);
+	}
+}
+
+static ssize_t show_asv_group(struct cpufreq_policy *policy, char *buf)
+{
+	return sprintf(buf, "%d\n", cur_asv_group);
+}
+
+static ssize_t show_voltage_offset(struct cpufreq_policy *policy, char *buf)
+{
+	unsigned long arm_volt, int_volt;
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&set_freq_lock);
+	for (i = 0; freq_table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		s5pv210_cpufreq_get_volt(freq_table[i].index,
+					 &arm_volt, &int_volt);
+		len += sprintf(buf + len, "%u %ld %ld %lu %lu\n",
+				freq_table[i].frequency,
+				dvs_offset[freq_table[i].index].arm_volt,
+				dvs_offset[freq_table[i].index].int_volt,
+				arm_volt, int_volt);
+	}
+	mutex_unlock(&set_freq_lock);
+
+	return len;
+}
+
+/*
+ * Input: "<freq in kHz> <arm offset in uV> <int offset in uV>"
+ *
+ * The resulting voltages must stay within [ASV_VOLT_MIN, *_volt_max],
+ * on the regulator step, and the ARM voltage must not drop below the
+ * one of a slower level or exceed the one of a faster level.
+ */
+static ssize_t store_voltage_offset(struct cpufreq_policy *policy,
+		const char *buf, size_t count)
+{
+	unsigned int freq, index;
+	long arm_off, int_off;
+	unsigned long arm_volt, int_volt, volt, other;
+	int i, ret;
+
+	if (sscanf(buf, "%u %ld %ld", &freq, &arm_off, &int_off) != 3)
+		return -EINVAL;
+
+	for (i = 0; freq_table[i].frequency != CPUFREQ_TABLE_END; i++)
+		if (freq_table[i].frequency == freq)
+			break;
+	if (freq_table[i].frequency == CPUFREQ_TABLE_END)
+		return -EINVAL;
+	index = freq_table[i].index;
+
+	if (arm_off % ASV_VOLT_STEP || int_off % ASV_VOLT_STEP)
+		return -EINVAL;
+
+	arm_volt = dvs_conf[index].arm_volt + arm_off;
+	int_volt = dvs_conf[index].int_volt + int_off;
+	if ((long)arm_volt < ASV_VOLT_MIN || arm_volt > arm_volt_max ||
+	    (long)int_volt < ASV_VOLT_MIN || int_volt > int_volt_max)
+		return -EINVAL;
+
+	mutex_lock(&set_freq_lock);
+
+	/* freq_table is sorted from the fastest to the slowest level */
+	ret = -EINVAL;
+	if (i > 0) {
+		s5pv210_cpufreq_get_volt(freq_table[i - 1].index,
+					 &volt, &other);
+		if (arm_volt > volt)
+			goto out;
+	}
+	if (freq_table[i + 1].frequency != CPUFREQ_TABLE_END) {
+		s5pv210_cpufreq_get_volt(freq_table[i + 1].index,
+					 &volt, &other);
+		if (arm_volt < volt)
+			goto out;
+	}
+
+	dvs_offset[index].arm_volt = arm_off;
+	dvs_offset[index].int_volt = int_off;
+
+	/* Apply right away if we are running at this level */
+	ret = 0;
+	if (index == cur_level) {
+		s5pv210_cpufreq_get_volt(index, &arm_volt, &int_volt);
+		ret = s5pv210_cpufreq_set_volt(arm_volt, int_volt, true);
+	}
+out:
+	mutex_unlock(&set_freq_lock);
+
+	return ret ? ret : count;
+}
+
+cpufreq_freq_attr_ro(asv_group);
+cpufreq_freq_attr_rw(voltage_offset);
+
+static struct freq_attr *s5pv210_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	&asv_group,
+	&voltage_offset,
+	NULL,
+};
+
 static struct cpufreq_driver s5pv210_cpufreq_driver = {
 	.flags		= CPUFREQ_STICKY,
 	.verify		= s5pv210_cpufreq_verify_speed,
@@ -716,6 +1249,7 @@ static struct cpufreq_driver s5pv210_cpufreq_driver = {
 	.get		= s5pv210_cpufreq_getspeed,
 	.init		= s5pv210_cpufreq_driver_init,
 	.name		= "s5pv210",
+	.attr		= s5pv210_cpufreq_attr,
 #ifdef CONFIG_PM
 	.suspend	= s5pv210_cpufreq_suspend,
 	.resume		= s5pv210_cpufreq_resume,
@@ -745,6 +1279,8 @@ static int __init s5pv210_cpufreq_probe(struct platform_device *pdev)
 		}
 	}
 
+	s5pv210_cpufreq_asv_init();
+
 #ifdef CONFIG_REGULATOR
 	arm_regulator = regulator_get_exclusive(NULL, "vddarm");
 	if (IS_ERR(arm_regulator)) {
@@ -763,6 +1299,10 @@ error:
 finish:
 #endif
 	register_pm_notifier(&s5pv210_cpufreq_notifier);
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	cpufreq_register_notifier(&s5pv210_cpufreq_policy_nb,
+				  CPUFREQ_POLICY_NOTIFIER);
+#endif
 
 	return cpufreq_register_driver(&s5pv210_cpufreq_driver);
 }
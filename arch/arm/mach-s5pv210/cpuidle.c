@@ -15,27 +15,97 @@
 #include <linux/platform_device.h>
 #include <linux/cpuidle.h>
 #include <linux/io.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <asm/irq.h>
 #include <asm/proc-fns.h>
 #include <asm/cacheflush.h>
+#include <asm/fiq_glue.h>
+#include <asm/system.h>
+#include <asm/vfp.h>
 
 #include <mach/map.h>
 #include <mach/regs-irq.h>
 #include <mach/regs-clock.h>
+#include <mach/power-domain.h>
 #include <plat/pm.h>
 #include <plat/devs.h>
 
 #include <mach/dma.h>
 #include <mach/regs-gpio.h>
 
-#define S5PC110_MAX_STATES	1
+#define S5PC110_MAX_STATES	3
+
+/* Idle states, in order of increasing depth */
+enum {
+	S5P_IDLE_WFI,		/* ARM clock gating */
+	S5P_IDLE_AFTR,		/* ARM off, top block on */
+	S5P_IDLE_TOP_RET,	/* ARM off, top block retention */
+};
+
+/* log2 residency buckets: [1us, 2us), [2us, 4us), ... [2^(n-1)us, inf) */
+#define S5P_IDLE_HIST_BUCKETS	20
+#define S5P_IDLE_NR_VIC		4
+#define S5P_IDLE_NR_WAKE_IRQS	(S5P_IDLE_NR_VIC * 32)
+
+struct s5p_idle_stats {
+	unsigned long	residency[S5P_IDLE_HIST_BUCKETS];
+	unsigned long	wakeup[S5P_IDLE_NR_WAKE_IRQS];
+	unsigned long	demoted;
+};
+
+static struct s5p_idle_stats s5p_idle_stats[S5PC110_MAX_STATES];
+
+static void __iomem *s5p_idle_vic[S5P_IDLE_NR_VIC] = {
+	S5P_VA_VIC0, S5P_VA_VIC1, S5P_VA_VIC2, S5P_VA_VIC3,
+};
+
+/*
+ * Convert an idle interval to microseconds and record it in the residency
+ * histogram of @state, along with the interrupts that ended the idle
+ * period.  The interval is read from the clocksource through ktime_get(),
+ * as sched_clock() only counts jiffies unless CONFIG_HRT_RTC is set.
+ * Must be called before interrupts are re-enabled so the wakeup source is
+ * still pending in the VICs.
+ */
+static int s5p_idle_account(int state, ktime_t before, ktime_t after)
+{
+	struct s5p_idle_stats *stats = &s5p_idle_stats[state];
+	unsigned long pending;
+	int idle_time, bucket, i;
+
+	idle_time = (int)ktime_us_delta(after, before);
+
+	bucket = idle_time > 0 ? fls(idle_time) - 1 : 0;
+	if (bucket >= S5P_IDLE_HIST_BUCKETS)
+		bucket = S5P_IDLE_HIST_BUCKETS - 1;
+	stats->residency[bucket]++;
+
+	for (i = 0; i < S5P_IDLE_NR_VIC; i++) {
+		pending = __raw_readl(s5p_idle_vic[i] + VIC_IRQ_STATUS);
+		while (pending) {
+			int bit = __ffs(pending);
+
+			stats->wakeup[i * 32 + bit]++;
+			pending &= ~(1UL << bit);
+		}
+	}
+
+	return idle_time;
+}
 
 static void s5p_enter_idle(void)
 {
 	unsigned long tmp;
 
 	tmp = __raw_readl(S5P_IDLE_CFG);
-	tmp &= ~((3<<30)|(3<<28)|(1<<0));
-	tmp |= ((2<<30)|(2<<28));
+	tmp &= ~(S5P_IDLE_CFG_TL_MASK | S5P_IDLE_CFG_TM_MASK |
+		 S5P_IDLE_CFG_DIDLE);
+	tmp |= (S5P_IDLE_CFG_TL_ON | S5P_IDLE_CFG_TM_ON);
 	__raw_writel(tmp, S5P_IDLE_CFG);
 
 	tmp = __raw_readl(S5P_PWR_CFG);
@@ -49,21 +119,206 @@ static void s5p_enter_idle(void)
 static int s5p_enter_idle_normal(struct cpuidle_device *dev,
 				struct cpuidle_state *state)
 {
-	struct timeval before, after;
+	ktime_t before, after;
 	int idle_time;
 
 	local_irq_disable();
-	do_gettimeofday(&before);
+	before = ktime_get();
 
 	s5p_enter_idle();
 
-	do_gettimeofday(&after);
+	after = ktime_get();
+	idle_time = s5p_idle_account(S5P_IDLE_WFI, before, after);
 	local_irq_enable();
-	idle_time = (after.tv_sec - before.tv_sec) * USEC_PER_SEC +
-			(after.tv_usec - before.tv_usec);
 	return idle_time;
 }
 
+#ifdef CONFIG_PM
+static unsigned long s5p_idle_regs_save[16];
+
+/*
+ * Bus masters that keep running without the ARM core.  Their clocks are
+ * only enabled while a client holds them, so an enabled gate means a
+ * transfer may be in flight and the ARM must stay up to service it.
+ */
+#define S5P_IDLE_BM_IP0		(S5P_CLKGATE_IP0_MDMA | \
+				 S5P_CLKGATE_IP0_PDMA0 | \
+				 S5P_CLKGATE_IP0_PDMA1 | \
+				 S5P_CLKGATE_IP0_FIMC0 | \
+				 S5P_CLKGATE_IP0_FIMC1 | \
+				 S5P_CLKGATE_IP0_FIMC2 | \
+				 S5P_CLKGATE_IP0_MFC | \
+				 S5P_CLKGATE_IP0_JPEG | \
+				 S5P_CLKGATE_IP0_ROTATOR)
+
+#define S5P_IDLE_BM_IP3		(S5P_CLKGATE_IP3_I2S0 | \
+				 S5P_CLKGATE_IP3_I2S1 | \
+				 S5P_CLKGATE_IP3_I2S2 | \
+				 S5P_CLKGATE_IP3_PCM0 | \
+				 S5P_CLKGATE_IP3_PCM1 | \
+				 S5P_CLKGATE_IP3_PCM2)
+
+/* Blocks that need the top block bus clocked, not just retained */
+#define S5P_IDLE_TOP_IP0	(S5P_CLKGATE_IP0_G2D | \
+				 S5P_CLKGATE_IP0_G3D)
+
+#define S5P_IDLE_TOP_IP1	(S5P_CLKGATE_IP1_USBOTG | \
+				 S5P_CLKGATE_IP1_USBHOST | \
+				 S5P_CLKGATE_IP1_NFCON)
+
+#define S5P_IDLE_TOP_IP2	(S5P_CLKGATE_IP2_HSMMC0 | \
+				 S5P_CLKGATE_IP2_HSMMC1 | \
+				 S5P_CLKGATE_IP2_HSMMC2 | \
+				 S5P_CLKGATE_IP2_HSMMC3)
+
+#define S5P_IDLE_TOP_PD		(S5PV210_PD_LCD | \
+				 S5PV210_PD_CAM | \
+				 S5PV210_PD_TV | \
+				 S5PV210_PD_MFC | \
+				 S5PV210_PD_G3D | \
+				 S5PV210_PD_AUDIO)
+
+static int s5p_idle_bm_busy(void)
+{
+	if (__raw_readl(S5P_CLKGATE_IP0) & S5P_IDLE_BM_IP0)
+		return 1;
+
+	if (__raw_readl(S5P_CLKGATE_IP3) & S5P_IDLE_BM_IP3)
+		return 1;
+
+	return 0;
+}
+
+static int s5p_idle_top_busy(void)
+{
+	if (__raw_readl(S5P_NORMAL_CFG) & S5P_IDLE_TOP_PD)
+		return 1;
+
+	if (__raw_readl(S5P_CLKGATE_IP0) & S5P_IDLE_TOP_IP0)
+		return 1;
+
+	if (__raw_readl(S5P_CLKGATE_IP1) & S5P_IDLE_TOP_IP1)
+		return 1;
+
+	if (__raw_readl(S5P_CLKGATE_IP2) & S5P_IDLE_TOP_IP2)
+		return 1;
+
+	return 0;
+}
+
+static void s5p_idle_wfi(void)
+{
+	unsigned long tmp = 0;
+
+	/* drain the write buffer before the power controller takes over;
+	 * we only get past the WFI if a wakeup source was already pending */
+	asm volatile("mcr p15, 0, %0, c7, c10, 5\n\t"
+		     "mcr p15, 0, %0, c7, c10, 4\n\t"
+		     "wfi" : : "r" (tmp) : "memory");
+}
+
+/*
+ * Power the ARM core off and let the power controller bring it back
+ * through s3c_cpu_resume.  L2 is kept in retention; the top block is
+ * either left on or put in retention depending on @top_on.
+ */
+static void s5p_enter_didle(bool top_on)
+{
+	unsigned long tmp;
+	int i;
+
+	/* only the EINTs that are currently unmasked may wake us */
+	tmp = 0;
+	for (i = 0; i < 4; i++)
+		tmp |= (__raw_readl(S5P_EINT_MASK(i)) & 0xff) << (i * 8);
+	__raw_writel(tmp, S5P_EINT_WAKEUP_MASK);
+
+	/* any other interrupt source is a wakeup source */
+	tmp = __raw_readl(S5P_WAKEUP_MASK);
+	tmp &= ~0xffff;
+	__raw_writel(tmp, S5P_WAKEUP_MASK);
+
+	__raw_writel(virt_to_phys(s3c_cpu_resume), S5P_INFORM0);
+	s3c_sleep_save_phys = virt_to_phys(s5p_idle_regs_save);
+
+	tmp = __raw_readl(S5P_IDLE_CFG);
+	tmp &= ~(S5P_IDLE_CFG_TL_MASK | S5P_IDLE_CFG_TM_MASK |
+		 S5P_IDLE_CFG_L2_MASK | S5P_IDLE_CFG_DIDLE);
+	if (top_on)
+		tmp |= (S5P_IDLE_CFG_TL_ON | S5P_IDLE_CFG_TM_ON);
+	else
+		tmp |= (S5P_IDLE_CFG_TL_RET | S5P_IDLE_CFG_TM_RET);
+	tmp |= (S5P_IDLE_CFG_L2_RET | S5P_IDLE_CFG_DIDLE);
+	__raw_writel(tmp, S5P_IDLE_CFG);
+
+	tmp = __raw_readl(S5P_PWR_CFG);
+	tmp &= S5P_CFG_WFI_CLEAN;
+	tmp |= S5P_CFG_WFI_IDLE;
+	__raw_writel(tmp, S5P_PWR_CFG);
+
+	/* clear wakeup_stat register for next wakeup reason */
+	__raw_writel(__raw_readl(S5P_WAKEUP_STAT), S5P_WAKEUP_STAT);
+
+	vfp_pm_save_context();
+
+	if (s5pv210_cpu_save(s5p_idle_regs_save, s5p_idle_wfi) == 0) {
+		/* the ARM was powered off, rebuild the banked mode stacks */
+		cpu_init();
+
+		fiq_glue_resume();
+		local_fiq_enable();
+
+		if (!top_on) {
+			/* release the pad retention held over top retention */
+			tmp = __raw_readl(S5P_OTHERS);
+			tmp |= (S5P_OTHERS_RET_IO | S5P_OTHERS_RET_CF |
+				S5P_OTHERS_RET_MMC | S5P_OTHERS_RET_UART);
+			__raw_writel(tmp, S5P_OTHERS);
+		}
+	}
+
+	/* back to plain WFI clock gating */
+	tmp = __raw_readl(S5P_IDLE_CFG);
+	tmp &= ~(S5P_IDLE_CFG_TL_MASK | S5P_IDLE_CFG_TM_MASK |
+		 S5P_IDLE_CFG_L2_MASK | S5P_IDLE_CFG_DIDLE);
+	tmp |= (S5P_IDLE_CFG_TL_ON | S5P_IDLE_CFG_TM_ON);
+	__raw_writel(tmp, S5P_IDLE_CFG);
+
+	tmp = __raw_readl(S5P_PWR_CFG);
+	tmp &= S5P_CFG_WFI_CLEAN;
+	__raw_writel(tmp, S5P_PWR_CFG);
+
+	__raw_writel(__raw_readl(S5P_WAKEUP_STAT), S5P_WAKEUP_STAT);
+}
+
+static int s5p_enter_idle_deep(struct cpuidle_device *dev,
+				struct cpuidle_state *state)
+{
+	ktime_t before, after;
+	bool top_on = (state == &dev->states[S5P_IDLE_AFTR]);
+	int index = top_on ? S5P_IDLE_AFTR : S5P_IDLE_TOP_RET;
+	int idle_time;
+
+	local_irq_disable();
+
+	/* demote to clock gating while the hardware still needs us */
+	if (s5p_idle_bm_busy() || (!top_on && s5p_idle_top_busy())) {
+		s5p_idle_stats[index].demoted++;
+		dev->last_state = dev->safe_state;
+		return s5p_enter_idle_normal(dev, dev->safe_state);
+	}
+
+	before = ktime_get();
+
+	s5p_enter_didle(top_on);
+
+	after = ktime_get();
+	idle_time = s5p_idle_account(index, before, after);
+	local_irq_enable();
+	return idle_time;
+}
+#endif /* CONFIG_PM */
+
 static DEFINE_PER_CPU(struct cpuidle_device, s5p_cpuidle_device);
 
 static struct cpuidle_driver s5p_idle_driver = {
@@ -71,6 +326,71 @@ static struct cpuidle_driver s5p_idle_driver = {
 	.owner =        THIS_MODULE,
 };
 
+#ifdef CONFIG_DEBUG_FS
+static int s5p_idle_stats_show(struct seq_file *s, void *unused)
+{
+	struct cpuidle_device *device = s->private;
+	int i, j;
+
+	for (i = 0; i < device->state_count; i++) {
+		struct s5p_idle_stats *stats = &s5p_idle_stats[i];
+
+		seq_printf(s, "%s: usage %llu time %llu demoted %lu\n",
+			   device->states[i].name, device->states[i].usage,
+			   device->states[i].time, stats->demoted);
+
+		seq_printf(s, "  residency (us):\n");
+		for (j = 0; j < S5P_IDLE_HIST_BUCKETS; j++) {
+			if (!stats->residency[j])
+				continue;
+			if (j == S5P_IDLE_HIST_BUCKETS - 1)
+				seq_printf(s, "    %8u+         %10lu\n",
+					   1U << j, stats->residency[j]);
+			else
+				seq_printf(s, "    %8u-%-8u %10lu\n",
+					   1U << j, (1U << (j + 1)) - 1,
+					   stats->residency[j]);
+		}
+
+		seq_printf(s, "  wakeup irq:\n");
+		for (j = 0; j < S5P_IDLE_NR_WAKE_IRQS; j++) {
+			if (!stats->wakeup[j])
+				continue;
+			seq_printf(s, "    %3d %10lu\n",
+				   S5P_IRQ_VIC0(j), stats->wakeup[j]);
+		}
+	}
+
+	return 0;
+}
+
+static int s5p_idle_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, s5p_idle_stats_show, inode->i_private);
+}
+
+/* any write clears the histograms */
+static ssize_t s5p_idle_stats_write(struct file *file,
+				    const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	local_irq_disable();
+	memset(s5p_idle_stats, 0, sizeof(s5p_idle_stats));
+	local_irq_enable();
+
+	return count;
+}
+
+static const struct file_operations s5p_idle_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= s5p_idle_stats_open,
+	.read		= seq_read,
+	.write		= s5p_idle_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif /* CONFIG_DEBUG_FS */
+
 /* Initialize CPU idle by registering the idle states */
 static int s5p_init_cpuidle(void)
 {
@@ -82,18 +402,48 @@ static int s5p_init_cpuidle(void)
 	device->state_count = 1;
 
 	/* Wait for interrupt state */
-	device->states[0].enter = s5p_enter_idle_normal;
-	device->states[0].exit_latency = 1;	/* uS */
-	device->states[0].target_residency = 10000;
-	device->states[0].flags = CPUIDLE_FLAG_TIME_VALID;
-	strcpy(device->states[0].name, "IDLE");
-	strcpy(device->states[0].desc, "ARM clock gating - WFI");
+	device->states[S5P_IDLE_WFI].enter = s5p_enter_idle_normal;
+	device->states[S5P_IDLE_WFI].exit_latency = 1;	/* uS */
+	device->states[S5P_IDLE_WFI].target_residency = 10000;
+	device->states[S5P_IDLE_WFI].flags = CPUIDLE_FLAG_TIME_VALID;
+	strcpy(device->states[S5P_IDLE_WFI].name, "IDLE");
+	strcpy(device->states[S5P_IDLE_WFI].desc, "ARM clock gating - WFI");
+
+	device->safe_state = &device->states[S5P_IDLE_WFI];
+
+#ifdef CONFIG_PM
+	/* ARM power gating, top block on */
+	device->states[S5P_IDLE_AFTR].enter = s5p_enter_idle_deep;
+	device->states[S5P_IDLE_AFTR].exit_latency = 300;	/* uS */
+	device->states[S5P_IDLE_AFTR].target_residency = 5000;
+	device->states[S5P_IDLE_AFTR].flags = CPUIDLE_FLAG_TIME_VALID |
+						CPUIDLE_FLAG_CHECK_BM;
+	strcpy(device->states[S5P_IDLE_AFTR].name, "AFTR");
+	strcpy(device->states[S5P_IDLE_AFTR].desc, "ARM power gating - top on");
+
+	/* ARM power gating, top block retention */
+	device->states[S5P_IDLE_TOP_RET].enter = s5p_enter_idle_deep;
+	device->states[S5P_IDLE_TOP_RET].exit_latency = 600;	/* uS */
+	device->states[S5P_IDLE_TOP_RET].target_residency = 20000;
+	device->states[S5P_IDLE_TOP_RET].flags = CPUIDLE_FLAG_TIME_VALID |
+						CPUIDLE_FLAG_CHECK_BM;
+	strcpy(device->states[S5P_IDLE_TOP_RET].name, "TOP-RET");
+	strcpy(device->states[S5P_IDLE_TOP_RET].desc,
+		"ARM power gating - top ret");
+
+	device->state_count = S5PC110_MAX_STATES;
+#endif
 
 	if (cpuidle_register_device(device)) {
 		printk(KERN_ERR "s5p_init_cpuidle: Failed registering\n");
 		return -EIO;
 	}
 
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("s5p_idle_stats", 0644, NULL, device,
+			    &s5p_idle_stats_fops);
+#endif
+
 	return 0;
 }
 
@@ -0,0 +1,47 @@
+/* linux/arch/arm/mach-s5pv210/include/mach/busfreq.h
+ *
+ * Copyright (c) 2010 Samsung Electronics Co., Ltd.
+ *		http://www.samsung.com/
+ *
+ * S5PV210 - DMC/bus frequency scaling
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARCH_BUSFREQ_H
+#define __ASM_ARCH_BUSFREQ_H __FILE__
+
+/*
+ * Bus levels for the MPLL based domains:
+ * ONEDRAM(DMC0) / HCLK_DSYS / HCLK_PSYS
+ */
+enum busfreq_level {
+	BUS_L0 = 0,	/* 200 / 166 / 133 MHz */
+	BUS_L1,		/* 100 /  83 /  66 MHz */
+	BUS_LEVEL_MAX,
+};
+
+/* Media blocks that may hold the bus at BUS_L0 */
+enum busfreq_client {
+	BUSFREQ_FIMC0 = 0,
+	BUSFREQ_FIMC1,
+	BUSFREQ_FIMC2,
+	BUSFREQ_MFC,
+	BUSFREQ_FB,
+	BUSFREQ_CLIENT_MAX,
+};
+
+#ifdef CONFIG_S5PV210_BUSFREQ
+extern void s5pv210_busfreq_lock(enum busfreq_client client);
+extern void s5pv210_busfreq_unlock(enum busfreq_client client);
+
+/* Provided by cpu-freq.c, which owns CLK_DIV0 */
+extern int s5pv210_cpufreq_set_bus_level(enum busfreq_level level);
+#else
+static inline void s5pv210_busfreq_lock(enum busfreq_client client) { }
+static inline void s5pv210_busfreq_unlock(enum busfreq_client client) { }
+#endif
+
+#endif /* __ASM_ARCH_BUSFREQ_H */
@@ -18,13 +18,17 @@
  * APLL M,P,S value for target frequency
  **/
 #define APLL_VAL_1664	((1<<31)|(417<<16)|(3<<8)|(0))
+#define APLL_VAL_1400	((1<<31)|(175<<16)|(3<<8)|(1))
 #define APLL_VAL_1332	((1<<31)|(444<<16)|(4<<8)|(0))
 #define APLL_VAL_1200	((1<<31)|(150<<16)|(3<<8)|(1))
 #define APLL_VAL_1000	((1<<31)|(125<<16)|(3<<8)|(1))
 #define APLL_VAL_800	((1<<31)|(100<<16)|(3<<8)|(1))
 
 enum perf_level {
-	L0 = 0,
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+	L_OD,	/* overdrive, only while the battery is cool enough */
+#endif
+	L0,
 	L1,
 	L2,
 	L3,
@@ -53,4 +57,11 @@ struct s5pv210_cpufreq_data {
 
 extern void s5pv210_cpufreq_set_platdata(struct s5pv210_cpufreq_data *pdata);
 
+/* Battery temperature in 0.1 degC, gates the overdrive level */
+#ifdef CONFIG_S5PV210_CPUFREQ_OVERDRIVE
+extern void s5pv210_cpufreq_update_temp(int temp);
+#else
+static inline void s5pv210_cpufreq_update_temp(int temp) { }
+#endif
+
 #endif /* __ASM_ARCH_CPU_FREQ_H */
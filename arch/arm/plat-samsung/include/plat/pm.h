@@ -54,6 +54,8 @@ extern void s3c_cpu_resume(void);
 
 extern void s3c2410_cpu_suspend(void);
 
+extern int  s5pv210_cpu_save(unsigned long *saveblk, void (*sleep)(void));
+
 extern unsigned long s3c_sleep_save_phys;
 
 /* sleep save info */
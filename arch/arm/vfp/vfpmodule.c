@@ -417,6 +417,25 @@ static struct sys_device vfp_pm_sysdev = {
 	.cls	= &vfp_pm_sysclass,
 };
 
+/*
+ * Save the hardware VFP state to its owning thread before the core is
+ * powered down by a low power idle state.  The next VFP instruction
+ * will then fault and reload the saved context.  Must be called with
+ * interrupts disabled.
+ */
+void vfp_pm_save_context(void)
+{
+	unsigned int cpu = smp_processor_id();
+	u32 fpexc = fmrx(FPEXC);
+
+	if (last_VFP_context[cpu]) {
+		fmxr(FPEXC, fpexc | FPEXC_EN);
+		vfp_save_state(last_VFP_context[cpu], fpexc);
+		fmxr(FPEXC, fpexc & ~FPEXC_EN);
+		last_VFP_context[cpu] = NULL;
+	}
+}
+
 static void vfp_pm_init(void)
 {
 	sysdev_class_register(&vfp_pm_sysclass);
@@ -16,6 +16,8 @@
 
 #ifdef __KERNEL__
 #include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 #include <linux/mutex.h>
 #include <linux/i2c.h>
 #include <linux/fb.h>
@@ -67,6 +69,9 @@
 
 #define FIMC_PINGPONG 2
 
+#define FIMC_CTX_REGS		19	/* registers of an output context */
+#define FIMC_REGS_SIZE		0x200
+
 /*
  * ENUMERATIONS
 */
@@ -116,6 +121,17 @@ enum fimc_overlay_mode {
 	FIMC_OVLY_NONE_MULTI_BUF	= 0x4,
 };
 
+enum fimc_preview_mode {
+	/* Preview frames only reach userspace through the capture queue */
+	FIMC_PREVIEW_NONE		= 0x0,
+	/* Scaler output goes straight to the FIMD window over local path */
+	FIMC_PREVIEW_FIFO		= 0x1,
+	/* FIMD window scans out the capture buffers, no tap */
+	FIMC_PREVIEW_DMA		= 0x2,
+	/* As above, and every shown frame is handed to dqbuf for recording */
+	FIMC_PREVIEW_DMA_TAP		= 0x3,
+};
+
 enum fimc_autoload {
 	FIMC_AUTO_LOAD,
 	FIMC_ONE_SHOT,
@@ -178,6 +194,16 @@ struct fimc_buf_set {
 	struct list_head	list;
 };
 
+/* preview frame accounting, intervals are in usec */
+struct fimc_preview_stats {
+	u32			delivered;	/* frames put on the window */
+	u32			dropped;	/* frames never shown */
+	u32			late;		/* frames after a stretched gap */
+	u32			interval;	/* running average */
+	u32			max_interval;
+	ktime_t			last;
+};
+
 /* for capture device */
 struct fimc_capinfo {
 	struct v4l2_cropcap	cropcap;
@@ -193,6 +219,15 @@ struct fimc_capinfo {
 	/* flip: V4L2_CID_xFLIP, rotate: 90, 180, 270 */
 	u32			flip;
 	u32			rotate;
+
+	/* preview to display window */
+	enum fimc_preview_mode	preview;
+	struct v4l2_window	win;
+	int			fb_id;
+	int			shown;		/* buffer on screen, -1 if none */
+	struct list_head	done;		/* shown frames for the tap */
+	spinlock_t		lock;		/* inq/done against the irq */
+	struct fimc_preview_stats stats;
 };
 
 /* for output overlay device */
@@ -246,6 +281,20 @@ struct fimc_ctx {
 	u32			flip;
 	u32			rotate;
 	enum fimc_status	status;
+
+	/* m2m: destination address image per index, written from irq */
+	struct fimc_buf_set	job[FIMC_OUTBUFS];
+	u32			batch;
+
+	/* register image built by fimc_outdev_set_ctx_param */
+	u32			regs[FIMC_CTX_REGS];
+	u32			regs_gen;
+
+	/* m2m: chained controllers, the next stage takes our dst as src */
+	struct fimc_control	*chain_next;
+	u32			chain_next_ctx;
+	struct fimc_control	*chain_prev;
+	u32			chain_prev_ctx;
 };
 
 struct fimc_outinfo {
@@ -255,6 +304,12 @@ struct fimc_outinfo {
 	struct fimc_idx		inq[FIMC_INQUEUES];
 	struct fimc_ctx		ctx[FIMC_MAX_CTXS];
 	struct fimc_ctx_idx	idxs;
+
+	/* context registers as loaded in h/w, valid until power off */
+	u32			regs[FIMC_CTX_REGS];
+	u32			regs_gen;
+	u32			regs_valid;
+	u32			regs_file[FIMC_REGS_SIZE / 4];
 };
 
 struct s3cfb_user_window {
@@ -522,6 +577,11 @@ extern int fimc_queryctrl(struct file *file, void *fh,
 					struct v4l2_queryctrl *qc);
 extern int fimc_querymenu(struct file *file, void *fh,
 					struct v4l2_querymenu *qm);
+extern void fimc_preview_frame(struct fimc_control *ctrl, int pp, int overflow);
+extern void fimc_preview_stop(struct fimc_control *ctrl);
+extern ssize_t fimc_print_preview_stats(struct fimc_control *ctrl,
+					char *buf, size_t len);
+extern void fimc_reset_preview_stats(struct fimc_control *ctrl);
 
 #if defined(CONFIG_CPU_S5PV210)
 extern int fimc_change_clksrc(struct fimc_control *ctrl, int fimc_clk);
@@ -538,6 +598,9 @@ extern int fimc_start_fifo(struct fimc_control *ctrl,
 extern int fimc_fimd_rect(const struct fimc_control *ctrl,
 					const struct fimc_ctx *ctx,
 					struct v4l2_rect *fimd_rect);
+extern int fimc_fimd_win_rect(const struct fimc_control *ctrl, u32 rotate,
+					const struct v4l2_window *win,
+					struct v4l2_rect *fimd_rect);
 extern int fimc_outdev_stop_streaming(struct fimc_control *ctrl,
 					struct fimc_ctx *ctx);
 extern int fimc_outdev_resume_dma(struct fimc_control *ctrl,
@@ -561,8 +624,14 @@ extern int fimc_s_fmt_vid_out(struct file *filp, void *fh,
 					struct v4l2_format *f);
 extern int fimc_try_fmt_vid_out(struct file *filp, void *fh,
 					struct v4l2_format *f);
-extern int fimc_output_set_dst_addr(struct fimc_control *ctrl,
+extern int fimc_outdev_prepare_job(struct fimc_control *ctrl,
 					struct fimc_ctx *ctx, int idx);
+extern int fimc_outdev_run_job(struct fimc_control *ctrl,
+					struct fimc_ctx *ctx, int idx);
+extern void fimc_outdev_done(struct fimc_control *ctrl,
+					struct fimc_ctx *ctx, int idx);
+extern void fimc_outdev_unchain(struct fimc_control *ctrl,
+					struct fimc_ctx *ctx);
 extern int fimc_init_in_queue(struct fimc_control *ctrl, struct fimc_ctx *ctx);
 extern int fimc_push_inq(struct fimc_control *ctrl,
 					struct fimc_ctx *ctx, int idx);
@@ -596,6 +665,9 @@ extern int fimc_hwset_enable_irq(struct fimc_control *ctrl,
 						int overflow, int level);
 extern int fimc_hwset_disable_irq(struct fimc_control *ctrl);
 extern int fimc_hwset_clear_irq(struct fimc_control *ctrl);
+extern void fimc_hwget_ctx_regs(struct fimc_control *ctrl, u32 *image);
+extern int fimc_hwset_ctx_regs(struct fimc_control *ctrl,
+					const u32 *image, const u32 *loaded);
 extern int fimc_hwset_reset(struct fimc_control *ctrl);
 extern int fimc_hwset_clksrc(struct fimc_control *ctrl, int src_clk);
 extern int fimc_hwget_overflow_state(struct fimc_control *ctrl);
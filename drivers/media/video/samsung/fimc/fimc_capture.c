@@ -430,6 +430,326 @@ static int fimc_update_hwaddr(struct fimc_control *ctrl)
 	return 0;
 }
 
+/*
+ * Preview to the display window.
+ *
+ * In the FIFO mode the scaler output is fed to the FIMD window of the
+ * same index over the local path and nothing is written to memory.  The
+ * local path and DMA output are exclusive on CISCCTRL, so the DMA modes
+ * keep capturing into the mmap buffers and point the window at the last
+ * completed one instead.  The irq handler rotates them: the finished
+ * buffer goes on screen, the slot is refilled from inq, and the buffer
+ * that was on screen goes back to inq or, with the tap, to the done list
+ * that dqbuf serves.  A frame is dropped when no buffer is left to refill
+ * its slot, which only happens when the tap holds on to them.
+ */
+static int fimc_preview_fb(struct fimc_control *ctrl)
+{
+	struct s3cfb_window *win;
+	int i;
+
+	for (i = 0; i < num_registered_fb; i++) {
+		win = (struct s3cfb_window *)registered_fb[i]->par;
+		if (win->id == ctrl->id)
+			return i;
+	}
+
+	return -ENODEV;
+}
+
+static int fimc_preview_start(struct fimc_control *ctrl)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	struct v4l2_rect fimd_rect;
+	struct fb_var_screeninfo var;
+	struct fb_info *fbinfo;
+	struct s3cfb_window *win;
+	u32 format = cap->fmt.pixelformat;
+	int ret;
+
+	memset(&fimd_rect, 0, sizeof(struct v4l2_rect));
+	ret = fimc_fimd_win_rect(ctrl, cap->rotate, &cap->win, &fimd_rect);
+	if (ret < 0) {
+		fimc_err("fimc_fimd_rect fail\n");
+		return -EINVAL;
+	}
+
+	if (fimd_rect.width != cap->fmt.width ||
+			fimd_rect.height != cap->fmt.height) {
+		fimc_err("%s: window %dx%d does not match capture %dx%d\n",
+				__func__, fimd_rect.width, fimd_rect.height,
+				cap->fmt.width, cap->fmt.height);
+		return -EINVAL;
+	}
+
+	if (cap->fmt.field == V4L2_FIELD_INTERLACED_TB) {
+		fimc_err("%s: interlaced preview is not supported\n",
+				__func__);
+		return -EINVAL;
+	}
+
+	fbinfo = registered_fb[cap->fb_id];
+	win = (struct s3cfb_window *)fbinfo->par;
+	memcpy(&var, &fbinfo->var, sizeof(struct fb_var_screeninfo));
+
+	if (cap->preview == FIMC_PREVIEW_FIFO) {
+		/* local path carries RGB888 only */
+		if (format != V4L2_PIX_FMT_RGB32) {
+			fimc_err("%s: FIFO preview needs RGB32\n", __func__);
+			return -EINVAL;
+		}
+
+		win->path = DATA_PATH_FIFO;
+		win->owner = DMA_MEM_NONE;
+		win->local_channel = 0;
+	} else {
+		if (format != V4L2_PIX_FMT_RGB32 &&
+				format != V4L2_PIX_FMT_RGB565) {
+			fimc_err("%s: DMA preview needs RGB\n", __func__);
+			return -EINVAL;
+		}
+
+		/* two buffers in the ping-pong slots and one on screen */
+		if (cap->nr_bufs < 3) {
+			fimc_err("%s: DMA preview needs 3 buffers\n", __func__);
+			return -EINVAL;
+		}
+
+		win->path = DATA_PATH_DMA;
+		win->owner = DMA_MEM_OTHER;
+		win->other_mem_addr = cap->bufs[cap->outq[0]].base[FIMC_ADDR_Y];
+		win->other_mem_size = cap->bufs[cap->outq[0]].length[FIMC_ADDR_Y];
+		var.bits_per_pixel = (format == V4L2_PIX_FMT_RGB32) ? 32 : 16;
+	}
+
+	/* Update WIN size */
+	var.xres_virtual = fimd_rect.width;
+	var.yres_virtual = fimd_rect.height;
+	var.xres = fimd_rect.width;
+	var.yres = fimd_rect.height;
+
+	/* Update WIN position */
+	win->x = fimd_rect.left;
+	win->y = fimd_rect.top;
+
+	var.activate = FB_ACTIVATE_FORCE;
+	ret = fb_set_var(fbinfo, &var);
+	if (ret < 0) {
+		fimc_err("fb_set_var fail (ret=%d)\n", ret);
+		return -EINVAL;
+	}
+
+	ret = fb_blank(fbinfo, FB_BLANK_UNBLANK);
+	if (ret < 0) {
+		fimc_err("%s: fb_blank: fb[%d] mode=FB_BLANK_UNBLANK\n",
+				__func__, cap->fb_id);
+		return -EINVAL;
+	}
+	ctrl->fb.is_enable = 1;
+
+	if (cap->preview == FIMC_PREVIEW_FIFO)
+		fimc_hwset_enable_lcdfifo(ctrl);
+
+	cap->shown = -1;
+	memset(&cap->stats, 0, sizeof(cap->stats));
+
+	return 0;
+}
+
+void fimc_preview_stop(struct fimc_control *ctrl)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	unsigned long flags;
+	int ret;
+
+	if (cap->preview == FIMC_PREVIEW_FIFO)
+		fimc_hwset_disable_lcdfifo(ctrl);
+
+	if (ctrl->fb.is_enable == 1) {
+		ret = fb_blank(registered_fb[cap->fb_id], FB_BLANK_POWERDOWN);
+		if (ret < 0)
+			fimc_err("%s: fb_blank: fb[%d] " \
+					"mode=FB_BLANK_POWERDOWN\n",
+					__func__, cap->fb_id);
+		ctrl->fb.is_enable = 0;
+	}
+
+	spin_lock_irqsave(&cap->lock, flags);
+	list_splice_tail_init(&cap->done, &cap->inq);
+	if (cap->shown >= 0)
+		fimc_add_inqueue(ctrl, cap->shown);
+	cap->shown = -1;
+	spin_unlock_irqrestore(&cap->lock, flags);
+}
+
+static int fimc_set_preview(struct fimc_control *ctrl, int mode)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	int fb_id;
+
+	if (ctrl->status != FIMC_STREAMOFF) {
+		fimc_err("%s: FIMC is running\n", __func__);
+		return -EBUSY;
+	}
+
+	if (mode < FIMC_PREVIEW_NONE || mode > FIMC_PREVIEW_DMA_TAP)
+		return -EINVAL;
+
+	if (mode != FIMC_PREVIEW_NONE) {
+		fb_id = fimc_preview_fb(ctrl);
+		if (fb_id < 0) {
+			fimc_err("%s: fb[%d] is not registered. " \
+					"must be registered for preview\n",
+					__func__, ctrl->id);
+			return -ENODEV;
+		}
+		cap->fb_id = fb_id;
+	}
+
+	cap->preview = mode;
+
+	return 0;
+}
+
+/* Called from the capture irq with the frame that has just completed. */
+void fimc_preview_frame(struct fimc_control *ctrl, int pp, int overflow)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	struct fimc_preview_stats *stats = &cap->stats;
+	struct s3cfb_window *win;
+	struct fb_info *fbinfo;
+	ktime_t now = ktime_get();
+	u32 gap;
+	int idx, prev;
+
+	spin_lock(&cap->lock);
+
+	if (stats->last.tv64) {
+		gap = (u32)ktime_us_delta(now, stats->last);
+		if (stats->interval && gap > stats->interval * 3 / 2)
+			stats->late++;
+		if (stats->interval)
+			stats->interval += ((int)gap - (int)stats->interval) / 8;
+		else
+			stats->interval = gap;
+		stats->max_interval = max(stats->max_interval, gap);
+	}
+	stats->last = now;
+
+	if (overflow) {
+		stats->dropped++;
+		goto out;
+	}
+
+	if (cap->preview == FIMC_PREVIEW_FIFO) {
+		stats->delivered++;
+		goto out;
+	}
+
+	/* keep the frame in its slot if there is nothing to refill it */
+	idx = cap->outq[pp];
+	if (fimc_add_outqueue(ctrl, pp) < 0) {
+		stats->dropped++;
+		goto out;
+	}
+
+	fbinfo = registered_fb[cap->fb_id];
+	win = (struct s3cfb_window *)fbinfo->par;
+	win->other_mem_addr = cap->bufs[idx].base[FIMC_ADDR_Y];
+	if (fb_pan_display(fbinfo, &fbinfo->var) < 0)
+		fimc_err("%s: fb_pan_display fail\n", __func__);
+
+	stats->delivered++;
+
+	prev = cap->shown;
+	cap->shown = idx;
+	if (prev < 0)
+		goto out;
+
+	if (cap->preview == FIMC_PREVIEW_DMA_TAP) {
+		list_add_tail(&cap->bufs[prev].list, &cap->done);
+		cap->irq = 1;
+	} else {
+		list_add_tail(&cap->bufs[prev].list, &cap->inq);
+	}
+
+out:
+	spin_unlock(&cap->lock);
+}
+
+static int fimc_preview_dqbuf(struct fimc_control *ctrl,
+			      struct v4l2_buffer *b)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	struct fimc_buf_set *buf;
+	unsigned long flags;
+
+	if (cap->preview != FIMC_PREVIEW_DMA_TAP)
+		return -EINVAL;
+
+	spin_lock_irqsave(&cap->lock, flags);
+
+	if (list_empty(&cap->done)) {
+		spin_unlock_irqrestore(&cap->lock, flags);
+		return -EAGAIN;
+	}
+
+	buf = list_first_entry(&cap->done, struct fimc_buf_set, list);
+	list_del(&buf->list);
+	b->index = buf->id;
+	cap->irq = !list_empty(&cap->done);
+
+	spin_unlock_irqrestore(&cap->lock, flags);
+
+	fimc_dbg("%s: buffer(%d) from preview\n", __func__, b->index);
+
+	return 0;
+}
+
+ssize_t fimc_print_preview_stats(struct fimc_control *ctrl,
+				 char *buf, size_t len)
+{
+	struct fimc_preview_stats stats;
+	unsigned long flags;
+	int mode;
+
+	/* fimc_release() frees cap under ctrl->lock */
+	mutex_lock(&ctrl->lock);
+
+	if (!ctrl->cap) {
+		mutex_unlock(&ctrl->lock);
+		return scnprintf(buf, len, "no capture\n");
+	}
+
+	spin_lock_irqsave(&ctrl->cap->lock, flags);
+	stats = ctrl->cap->stats;
+	mode = ctrl->cap->preview;
+	spin_unlock_irqrestore(&ctrl->cap->lock, flags);
+
+	mutex_unlock(&ctrl->lock);
+
+	return scnprintf(buf, len,
+		"preview: mode %d delivered %u dropped %u late %u "
+		"interval avg %u max %u (usec)\n",
+		mode, stats.delivered, stats.dropped, stats.late,
+		stats.interval, stats.max_interval);
+}
+
+void fimc_reset_preview_stats(struct fimc_control *ctrl)
+{
+	unsigned long flags;
+
+	mutex_lock(&ctrl->lock);
+
+	if (ctrl->cap) {
+		spin_lock_irqsave(&ctrl->cap->lock, flags);
+		memset(&ctrl->cap->stats, 0, sizeof(ctrl->cap->stats));
+		spin_unlock_irqrestore(&ctrl->cap->lock, flags);
+	}
+
+	mutex_unlock(&ctrl->lock);
+}
+
 int fimc_g_parm(struct file *file, void *fh, struct v4l2_streamparm *a)
 {
 	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
@@ -837,6 +1157,11 @@ int fimc_s_fmt_vid_capture(struct file *file, void *fh, struct v4l2_format *f)
 	cap = ctrl->cap;
 	memset(cap, 0, sizeof(*cap));
 	memcpy(&cap->fmt, &f->fmt.pix, sizeof(cap->fmt));
+	spin_lock_init(&cap->lock);
+	INIT_LIST_HEAD(&cap->inq);
+	INIT_LIST_HEAD(&cap->done);
+	cap->shown = -1;
+	cap->fb_id = -1;
 
 	/*
 	 * Note that expecting format only can be with
@@ -979,6 +1304,8 @@ int fimc_reqbufs_capture(void *fh, struct v4l2_requestbuffers *b)
 	fimc_dbg("%s: requested %d buffers\n", __func__, b->count);
 
 	INIT_LIST_HEAD(&cap->inq);
+	INIT_LIST_HEAD(&cap->done);
+	cap->shown = -1;
 	fimc_free_buffers(ctrl);
 
 	switch (cap->fmt.pixelformat) {
@@ -1124,6 +1451,22 @@ int fimc_g_ctrl_capture(void *fh, struct v4l2_control *c)
 		c->value = (ctrl->cap->flip & FIMC_YFLIP) ? 1 : 0;
 		break;
 
+	case V4L2_CID_FIMC_PREVIEW:
+		c->value = ctrl->cap->preview;
+		break;
+
+	case V4L2_CID_FIMC_PREVIEW_DELIVERED:
+		c->value = ctrl->cap->stats.delivered;
+		break;
+
+	case V4L2_CID_FIMC_PREVIEW_DROPPED:
+		c->value = ctrl->cap->stats.dropped;
+		break;
+
+	case V4L2_CID_FIMC_PREVIEW_LATE:
+		c->value = ctrl->cap->stats.late;
+		break;
+
 	default:
 		/* get ctrl supported by subdev */
 		mutex_unlock(&ctrl->v4l2_lock);
@@ -1172,6 +1515,10 @@ int fimc_s_ctrl_capture(void *fh, struct v4l2_control *c)
 		ctrl->cap->flip |= FIMC_YFLIP;
 		break;
 
+	case V4L2_CID_FIMC_PREVIEW:
+		ret = fimc_set_preview(ctrl, c->value);
+		break;
+
 	case V4L2_CID_PADDR_Y:
 		c->value = ctrl->cap->bufs[c->value].base[FIMC_ADDR_Y];
 		break;
@@ -1508,6 +1855,9 @@ static void fimc_reset_capture(struct fimc_control *ctrl)
 
 	fimc_stop_capture(ctrl);
 
+	if (ctrl->cap->preview != FIMC_PREVIEW_NONE)
+		fimc_preview_stop(ctrl);
+
 	for (i = 0; i < FIMC_PINGPONG; i++)
 		fimc_add_inqueue(ctrl, ctrl->cap->outq[i]);
 
@@ -1607,6 +1957,15 @@ int fimc_streamon_capture(void *fh)
 	if (ctrl->cap->fmt.colorspace == V4L2_COLORSPACE_JPEG)
 		fimc_hwset_scaler_bypass(ctrl);
 
+	if (cap->preview != FIMC_PREVIEW_NONE) {
+		ret = fimc_preview_start(ctrl);
+		if (ret < 0) {
+			fimc_reset_capture(ctrl);
+			mutex_unlock(&ctrl->v4l2_lock);
+			return ret;
+		}
+	}
+
 	fimc_start_capture(ctrl);
 
 	if (ctrl->cap->fmt.colorspace == V4L2_COLORSPACE_JPEG &&
@@ -1652,6 +2011,7 @@ int fimc_streamoff_capture(void *fh)
 int fimc_qbuf_capture(void *fh, struct v4l2_buffer *b)
 {
 	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
+	unsigned long flags;
 
 	if (!ctrl->cap || !ctrl->cap->nr_bufs) {
 		fimc_err("%s: Invalid capture setting.\n", __func__);
@@ -1664,7 +2024,9 @@ int fimc_qbuf_capture(void *fh, struct v4l2_buffer *b)
 	}
 
 	mutex_lock(&ctrl->v4l2_lock);
+	spin_lock_irqsave(&ctrl->cap->lock, flags);
 	fimc_add_inqueue(ctrl, b->index);
+	spin_unlock_irqrestore(&ctrl->cap->lock, flags);
 	mutex_unlock(&ctrl->v4l2_lock);
 
 	return 0;
@@ -1696,6 +2058,13 @@ int fimc_dqbuf_capture(void *fh, struct v4l2_buffer *b)
 		return -EINVAL;
 	}
 
+	/* the preview owns the buffers, only the tap hands them out */
+	if (cap->preview != FIMC_PREVIEW_NONE) {
+		ret = fimc_preview_dqbuf(ctrl, b);
+		mutex_unlock(&ctrl->v4l2_lock);
+		return ret;
+	}
+
 	/* find out the real index */
 	pp = ((fimc_hwget_frame_count(ctrl) + 2) % 4);
 
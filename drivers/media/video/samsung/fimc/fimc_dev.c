@@ -35,6 +35,7 @@
 #include <linux/videodev2_samsung.h>
 #include <linux/delay.h>
 #include <plat/regs-fimc.h>
+#include <mach/busfreq.h>
 
 #include "fimc.h"
 
@@ -122,8 +123,16 @@ void fimc_clk_en(struct fimc_control *ctrl, bool on)
 			/* Turn on fimc power domain regulator */
 			regulator_enable(ctrl->regulator);
 			clk_enable(lclk);
+			s5pv210_busfreq_lock(BUSFREQ_FIMC0 + ctrl->id);
 		}
 	} else {
+		if (lclk->usage > 0)
+			s5pv210_busfreq_unlock(BUSFREQ_FIMC0 + ctrl->id);
+
+		/* the power domain goes down with the clock */
+		if (ctrl->out)
+			ctrl->out->regs_valid = 0;
+
 		while (lclk->usage > 0) {
 			if (!ctrl->out)
 				fimc_info1("(%d) Clock %s(%d) disabled.\n",
@@ -154,10 +163,8 @@ static inline u32 fimc_irq_out_single_buf(struct fimc_control *ctrl,
 
 	ctx->status = FIMC_STREAMON_IDLE;
 
-	/* Attach done buffer to outgoing queue. */
-	ret = fimc_push_outq(ctrl, ctx, ctrl->out->idxs.active.idx);
-	if (ret < 0)
-		fimc_err("Failed: fimc_push_outq\n");
+	/* Attach done buffer to outgoing queue, or pass it down the chain. */
+	fimc_outdev_done(ctrl, ctx, ctrl->out->idxs.active.idx);
 
 	/* Detach buffer from incomming queue. */
 	ret = fimc_pop_inq(ctrl, &ctx_num, &next);
@@ -168,18 +175,7 @@ static inline u32 fimc_irq_out_single_buf(struct fimc_control *ctrl,
 			fimc_outdev_set_ctx_param(ctrl, ctx);
 		}
 
-		fimc_outdev_set_src_addr(ctrl, ctx->src[next].base);
-
-		fimc_output_set_dst_addr(ctrl, ctx, next);
-
-		ret = fimc_outdev_start_camif(ctrl);
-		if (ret < 0)
-			fimc_err("Fail: fimc_start_camif\n");
-
-		ctrl->out->idxs.active.ctx = ctx_num;
-		ctrl->out->idxs.active.idx = next;
-		ctx->status = FIMC_STREAMON;
-		ctrl->status = FIMC_STREAMON;
+		fimc_outdev_run_job(ctrl, ctx, next);
 	} else {	/* There is no buffer in incomming queue. */
 		ctrl->out->idxs.active.ctx = -1;
 		ctrl->out->idxs.active.idx = -1;
@@ -207,10 +203,8 @@ static inline u32 fimc_irq_out_multi_buf(struct fimc_control *ctrl,
 		return wakeup;
 	}
 
-	/* Attach done buffer to outgoing queue. */
-	ret = fimc_push_outq(ctrl, ctx, ctrl->out->idxs.active.idx);
-	if (ret < 0)
-		fimc_err("Failed: fimc_push_outq\n");
+	/* Attach done buffer to outgoing queue, or pass it down the chain. */
+	fimc_outdev_done(ctrl, ctx, ctrl->out->idxs.active.idx);
 
 	/* Detach buffer from incomming queue. */
 	ret = fimc_pop_inq(ctrl, &ctx_num, &next);
@@ -221,18 +215,7 @@ static inline u32 fimc_irq_out_multi_buf(struct fimc_control *ctrl,
 			fimc_outdev_set_ctx_param(ctrl, ctx);
 		}
 
-		fimc_outdev_set_src_addr(ctrl, ctx->src[next].base);
-
-		fimc_output_set_dst_addr(ctrl, ctx, next);
-
-		ret = fimc_outdev_start_camif(ctrl);
-		if (ret < 0)
-			fimc_err("Fail: fimc_start_camif\n");
-
-		ctrl->out->idxs.active.ctx = ctx_num;
-		ctrl->out->idxs.active.idx = next;
-		ctx->status = FIMC_STREAMON;
-		ctrl->status = FIMC_STREAMON;
+		fimc_outdev_run_job(ctrl, ctx, next);
 	} else {	/* There is no buffer in incomming queue. */
 		ctrl->out->idxs.active.ctx = -1;
 		ctrl->out->idxs.active.idx = -1;
@@ -246,9 +229,8 @@ static inline u32 fimc_irq_out_multi_buf(struct fimc_control *ctrl,
 static inline u32 fimc_irq_out_dma(struct fimc_control *ctrl,
 				   struct fimc_ctx *ctx)
 {
-	struct fimc_buf_set buf_set;
 	int idx = ctrl->out->idxs.active.idx;
-	int ret = -1, i, ctx_num, next;
+	int ret = -1, ctx_num, next;
 	u32 wakeup = 1;
 
 	if (ctx->status == FIMC_READY_OFF) {
@@ -285,23 +267,7 @@ static inline u32 fimc_irq_out_dma(struct fimc_control *ctrl,
 	ret = fimc_pop_inq(ctrl, &ctx_num, &next);
 	if (ret == 0) {		/* There is a buffer in incomming queue. */
 		ctx = &ctrl->out->ctx[ctx_num];
-		fimc_outdev_set_src_addr(ctrl, ctx->src[next].base);
-
-		memset(&buf_set, 0x00, sizeof(buf_set));
-		buf_set.base[FIMC_ADDR_Y] = ctx->dst[next].base[FIMC_ADDR_Y];
-
-		for (i = 0; i < FIMC_PHYBUFS; i++)
-			fimc_hwset_output_address(ctrl, &buf_set, i);
-
-		ret = fimc_outdev_start_camif(ctrl);
-		if (ret < 0)
-			fimc_err("Fail: fimc_start_camif\n");
-
-		ctrl->out->idxs.active.ctx = ctx_num;
-		ctrl->out->idxs.active.idx = next;
-
-		ctx->status = FIMC_STREAMON;
-		ctrl->status = FIMC_STREAMON;
+		fimc_outdev_run_job(ctrl, ctx, next);
 	} else {		/* There is no buffer in incomming queue. */
 		ctrl->out->idxs.active.ctx = -1;
 		ctrl->out->idxs.active.idx = -1;
@@ -391,11 +357,12 @@ static inline void fimc_irq_out(struct fimc_control *ctrl)
 static inline void fimc_irq_cap(struct fimc_control *ctrl)
 {
 	struct fimc_capinfo *cap = ctrl->cap;
-	int pp;
+	int pp, overflow;
 	u32 cfg;
 
 	fimc_hwset_clear_irq(ctrl);
-	if (fimc_hwget_overflow_state(ctrl)) {
+	overflow = fimc_hwget_overflow_state(ctrl);
+	if (overflow) {
 		/* s/w reset -- added for recovering module in ESD state*/
 		cfg = readl(ctrl->regs + S3C_CIGCTRL);
 		cfg |= (S3C_CIGCTRL_SWRST);
@@ -407,7 +374,11 @@ static inline void fimc_irq_cap(struct fimc_control *ctrl)
 		writel(cfg, ctrl->regs + S3C_CIGCTRL);
 	}
 	pp = ((fimc_hwget_frame_count(ctrl) + 2) % 4);
-	if (cap->fmt.field == V4L2_FIELD_INTERLACED_TB) {
+	if (cap->preview != FIMC_PREVIEW_NONE) {
+		fimc_preview_frame(ctrl, pp, overflow);
+		if (cap->irq)
+			wake_up(&ctrl->wq);
+	} else if (cap->fmt.field == V4L2_FIELD_INTERLACED_TB) {
 		/* odd value of pp means one frame is made with top/bottom */
 		if (pp & 0x1) {
 			cap->irq = 1;
@@ -988,6 +959,11 @@ static int fimc_release(struct file *filp)
 	}
 
 	if (ctrl->cap) {
+		/* Don't leave the window scanning out the buffers freed below */
+		if (ctrl->status == FIMC_STREAMON &&
+		    ctrl->cap->preview != FIMC_PREVIEW_NONE)
+			fimc_preview_stop(ctrl);
+
 		ctrl->mem.curr = ctrl->mem.base;
 		kfree(filp->private_data);
 		filp->private_data = NULL;
@@ -1061,6 +1037,8 @@ static int fimc_release(struct file *filp)
 			}
 		}
 
+		fimc_outdev_unchain(ctrl, ctx);
+
 		ctrl->ctx_busy[ctx_id] = 0;
 		memset(ctx, 0x00, sizeof(struct fimc_ctx));
 
@@ -1301,6 +1279,30 @@ static DEVICE_ATTR(log_level, 0644, \
 			fimc_show_log_level,
 			fimc_store_log_level);
 
+static ssize_t fimc_show_preview_stats(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+
+	return fimc_print_preview_stats(get_fimc_ctrl(pdev->id),
+					buf, PAGE_SIZE);
+}
+
+/* any write clears the counters */
+static ssize_t fimc_store_preview_stats(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct platform_device *pdev = to_platform_device(dev);
+
+	fimc_reset_preview_stats(get_fimc_ctrl(pdev->id));
+
+	return len;
+}
+
+static DEVICE_ATTR(preview_stats, 0644, \
+			fimc_show_preview_stats,
+			fimc_store_preview_stats);
+
 static int __devinit fimc_probe(struct platform_device *pdev)
 {
 	struct s3c_platform_fimc *pdata;
@@ -1385,6 +1387,13 @@ static int __devinit fimc_probe(struct platform_device *pdev)
 		fimc_err("failed to add sysfs entries\n");
 		goto err_global;
 	}
+
+	ret = device_create_file(&(pdev->dev), &dev_attr_preview_stats);
+	if (ret < 0) {
+		fimc_err("failed to add sysfs entries\n");
+		device_remove_file(&(pdev->dev), &dev_attr_log_level);
+		goto err_global;
+	}
 	printk(KERN_INFO "FIMC%d registered successfully\n", ctrl->id);
 
 	return 0;
@@ -1408,6 +1417,7 @@ static int fimc_remove(struct platform_device *pdev)
 {
 	fimc_unregister_controller(pdev);
 
+	device_remove_file(&(pdev->dev), &dev_attr_preview_stats);
 	device_remove_file(&(pdev->dev), &dev_attr_log_level);
 
 	kfree(fimc_dev);
@@ -1478,6 +1488,7 @@ static inline int fimc_suspend_out(struct fimc_control *ctrl)
 		ctrl->status = FIMC_OFF_SLEEP;
 
 	ctrl->out->last_ctx = -1;
+	ctrl->out->regs_valid = 0;
 
 	return 0;
 }
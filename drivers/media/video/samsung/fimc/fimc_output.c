@@ -21,6 +21,7 @@
 #include <linux/io.h>
 #include <linux/uaccess.h>
 #include <linux/mman.h>
+#include <linux/interrupt.h>
 #include <plat/media.h>
 #include <linux/clk.h>
 
@@ -100,7 +101,9 @@ int fimc_outdev_stop_streaming(struct fimc_control *ctrl, struct fimc_ctx *ctx)
 		break;
 	case FIMC_OVLY_NONE_SINGLE_BUF:		/* fall through */
 	case FIMC_OVLY_NONE_MULTI_BUF:
-		if (ctx->status == FIMC_STREAMON_IDLE)
+		/* READY_ON: nothing started yet, e.g. a partial batch */
+		if (ctx->status == FIMC_STREAMON_IDLE ||
+		    ctx->status == FIMC_READY_ON)
 			ctx->status = FIMC_STREAMOFF;
 		else
 			ctx->status = FIMC_READY_OFF;
@@ -1074,7 +1077,8 @@ static int fimc_outdev_set_scaler(struct fimc_control *ctrl,
 	return 0;
 }
 
-int fimc_outdev_set_ctx_param(struct fimc_control *ctrl, struct fimc_ctx *ctx)
+static int fimc_outdev_load_ctx_param(struct fimc_control *ctrl,
+				      struct fimc_ctx *ctx)
 {
 	int ret;
 
@@ -1103,44 +1107,112 @@ int fimc_outdev_set_ctx_param(struct fimc_control *ctrl, struct fimc_ctx *ctx)
 	return 0;
 }
 
-int fimc_fimd_rect(const struct fimc_control *ctrl,
-		   const struct fimc_ctx *ctx,
-		   struct v4l2_rect *fimd_rect)
+/*
+ * Derive the register image of a context by running the full setup
+ * against a memory copy of the register file, based on what is loaded
+ * in h/w.  The controller must not be touched by anyone else meanwhile.
+ */
+static int fimc_outdev_build_ctx_regs(struct fimc_control *ctrl,
+				      struct fimc_ctx *ctx)
 {
-	switch (ctx->rotate) {
+	struct fimc_outinfo *out = ctrl->out;
+	void __iomem *regs = ctrl->regs;
+	int ret;
+
+	ctrl->regs = (void __force __iomem *)out->regs_file;
+	fimc_hwset_ctx_regs(ctrl, out->regs, NULL);
+
+	ret = fimc_outdev_load_ctx_param(ctrl, ctx);
+	if (ret == 0)
+		fimc_hwget_ctx_regs(ctrl, ctx->regs);
+
+	ctrl->regs = regs;
+
+	if (ret < 0) {
+		ctx->regs_gen = 0;
+		return ret;
+	}
+
+	ctx->regs_gen = out->regs_valid ? out->regs_gen : 0;
+
+	return 0;
+}
+
+int fimc_outdev_set_ctx_param(struct fimc_control *ctrl, struct fimc_ctx *ctx)
+{
+	struct fimc_outinfo *out = ctrl->out;
+	int ret, cnt;
+
+	/* first load after power on: set up everything and keep a copy */
+	if (!out->regs_valid) {
+		ret = fimc_outdev_load_ctx_param(ctrl, ctx);
+		if (ret < 0)
+			return ret;
+
+		fimc_hwget_ctx_regs(ctrl, out->regs);
+		memcpy(ctx->regs, out->regs, sizeof(ctx->regs));
+
+		if (++out->regs_gen == 0)
+			out->regs_gen = 1;
+		ctx->regs_gen = out->regs_gen;
+		out->regs_valid = 1;
+
+		return 0;
+	}
+
+	if (ctx->regs_gen != out->regs_gen) {
+		ret = fimc_outdev_build_ctx_regs(ctrl, ctx);
+		if (ret < 0)
+			return ret;
+	}
+
+	cnt = fimc_hwset_ctx_regs(ctrl, ctx->regs, out->regs);
+	memcpy(out->regs, ctx->regs, sizeof(out->regs));
+
+	fimc_dbg("%s: ctx(%d) %d registers written\n",
+			__func__, ctx->ctx_num, cnt);
+
+	return 0;
+}
+
+int fimc_fimd_win_rect(const struct fimc_control *ctrl, u32 rotate,
+		       const struct v4l2_window *win,
+		       struct v4l2_rect *fimd_rect)
+{
+	switch (rotate) {
 	case 0:
-		fimd_rect->left = ctx->win.w.left;
-		fimd_rect->top = ctx->win.w.top;
-		fimd_rect->width = ctx->win.w.width;
-		fimd_rect->height = ctx->win.w.height;
+		fimd_rect->left = win->w.left;
+		fimd_rect->top = win->w.top;
+		fimd_rect->width = win->w.width;
+		fimd_rect->height = win->w.height;
 
 		break;
 
 	case 90:
 		fimd_rect->left = ctrl->fb.lcd_hres -
-				(ctx->win.w.top + ctx->win.w.height);
-		fimd_rect->top = ctx->win.w.left;
-		fimd_rect->width = ctx->win.w.height;
-		fimd_rect->height = ctx->win.w.width;
+				(win->w.top + win->w.height);
+		fimd_rect->top = win->w.left;
+		fimd_rect->width = win->w.height;
+		fimd_rect->height = win->w.width;
 
 		break;
 
 	case 180:
 		fimd_rect->left = ctrl->fb.lcd_hres -
-				(ctx->win.w.left + ctx->win.w.width);
+				(win->w.left + win->w.width);
 		fimd_rect->top = ctrl->fb.lcd_vres -
-				(ctx->win.w.top + ctx->win.w.height);
-		fimd_rect->width = ctx->win.w.width;
-		fimd_rect->height = ctx->win.w.height;
+				(win->w.top + win->w.height);
+		fimd_rect->width = win->w.width;
+		fimd_rect->height = win->w.height;
 
 		break;
 
 	case 270:
-		fimd_rect->left = ctx->win.w.top;
+		fimd_rect->left = win->w.top;
 		fimd_rect->top = ctrl->fb.lcd_vres -
-				(ctx->win.w.left + ctx->win.w.width);
-		fimd_rect->width = ctx->win.w.height;
-		fimd_rect->height = ctx->win.w.width;
+				(win->w.left + win->w.width);
+		fimd_rect->width = win->w.height;
+		fimd_rect->height = win->w.width;
 
 		break;
 
@@ -1154,6 +1226,13 @@ int fimc_fimd_rect(const struct fimc_control *ctrl,
 	return 0;
 }
 
+int fimc_fimd_rect(const struct fimc_control *ctrl,
+		   const struct fimc_ctx *ctx,
+		   struct v4l2_rect *fimd_rect)
+{
+	return fimc_fimd_win_rect(ctrl, ctx->rotate, &ctx->win, fimd_rect);
+}
+
 int fimc_outdev_overlay_buf(struct file *filp,
 			    struct fimc_control *ctrl,
 			    struct fimc_ctx *ctx)
@@ -1362,6 +1441,18 @@ int fimc_g_ctrl_output(void *fh, struct v4l2_control *c)
 		c->value = pdata->hw_ver;
 		break;
 
+	case V4L2_CID_FIMC_BATCH:
+		c->value = ctx->batch;
+		break;
+
+	case V4L2_CID_FIMC_CHAIN:
+		if (ctx->chain_next)
+			c->value = (ctx->chain_next->id << 8) |
+					ctx->chain_next_ctx;
+		else
+			c->value = -1;
+		break;
+
 	default:
 		fimc_err("Invalid control id: %d\n", c->id);
 		return -EINVAL;
@@ -1415,6 +1506,12 @@ static int fimc_set_dst_info(struct fimc_control *ctrl,
 
 	return 0;
 }
+
+static int fimc_outdev_set_batch(struct fimc_control *ctrl,
+				 struct fimc_ctx *ctx, int value);
+static int fimc_outdev_set_chain(struct fimc_control *ctrl,
+				 struct fimc_ctx *ctx, int value);
+
 int fimc_s_ctrl_output(struct file *filp, void *fh, struct v4l2_control *c)
 {
 	struct fimc_ctx *ctx;
@@ -1423,6 +1520,11 @@ int fimc_s_ctrl_output(struct file *filp, void *fh, struct v4l2_control *c)
 	int ret = 0;
 
 	ctx = &ctrl->out->ctx[ctx_id];
+
+	/* batch size may change while streaming to flush a partial batch */
+	if (c->id == V4L2_CID_FIMC_BATCH)
+		return fimc_outdev_set_batch(ctrl, ctx, c->value);
+
 	if (ctx->status != FIMC_STREAMOFF) {
 		fimc_err("FIMC is running\n");
 		return -EBUSY;
@@ -1465,6 +1567,9 @@ int fimc_s_ctrl_output(struct file *filp, void *fh, struct v4l2_control *c)
 		ret = fimc_set_dst_info(ctrl, ctx,
 					(struct fimc_buf *)c->value);
 		break;
+	case V4L2_CID_FIMC_CHAIN:
+		ret = fimc_outdev_set_chain(ctrl, ctx, c->value);
+		break;
 	default:
 		fimc_err("Invalid control id: %d\n", c->id);
 		ret = -EINVAL;
@@ -1632,7 +1737,8 @@ int fimc_streamon_output(void *fh)
 	struct fimc_ctx *ctx;
 	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
 	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
-	int ret = -1;
+	unsigned long flags;
+	int ret = -1, i;
 
 	fimc_info1("%s: called\n", __func__);
 
@@ -1653,6 +1759,45 @@ int fimc_streamon_output(void *fh)
 		return ret;
 	}
 
+	/* a chain passes frames between m2m contexts only */
+	if ((ctx->chain_next &&
+	     ctx->overlay.mode != FIMC_OVLY_NONE_MULTI_BUF) ||
+	    (ctx->chain_prev &&
+	     ctx->overlay.mode != FIMC_OVLY_NONE_MULTI_BUF &&
+	     ctx->overlay.mode != FIMC_OVLY_NONE_SINGLE_BUF)) {
+		fimc_err("%s: overlay mode(%d) can not be chained\n",
+				__func__, ctx->overlay.mode);
+		return -EINVAL;
+	}
+
+	/* validate the setup once and keep its register image */
+	disable_irq(ctrl->irq);
+	local_irq_save(flags);
+	ret = fimc_outdev_build_ctx_regs(ctrl, ctx);
+	local_irq_restore(flags);
+	enable_irq(ctrl->irq);
+	if (ret < 0) {
+		fimc_err("Fail: fimc_outdev_build_ctx_regs\n");
+		return ret;
+	}
+
+	/*
+	 * buffers queued before the mode was fixed; a downstream stage of a
+	 * chain never sees qbuf, any of its indices may be fed to it
+	 */
+	for (i = 0; i < ctx->buf_num; i++) {
+		if (!ctx->chain_prev && ctx->src[i].state != VIDEOBUF_QUEUED)
+			continue;
+
+		ret = fimc_outdev_prepare_job(ctrl, ctx, i);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the previous stage starts us from its irq handler */
+	if (ctx->chain_prev)
+		fimc_clk_en(ctrl, true);
+
 	ctx->status = FIMC_READY_ON;
 	if (ctrl->status == FIMC_STREAMOFF)
 		ctrl->status = FIMC_READY_ON;
@@ -1760,18 +1905,17 @@ int fimc_streamoff_output(void *fh)
 }
 
 
-int fimc_output_set_dst_addr(struct fimc_control *ctrl,
-				struct fimc_ctx *ctx, int idx)
+static int fimc_output_get_dst_addr(struct fimc_control *ctrl,
+				    struct fimc_ctx *ctx, int idx,
+				    struct fimc_buf_set *buf_set)
 {
-	struct fimc_buf_set buf_set;	/* destination addr */
 	u32 format = ctx->fbuf.fmt.pixelformat;
 	u32 width = ctx->fbuf.fmt.width;
 	u32 height = ctx->fbuf.fmt.height;
 	u32 y_size = width * height;
 	u32 c_size = y_size >> 2;
-	int i;
 
-	memset(&buf_set, 0x00, sizeof(buf_set));
+	memset(buf_set->base, 0x00, sizeof(buf_set->base));
 
 	if (V4L2_PIX_FMT_NV12T == format)
 		fimc_get_nv12t_size(width, height, &y_size, &c_size);
@@ -1784,26 +1928,26 @@ int fimc_output_set_dst_addr(struct fimc_control *ctrl,
 	case V4L2_PIX_FMT_YVYU:		/* fall through */
 	case V4L2_PIX_FMT_VYUY:		/* fall through */
 		if (ctx->overlay.mode == FIMC_OVLY_NONE_SINGLE_BUF)
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				(dma_addr_t)ctx->fbuf.base;
 		else
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				ctx->dst[idx].base[FIMC_ADDR_Y];
 		break;
 	case V4L2_PIX_FMT_YUV420:
 		if (ctx->overlay.mode == FIMC_OVLY_NONE_SINGLE_BUF) {
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				(dma_addr_t)ctx->fbuf.base;
-			buf_set.base[FIMC_ADDR_CB] =
-				buf_set.base[FIMC_ADDR_Y] + y_size;
-			buf_set.base[FIMC_ADDR_CR] =
-				buf_set.base[FIMC_ADDR_CB] + c_size;
+			buf_set->base[FIMC_ADDR_CB] =
+				buf_set->base[FIMC_ADDR_Y] + y_size;
+			buf_set->base[FIMC_ADDR_CR] =
+				buf_set->base[FIMC_ADDR_CB] + c_size;
 		} else {
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				ctx->dst[idx].base[FIMC_ADDR_Y];
-			buf_set.base[FIMC_ADDR_CB] =
+			buf_set->base[FIMC_ADDR_CB] =
 				ctx->dst[idx].base[FIMC_ADDR_CB];
-			buf_set.base[FIMC_ADDR_CR] =
+			buf_set->base[FIMC_ADDR_CR] =
 				ctx->dst[idx].base[FIMC_ADDR_CR];
 		}
 		break;
@@ -1813,14 +1957,14 @@ int fimc_output_set_dst_addr(struct fimc_control *ctrl,
 	case V4L2_PIX_FMT_NV61:
 	case V4L2_PIX_FMT_NV12T:
 		if (ctx->overlay.mode == FIMC_OVLY_NONE_SINGLE_BUF) {
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				(dma_addr_t)ctx->fbuf.base;
-			buf_set.base[FIMC_ADDR_CB] =
-				buf_set.base[FIMC_ADDR_Y] + y_size;
+			buf_set->base[FIMC_ADDR_CB] =
+				buf_set->base[FIMC_ADDR_Y] + y_size;
 		} else {
-			buf_set.base[FIMC_ADDR_Y] =
+			buf_set->base[FIMC_ADDR_Y] =
 				ctx->dst[idx].base[FIMC_ADDR_Y];
-			buf_set.base[FIMC_ADDR_CB] =
+			buf_set->base[FIMC_ADDR_CB] =
 				ctx->dst[idx].base[FIMC_ADDR_CB];
 		}
 		break;
@@ -1830,55 +1974,44 @@ int fimc_output_set_dst_addr(struct fimc_control *ctrl,
 		return -EINVAL;
 	}
 
-	for (i = 0; i < FIMC_PHYBUFS; i++)
-		fimc_hwset_output_address(ctrl, &buf_set, i);
-
 	return 0;
 }
 
-
-static int fimc_qbuf_output_single_buf(struct fimc_control *ctrl,
-				       struct fimc_ctx *ctx,
-				       int idx)
+/*
+ * Work out the destination addresses of one index up front, so that
+ * starting the job from the irq handler is only register writes.
+ */
+int fimc_outdev_prepare_job(struct fimc_control *ctrl,
+			    struct fimc_ctx *ctx, int idx)
 {
-	int ret = -1;
+	struct fimc_buf_set *job = &ctx->job[idx];
 
-	fimc_outdev_set_src_addr(ctrl, ctx->src[idx].base);
-
-	ret = fimc_output_set_dst_addr(ctrl, ctx, idx);
-	if (ret < 0) {
-		fimc_err("%s: Fail: fimc_output_set_dst_addr\n", __func__);
-		return -EINVAL;
-	}
-
-	ret = fimc_outdev_start_camif(ctrl);
-	if (ret < 0) {
-		fimc_err("Fail: fimc_start_camif\n");
-		return -EINVAL;
+	switch (ctx->overlay.mode) {
+	case FIMC_OVLY_DMA_AUTO:		/* fall through */
+	case FIMC_OVLY_DMA_MANUAL:
+		memset(job->base, 0x00, sizeof(job->base));
+		job->base[FIMC_ADDR_Y] = ctx->dst[idx].base[FIMC_ADDR_Y];
+		break;
+	case FIMC_OVLY_NONE_SINGLE_BUF:		/* fall through */
+	case FIMC_OVLY_NONE_MULTI_BUF:
+		return fimc_output_get_dst_addr(ctrl, ctx, idx, job);
+	default:
+		/* prepared again at streamon once the mode is fixed */
+		break;
 	}
 
-	ctrl->out->idxs.active.idx = idx;
-	ctrl->out->idxs.active.ctx = ctx->ctx_num;
-
-	ctrl->status = FIMC_STREAMON;
-	ctx->status = FIMC_STREAMON;
-
 	return 0;
 }
 
-static int fimc_qbuf_output_multi_buf(struct fimc_control *ctrl,
-				      struct fimc_ctx *ctx,
-				      int idx)
+int fimc_outdev_run_job(struct fimc_control *ctrl,
+			struct fimc_ctx *ctx, int idx)
 {
-	int ret = -1;
+	int ret = -1, i;
 
 	fimc_outdev_set_src_addr(ctrl, ctx->src[idx].base);
 
-	fimc_output_set_dst_addr(ctrl, ctx, idx);
-	if (ret < 0) {
-		fimc_err("%s: Fail: fimc_output_set_dst_addr\n", __func__);
-		return -EINVAL;
-	}
+	for (i = 0; i < FIMC_PHYBUFS; i++)
+		fimc_hwset_output_address(ctrl, &ctx->job[idx], i);
 
 	ret = fimc_outdev_start_camif(ctrl);
 	if (ret < 0) {
@@ -1895,6 +2028,7 @@ static int fimc_qbuf_output_multi_buf(struct fimc_control *ctrl,
 	return 0;
 }
 
+
 static int fimc_qbuf_output_dma_auto(struct fimc_control *ctrl,
 				      struct fimc_ctx *ctx,
 				      int idx)
@@ -1903,8 +2037,7 @@ static int fimc_qbuf_output_dma_auto(struct fimc_control *ctrl,
 	struct fb_info *fbinfo;
 	struct s3cfb_window *win;
 	struct v4l2_rect fimd_rect;
-	struct fimc_buf_set buf_set;	/* destination addr */
-	int ret = -1, i;
+	int ret = -1;
 
 	switch (ctx->status) {
 	case FIMC_READY_ON:
@@ -1945,88 +2078,279 @@ static int fimc_qbuf_output_dma_auto(struct fimc_control *ctrl,
 		/* fall through */
 
 	case FIMC_STREAMON_IDLE:
-		fimc_outdev_set_src_addr(ctrl, ctx->src[idx].base);
+		ret = fimc_outdev_run_job(ctrl, ctx, idx);
+		if (ret < 0)
+			return ret;
 
-		memset(&buf_set, 0x00, sizeof(buf_set));
-		buf_set.base[FIMC_ADDR_Y] = ctx->dst[idx].base[FIMC_ADDR_Y];
+		break;
 
-		for (i = 0; i < FIMC_PHYBUFS; i++)
-			fimc_hwset_output_address(ctrl, &buf_set, i);
+	default:
+		break;
+	}
 
-		ret = fimc_outdev_start_camif(ctrl);
-		if (ret < 0) {
-			fimc_err("Fail: fimc_start_camif\n");
-			return -EINVAL;
-		}
+	return 0;
+}
 
-		ctrl->out->idxs.active.idx = idx;
-		ctrl->out->idxs.active.ctx = ctx->ctx_num;
+static int fimc_update_in_queue_addr(struct fimc_control *ctrl,
+				     struct fimc_ctx *ctx,
+				     u32 idx, dma_addr_t *addr)
+{
+	if (idx >= FIMC_OUTBUFS) {
+		fimc_err("%s: Failed\n", __func__);
+		return -EINVAL;
+	}
 
-		ctrl->status = FIMC_STREAMON;
-		ctx->status = FIMC_STREAMON;
+	ctx->src[idx].base[FIMC_ADDR_Y] = addr[FIMC_ADDR_Y];
+	ctx->src[idx].base[FIMC_ADDR_CB] = addr[FIMC_ADDR_CB];
+	ctx->src[idx].base[FIMC_ADDR_CR] = addr[FIMC_ADDR_CR];
 
-		break;
+	return 0;
+}
+
+/* Start the oldest queued job on an idle controller. */
+static int fimc_outdev_kick(struct fimc_control *ctrl)
+{
+	struct fimc_ctx *ctx;
+	int idx, ctx_num;
+	int ret = -1;
+
+	ret = fimc_pop_inq(ctrl, &ctx_num, &idx);
+	if (ret < 0) {
+		fimc_err("Fail: fimc_pop_inq\n");
+		return -EINVAL;
+	}
+
+	fimc_clk_en(ctrl, true);
 
+	ctx = &ctrl->out->ctx[ctx_num];
+	if (ctx_num != ctrl->out->last_ctx) {
+		ctrl->out->last_ctx = ctx->ctx_num;
+		fimc_outdev_set_ctx_param(ctrl, ctx);
+	}
+
+	switch (ctx->overlay.mode) {
+	case FIMC_OVLY_DMA_AUTO:
+		ret = fimc_qbuf_output_dma_auto(ctrl, ctx, idx);
+		break;
+	case FIMC_OVLY_DMA_MANUAL:		/* fall through */
+	case FIMC_OVLY_NONE_SINGLE_BUF:		/* fall through */
+	case FIMC_OVLY_NONE_MULTI_BUF:
+		ret = fimc_outdev_run_job(ctrl, ctx, idx);
+		break;
 	default:
 		break;
 	}
 
-	return 0;
+	return ret;
 }
 
-static int fimc_qbuf_output_dma_manual(struct fimc_control *ctrl,
-				      struct fimc_ctx *ctx,
-				      int idx)
+/*
+ * In batch mode the controller is only started once enough jobs are
+ * queued; the irq handler then runs them back to back.
+ */
+static int fimc_outdev_batch_ready(struct fimc_ctx *ctx)
 {
-	struct fimc_buf_set buf_set;	/* destination addr */
-	int ret = -1, i;
+	u32 pending = 0, batch = min(ctx->batch, ctx->buf_num);
+	int i;
 
-	fimc_outdev_set_src_addr(ctrl, ctx->src[idx].base);
+	if (batch <= 1)
+		return 1;
 
-	memset(&buf_set, 0x00, sizeof(buf_set));
-	buf_set.base[FIMC_ADDR_Y] = ctx->dst[idx].base[FIMC_ADDR_Y];
+	for (i = 0; i < FIMC_OUTBUFS; i++) {
+		if (ctx->inq[i] != -1)
+			pending++;
+	}
 
-	for (i = 0; i < FIMC_PHYBUFS; i++)
-		fimc_hwset_output_address(ctrl, &buf_set, i);
+	return pending >= batch;
+}
 
-	ret = fimc_outdev_start_camif(ctrl);
-	if (ret < 0) {
-		fimc_err("Fail: fimc_start_camif\n");
+static int fimc_outdev_set_batch(struct fimc_control *ctrl,
+				 struct fimc_ctx *ctx, int value)
+{
+	if (value < 0 || value > FIMC_OUTBUFS) {
+		fimc_err("%s: batch(%d) must be 0 ~ %d\n",
+				__func__, value, FIMC_OUTBUFS);
 		return -EINVAL;
 	}
 
-	ctrl->out->idxs.active.idx = idx;
-	ctrl->out->idxs.active.ctx = ctx->ctx_num;
+	ctx->batch = value;
 
-	ctrl->status = FIMC_STREAMON;
-	ctx->status = FIMC_STREAMON;
+	/* a smaller batch may flush what is already queued */
+	if ((ctrl->status == FIMC_READY_ON ||
+	     ctrl->status == FIMC_STREAMON_IDLE) &&
+	    ctx->inq[0] != -1 && fimc_outdev_batch_ready(ctx))
+		return fimc_outdev_kick(ctrl);
 
 	return 0;
 }
 
-static int fimc_update_in_queue_addr(struct fimc_control *ctrl,
-				     struct fimc_ctx *ctx,
-				     u32 idx, dma_addr_t *addr)
+static int fimc_outdev_set_chain(struct fimc_control *ctrl,
+				 struct fimc_ctx *ctx, int value)
 {
-	if (idx >= FIMC_OUTBUFS) {
-		fimc_err("%s: Failed\n", __func__);
+	struct fimc_control *next;
+	struct fimc_ctx *next_ctx;
+	int id = value >> 8, next_num = value & 0xff;
+	unsigned long flags;
+
+	if (value < 0) {
+		fimc_outdev_unchain(ctrl, ctx);
+		return 0;
+	}
+
+	if (id >= FIMC_DEVICES || id == ctrl->id ||
+	    next_num >= FIMC_MAX_CTXS) {
+		fimc_err("%s: invalid target FIMC%d ctx(%d)\n",
+				__func__, id, next_num);
 		return -EINVAL;
 	}
 
-	ctx->src[idx].base[FIMC_ADDR_Y] = addr[FIMC_ADDR_Y];
-	ctx->src[idx].base[FIMC_ADDR_CB] = addr[FIMC_ADDR_CB];
-	ctx->src[idx].base[FIMC_ADDR_CR] = addr[FIMC_ADDR_CR];
+	next = get_fimc_ctrl(id);
+	if (!next->out) {
+		fimc_err("%s: FIMC%d is not an output device\n", __func__, id);
+		return -ENODEV;
+	}
+
+	next_ctx = &next->out->ctx[next_num];
+	if (next_ctx->chain_prev || next_ctx->status != FIMC_STREAMOFF) {
+		fimc_err("%s: FIMC%d ctx(%d) is busy\n", __func__, id, next_num);
+		return -EBUSY;
+	}
+
+	fimc_outdev_unchain(ctrl, ctx);
+
+	local_irq_save(flags);
+	ctx->chain_next = next;
+	ctx->chain_next_ctx = next_num;
+	next_ctx->chain_prev = ctrl;
+	next_ctx->chain_prev_ctx = ctx->ctx_num;
+	local_irq_restore(flags);
+
+	fimc_info1("%s: ctx(%d) feeds FIMC%d ctx(%d)\n",
+			__func__, ctx->ctx_num, id, next_num);
 
 	return 0;
 }
 
+void fimc_outdev_unchain(struct fimc_control *ctrl, struct fimc_ctx *ctx)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if (ctx->chain_next && ctx->chain_next->out)
+		ctx->chain_next->out->ctx[ctx->chain_next_ctx].chain_prev = NULL;
+
+	if (ctx->chain_prev && ctx->chain_prev->out)
+		ctx->chain_prev->out->ctx[ctx->chain_prev_ctx].chain_next = NULL;
+
+	ctx->chain_next = NULL;
+	ctx->chain_prev = NULL;
+
+	local_irq_restore(flags);
+}
+
+/*
+ * Hand a finished frame to the next controller of the chain and start it
+ * if it is idle.  Called from the irq handler of this controller.
+ */
+static int fimc_outdev_chain_feed(struct fimc_control *ctrl,
+				  struct fimc_ctx *ctx, int idx)
+{
+	struct fimc_control *next = ctx->chain_next;
+	struct fimc_ctx *next_ctx;
+	int ctx_num, next_idx, ret = -1;
+
+	if (!next->out)
+		return -ENODEV;
+
+	next_ctx = &next->out->ctx[ctx->chain_next_ctx];
+	if (next_ctx->status == FIMC_STREAMOFF ||
+	    next_ctx->status == FIMC_READY_OFF ||
+	    idx >= next_ctx->buf_num) {
+		fimc_err("%s: FIMC%d is not ready for idx(%d)\n",
+				__func__, next->id, idx);
+		return -EINVAL;
+	}
+
+	next_ctx->src[idx].base[FIMC_ADDR_Y] = ctx->job[idx].base[FIMC_ADDR_Y];
+	next_ctx->src[idx].base[FIMC_ADDR_CB] = ctx->job[idx].base[FIMC_ADDR_CB];
+	next_ctx->src[idx].base[FIMC_ADDR_CR] = ctx->job[idx].base[FIMC_ADDR_CR];
+
+	/* the chain may have been linked after the next stage's streamon */
+	ret = fimc_outdev_prepare_job(next, next_ctx, idx);
+	if (ret < 0)
+		return ret;
+
+	ret = fimc_push_inq(next, next_ctx, idx);
+	if (ret < 0)
+		return ret;
+
+	if (next->status == FIMC_READY_ON ||
+	    next->status == FIMC_STREAMON_IDLE) {
+		ret = fimc_pop_inq(next, &ctx_num, &next_idx);
+		if (ret == 0) {
+			next_ctx = &next->out->ctx[ctx_num];
+			if (ctx_num != next->out->last_ctx) {
+				next->out->last_ctx = ctx_num;
+				fimc_outdev_set_ctx_param(next, next_ctx);
+			}
+
+			fimc_outdev_run_job(next, next_ctx, next_idx);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A job of the m2m modes is done.  Without a chain it goes to our own
+ * outgoing queue; inside a chain it moves on to the next stage, and the
+ * last stage gives the buffer back to the first one to be dequeued.
+ */
+void fimc_outdev_done(struct fimc_control *ctrl, struct fimc_ctx *ctx, int idx)
+{
+	struct fimc_control *head = ctrl;
+	struct fimc_ctx *head_ctx = ctx;
+	int ret = -1;
+
+	if (ctx->chain_next) {
+		ret = fimc_outdev_chain_feed(ctrl, ctx, idx);
+		if (ret == 0) {
+			if (ctx->chain_prev) {
+				ctx->src[idx].state = VIDEOBUF_IDLE;
+				ctx->src[idx].flags = V4L2_BUF_FLAG_MAPPED;
+			}
+
+			return;
+		}
+	}
+
+	while (head_ctx->chain_prev && head_ctx->chain_prev->out) {
+		struct fimc_control *prev = head_ctx->chain_prev;
+
+		head_ctx = &prev->out->ctx[head_ctx->chain_prev_ctx];
+		head = prev;
+	}
+
+	if (head != ctrl) {
+		ctx->src[idx].state = VIDEOBUF_IDLE;
+		ctx->src[idx].flags = V4L2_BUF_FLAG_MAPPED;
+	}
+
+	ret = fimc_push_outq(head, head_ctx, idx);
+	if (ret < 0)
+		fimc_err("Failed: fimc_push_outq\n");
+
+	if (head != ctrl)
+		wake_up(&head->wq);
+}
+
 int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 {
 	struct fimc_buf *buf = (struct fimc_buf *)b->m.userptr;
 	struct fimc_ctx *ctx;
 	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
 	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
-	int idx, ctx_num;
 	int ret = -1;
 
 	ctx = &ctrl->out->ctx[ctx_id];
@@ -2040,6 +2364,12 @@ int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 		return -EINVAL;
 	}
 
+	if (ctx->chain_prev) {
+		fimc_err("ctx(%d) is fed by FIMC%d\n",
+				ctx->ctx_num, ctx->chain_prev->id);
+		return -EBUSY;
+	}
+
 	/* Check the buffer state if the state is VIDEOBUF_IDLE. */
 	if (ctx->src[b->index].state != VIDEOBUF_IDLE) {
 		fimc_err("The index(%d) buffer must be dequeued state(%d)\n",
@@ -2053,6 +2383,10 @@ int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 			return ret;
 	}
 
+	ret = fimc_outdev_prepare_job(ctrl, ctx, b->index);
+	if (ret < 0)
+		return ret;
+
 	/* Attach the buffer to the incoming queue. */
 	ret = fimc_push_inq(ctrl, ctx, b->index);
 	if (ret < 0) {
@@ -2062,36 +2396,10 @@ int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 
 	if ((ctrl->status == FIMC_READY_ON) ||
 	    (ctrl->status == FIMC_STREAMON_IDLE)) {
-		ret = fimc_pop_inq(ctrl, &ctx_num, &idx);
-		if (ret < 0) {
-			fimc_err("Fail: fimc_pop_inq\n");
-			return -EINVAL;
-		}
-
-		fimc_clk_en(ctrl, true);
-
-		ctx = &ctrl->out->ctx[ctx_num];
-		if (ctx_num != ctrl->out->last_ctx) {
-			ctrl->out->last_ctx = ctx->ctx_num;
-			fimc_outdev_set_ctx_param(ctrl, ctx);
-		}
+		if (!fimc_outdev_batch_ready(ctx))
+			return 0;
 
-		switch (ctx->overlay.mode) {
-		case FIMC_OVLY_DMA_AUTO:
-			ret = fimc_qbuf_output_dma_auto(ctrl, ctx, idx);
-			break;
-		case FIMC_OVLY_DMA_MANUAL:
-			ret = fimc_qbuf_output_dma_manual(ctrl, ctx, idx);
-			break;
-		case FIMC_OVLY_NONE_SINGLE_BUF:
-			ret = fimc_qbuf_output_single_buf(ctrl, ctx, idx);
-			break;
-		case FIMC_OVLY_NONE_MULTI_BUF:
-			ret = fimc_qbuf_output_multi_buf(ctrl, ctx, idx);
-			break;
-		default:
-			break;
-		}
+		ret = fimc_outdev_kick(ctrl);
 	}
 
 	return ret;
@@ -20,25 +20,10 @@
 
 #include "fimc.h"
 
-int fimc_try_fmt_overlay(struct file *filp, void *fh, struct v4l2_format *f)
+/* Check Overlay Size : Overlay size must be smaller than LCD size. */
+static void fimc_fit_overlay(struct fimc_control *ctrl, u32 is_rotate,
+			     struct v4l2_format *f)
 {
-	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
-	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
-	struct fimc_ctx *ctx;
-
-	u32 is_rotate = 0;
-	ctx = &ctrl->out->ctx[ctx_id];
-
-	fimc_info1("%s: top(%d) left(%d) width(%d) height(%d)\n", __func__,
-			f->fmt.win.w.top, f->fmt.win.w.left,
-			f->fmt.win.w.width, f->fmt.win.w.height);
-
-	if (ctx->overlay.mode == FIMC_OVLY_NONE_SINGLE_BUF ||
-		(ctx->overlay.mode == FIMC_OVLY_NONE_MULTI_BUF))
-		return 0;
-
-	/* Check Overlay Size : Overlay size must be smaller than LCD size. */
-	is_rotate = fimc_mapping_rot_flip(ctx->rotate, ctx->flip);
 	if (is_rotate & FIMC_ROT) {	/* Landscape mode */
 		if (f->fmt.win.w.width > ctrl->fb.lcd_vres) {
 			fimc_warn("The width is changed %d -> %d\n",
@@ -64,6 +49,33 @@ int fimc_try_fmt_overlay(struct file *filp, void *fh, struct v4l2_format *f)
 				f->fmt.win.w.height = ctrl->fb.lcd_vres;
 		}
 	}
+}
+
+int fimc_try_fmt_overlay(struct file *filp, void *fh, struct v4l2_format *f)
+{
+	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
+	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
+	struct fimc_capinfo *cap = ctrl->cap;
+	struct fimc_ctx *ctx;
+
+	fimc_info1("%s: top(%d) left(%d) width(%d) height(%d)\n", __func__,
+			f->fmt.win.w.top, f->fmt.win.w.left,
+			f->fmt.win.w.width, f->fmt.win.w.height);
+
+	/* capture node: window for the camera preview */
+	if (cap) {
+		fimc_fit_overlay(ctrl,
+				fimc_mapping_rot_flip(cap->rotate, cap->flip), f);
+		return 0;
+	}
+
+	ctx = &ctrl->out->ctx[ctx_id];
+
+	if (ctx->overlay.mode == FIMC_OVLY_NONE_SINGLE_BUF ||
+		(ctx->overlay.mode == FIMC_OVLY_NONE_MULTI_BUF))
+		return 0;
+
+	fimc_fit_overlay(ctrl, fimc_mapping_rot_flip(ctx->rotate, ctx->flip), f);
 
 	return 0;
 }
@@ -74,10 +86,15 @@ int fimc_g_fmt_vid_overlay(struct file *filp, void *fh, struct v4l2_format *f)
 	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
 	struct fimc_ctx *ctx;
 
-	ctx = &ctrl->out->ctx[ctx_id];
-
 	fimc_info1("%s: called\n", __func__);
 
+	if (ctrl->cap) {
+		f->fmt.win = ctrl->cap->win;
+		return 0;
+	}
+
+	ctx = &ctrl->out->ctx[ctx_id];
+
 	f->fmt.win = ctx->win;
 
 	return 0;
@@ -106,6 +123,7 @@ static int fimc_change_fifo_position(struct fimc_control *ctrl,
 	int ret = -1;
 
 	fbinfo = registered_fb[ctx->overlay.fb_id];
+	win = (struct s3cfb_window *)fbinfo->par;
 
 	memset(&fimd_rect, 0, sizeof(struct v4l2_rect));
 
@@ -129,16 +147,78 @@ static int fimc_change_fifo_position(struct fimc_control *ctrl,
 	return 0;
 }
 
+static int fimc_s_fmt_preview(struct fimc_control *ctrl,
+			      struct v4l2_format *f)
+{
+	struct fimc_capinfo *cap = ctrl->cap;
+	struct v4l2_rect fimd_rect;
+	struct fb_info *fbinfo;
+	struct s3cfb_window *win;
+	int ret = 0;
+
+	mutex_lock(&ctrl->v4l2_lock);
+
+	fimc_fit_overlay(ctrl, fimc_mapping_rot_flip(cap->rotate, cap->flip), f);
+
+	if (ctrl->status == FIMC_STREAMOFF ||
+			cap->preview == FIMC_PREVIEW_NONE) {
+		cap->win = f->fmt.win;
+		goto out;
+	}
+
+	if (ctrl->status != FIMC_STREAMON ||
+			cap->win.w.width != f->fmt.win.w.width ||
+			cap->win.w.height != f->fmt.win.w.height) {
+		fimc_err("When FIMC is running, "
+			"you can only move the position.\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	cap->win = f->fmt.win;
+
+	memset(&fimd_rect, 0, sizeof(struct v4l2_rect));
+	ret = fimc_fimd_win_rect(ctrl, cap->rotate, &cap->win, &fimd_rect);
+	if (ret < 0) {
+		fimc_err("fimc_fimd_rect fail\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	fbinfo = registered_fb[cap->fb_id];
+	win = (struct s3cfb_window *)fbinfo->par;
+
+	/* Update WIN position */
+	win->x = fimd_rect.left;
+	win->y = fimd_rect.top;
+
+	fbinfo->var.activate = FB_ACTIVATE_FORCE;
+	ret = fb_set_var(fbinfo, &fbinfo->var);
+	if (ret < 0) {
+		fimc_err("fb_set_var fail (ret=%d)\n", ret);
+		ret = -EINVAL;
+	}
+
+out:
+	mutex_unlock(&ctrl->v4l2_lock);
+
+	return ret;
+}
+
 int fimc_s_fmt_vid_overlay(struct file *filp, void *fh, struct v4l2_format *f)
 {
 	struct fimc_control *ctrl = ((struct fimc_prv_data *)fh)->ctrl;
 	int ctx_id = ((struct fimc_prv_data *)fh)->ctx_id;
 	struct fimc_ctx *ctx;
 	int ret = -1;
-	ctx = &ctrl->out->ctx[ctx_id];
 
 	fimc_info1("%s: called\n", __func__);
 
+	if (ctrl->cap)
+		return fimc_s_fmt_preview(ctrl, f);
+
+	ctx = &ctrl->out->ctx[ctx_id];
+
 	switch (ctx->status) {
 	case FIMC_STREAMON:
 		ret = fimc_check_pos(ctrl, ctx, f);
@@ -156,6 +156,61 @@ int fimc_hwset_clear_irq(struct fimc_control *ctrl)
 	return 0;
 }
 
+/* Registers written by fimc_outdev_set_ctx_param, in image order */
+static const u32 fimc_ctx_regs[FIMC_CTX_REGS] = {
+	S3C_CIGCTRL, S3C_CITRGFMT, S3C_CIOCTRL, S3C_CISCPRERATIO,
+	S3C_CISCPREDST, S3C_CISCCTRL, S3C_CITAREA, S3C_CIREAL_ISIZE,
+	S3C_MSCTRL, S3C_CIOYOFF, S3C_CIOCBOFF, S3C_CIOCROFF,
+	S3C_CIIYOFF, S3C_CIICBOFF, S3C_CIICROFF, S3C_ORGISIZE,
+	S3C_ORGOSIZE, S3C_CIEXTEN, S3C_CIDMAPARAM,
+};
+
+/* command and status bits are never part of a context image */
+static u32 fimc_ctx_reg_mask(u32 reg)
+{
+	switch (reg) {
+	case S3C_CIGCTRL:
+		return ~(S3C_CIGCTRL_SWRST | S3C_CIGCTRL_IRQ_CLR);
+	case S3C_CISCCTRL:
+		return ~S3C_CISCCTRL_SCALERSTART;
+	case S3C_CIREAL_ISIZE:
+		return ~S3C_CIREAL_ISIZE_ADDR_CH_DISABLE;
+	case S3C_MSCTRL:
+		return ~S3C_MSCTRL_ENVID;
+	default:
+		return ~0;
+	}
+}
+
+void fimc_hwget_ctx_regs(struct fimc_control *ctrl, u32 *image)
+{
+	int i;
+
+	for (i = 0; i < FIMC_CTX_REGS; i++)
+		image[i] = readl(ctrl->regs + fimc_ctx_regs[i]) &
+				fimc_ctx_reg_mask(fimc_ctx_regs[i]);
+}
+
+/*
+ * Load a context image.  With the image currently in h/w given as loaded,
+ * only the registers that differ are written.  Returns the write count.
+ */
+int fimc_hwset_ctx_regs(struct fimc_control *ctrl,
+			const u32 *image, const u32 *loaded)
+{
+	int i, cnt = 0;
+
+	for (i = 0; i < FIMC_CTX_REGS; i++) {
+		if (loaded && loaded[i] == image[i])
+			continue;
+
+		writel(image[i], ctrl->regs + fimc_ctx_regs[i]);
+		cnt++;
+	}
+
+	return cnt;
+}
+
 int fimc_hwset_output_area_size(struct fimc_control *ctrl, u32 size)
 {
 	u32 cfg = 0;
@@ -18,6 +18,8 @@
  *   2009.11.04 - remove mfc_common.[ch]
  *                seperate buffer alloc & set (Key Young, Park)
  *   2009.11.24 - add state check when decoding & encoding (Key Young, Park)
+ *   per instance frame run time stats
+ *   add IOCTL_MFC_SET_DPB & IOCTL_MFC_RELEASE_DPB
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -49,6 +51,7 @@
 #include <plat/media.h>
 #include <mach/media.h>
 #include <plat/mfc.h>
+#include <mach/busfreq.h>
 
 #include "mfc_interface.h"
 #include "mfc_logmsg.h"
@@ -56,6 +59,7 @@
 #include "mfc_memory.h"
 #include "mfc_buffer_manager.h"
 #include "mfc_intr.h"
+#include "mfc_frame_stats.h"
 
 #define MFC_FW_NAME	"samsung_mfc_fw.bin"
 
@@ -81,6 +85,8 @@ static int mfc_open(struct inode *inode, struct file *file)
 			goto err_open;
 		}
 
+		s5pv210_busfreq_lock(BUSFREQ_MFC);
+
 		clk_enable(mfc_sclk);
 
 		mfc_load_firmware(mfc_fw_info->data, mfc_fw_info->size);
@@ -121,6 +127,8 @@ static int mfc_open(struct inode *inode, struct file *file)
 	mfc_ctx->extraDPB = MFC_MAX_EXTRA_DPB;
 	mfc_ctx->FrameType = MFC_RET_FRAME_NOT_SET;
 
+	mfc_frame_stats_attach(mfc_ctx);
+
 	file->private_data = mfc_ctx;
 
 	mutex_unlock(&mfc_mutex);
@@ -133,6 +141,8 @@ err_mem_inst:
 	kfree(mfc_ctx);
 err_regulator:
 	if (!mfc_is_running()) {
+		s5pv210_busfreq_unlock(BUSFREQ_MFC);
+
 		/* Turn off mfc power domain regulator */
 		ret = regulator_disable(mfc_pd_regulator);
 		if (ret < 0)
@@ -158,8 +168,10 @@ static int mfc_release(struct inode *inode, struct file *file)
 		goto out_release;
 	}
 
+	mfc_frame_stats_detach(mfc_ctx);
+
+	mfc_put_dpb(mfc_ctx);
 	mfc_release_all_buffer(mfc_ctx->mem_inst_no);
-	mfc_merge_fragment(mfc_ctx->mem_inst_no);
 
 	mfc_return_mem_inst_no(mfc_ctx->mem_inst_no);
 
@@ -175,6 +187,8 @@ static int mfc_release(struct inode *inode, struct file *file)
 	ret = 0;
 
 	if (!mfc_is_running()) {
+		s5pv210_busfreq_unlock(BUSFREQ_MFC);
+
 		/* Turn off mfc power domain regulator */
 		ret = regulator_disable(mfc_pd_regulator);
 		if (ret < 0) {
@@ -245,7 +259,7 @@ static int mfc_ioctl(struct inode *inode, struct file *file, unsigned int cmd, u
 			break;
 		}
 
-		in_param.ret_code = mfc_exe_encode(mfc_ctx, &(in_param.args));
+		in_param.ret_code = mfc_run_frame(mfc_ctx, MFC_FRAME_ENCODE, &(in_param.args));
 		ret = in_param.ret_code;
 		mutex_unlock(&mfc_mutex);
 		break;
@@ -295,7 +309,7 @@ static int mfc_ioctl(struct inode *inode, struct file *file, unsigned int cmd, u
 			break;
 		}
 
-		in_param.ret_code = mfc_exe_decode(mfc_ctx, &(in_param.args));
+		in_param.ret_code = mfc_run_frame(mfc_ctx, MFC_FRAME_DECODE, &(in_param.args));
 		ret = in_param.ret_code;
 		mutex_unlock(&mfc_mutex);
 		break;
@@ -368,7 +382,7 @@ static int mfc_ioctl(struct inode *inode, struct file *file, unsigned int cmd, u
 			break;
 		}
 
-		in_param.ret_code = mfc_release_buffer((unsigned char *)in_param.args.mem_free.u_addr);
+		in_param.ret_code = mfc_release_buffer(mfc_ctx, (unsigned char *)in_param.args.mem_free.u_addr);
 		ret = in_param.ret_code;
 		mutex_unlock(&mfc_mutex);
 		break;
@@ -390,6 +404,36 @@ static int mfc_ioctl(struct inode *inode, struct file *file, unsigned int cmd, u
 		mutex_unlock(&mfc_mutex);
 		break;
 
+	case IOCTL_MFC_SET_DPB:
+		mutex_lock(&mfc_mutex);
+		if (mfc_ctx->MfcState != MFCINST_STATE_DEC_INITIALIZE) {
+			mfc_err("MFCINST_ERR_STATE_INVALID\n");
+			in_param.ret_code = MFCINST_ERR_STATE_INVALID;
+			ret = -EINVAL;
+			mutex_unlock(&mfc_mutex);
+			break;
+		}
+
+		in_param.ret_code = mfc_set_dpb(mfc_ctx, &(in_param.args));
+		ret = in_param.ret_code;
+		mutex_unlock(&mfc_mutex);
+		break;
+
+	case IOCTL_MFC_RELEASE_DPB:
+		mutex_lock(&mfc_mutex);
+		if (mfc_ctx->MfcState < MFCINST_STATE_DEC_INITIALIZE) {
+			mfc_err("MFCINST_ERR_STATE_INVALID\n");
+			in_param.ret_code = MFCINST_ERR_STATE_INVALID;
+			ret = -EINVAL;
+			mutex_unlock(&mfc_mutex);
+			break;
+		}
+
+		in_param.ret_code = mfc_release_dpb(mfc_ctx, &(in_param.args));
+		ret = in_param.ret_code;
+		mutex_unlock(&mfc_mutex);
+		break;
+
 	case IOCTL_MFC_GET_MMAP_SIZE:
 
 		if (mfc_ctx->MfcState < MFCINST_STATE_OPENED) {
@@ -507,6 +551,28 @@ static void mfc_firmware_request_complete_handler(const struct firmware *fw,
 	}
 }
 
+static ssize_t mfc_mem_stats_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	ssize_t len;
+
+	mutex_lock(&mfc_mutex);
+	len = mfc_print_mem_stats(buf, PAGE_SIZE);
+	mutex_unlock(&mfc_mutex);
+
+	return len;
+}
+
+static DEVICE_ATTR(mem_stats, S_IRUGO, mfc_mem_stats_show, NULL);
+
+static ssize_t mfc_frame_stats_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	return mfc_print_frame_stats(buf, PAGE_SIZE);
+}
+
+static DEVICE_ATTR(frame_stats, S_IRUGO, mfc_frame_stats_show, NULL);
+
 static int mfc_probe(struct platform_device *pdev)
 {
 	struct s3c_platform_mfc *pdata;
@@ -619,12 +685,19 @@ static int mfc_probe(struct platform_device *pdev)
 	mfc_init_mem_inst_no();
 	mfc_init_buffer();
 
+	mfc_frame_stats_init();
+
 	ret = misc_register(&mfc_miscdev);
 	if (ret) {
 		mfc_err("MFC can't misc register on minor\n");
 		goto err_misc_reg;
 	}
 
+	if (device_create_file(&pdev->dev, &dev_attr_mem_stats))
+		mfc_warn("can't create mem_stats attribute\n");
+	if (device_create_file(&pdev->dev, &dev_attr_frame_stats))
+		mfc_warn("can't create frame_stats attribute\n");
+
 	/*
 	 * MFC FW downloading
 	 */
@@ -644,6 +717,8 @@ static int mfc_probe(struct platform_device *pdev)
 	return 0;
 
 err_req_fw:
+	device_remove_file(&pdev->dev, &dev_attr_frame_stats);
+	device_remove_file(&pdev->dev, &dev_attr_mem_stats);
 	misc_deregister(&mfc_miscdev);
 err_misc_reg:
 	clk_put(mfc_sclk);
@@ -682,6 +757,8 @@ static int mfc_remove(struct platform_device *pdev)
 
 	clk_put(mfc_sclk);
 
+	device_remove_file(&pdev->dev, &dev_attr_frame_stats);
+	device_remove_file(&pdev->dev, &dev_attr_mem_stats);
 	misc_deregister(&mfc_miscdev);
 
 	if (mfc_fw_info)
@@ -10,6 +10,7 @@
  *   2009.09.14 - use struct list_head for duble linked list
  *   2009.11.04 - get physical address via mfc_allocate_buffer (Key Young, Park)
  *   2009.11.13 - fix free buffer fragmentation (Key Young, Park)
+ *   merge free memory on release, per instance allocation lists
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -41,134 +42,278 @@
 #include "mfc_logmsg.h"
 #include "mfc_memory.h"
 
-static struct list_head mfc_alloc_mem_head[MFC_MAX_PORT_NUM];
-static struct list_head mfc_free_mem_head[MFC_MAX_PORT_NUM];
+/* free extents are filed by fls(size) - 1 */
+#define MFC_FREE_CLASS_NUM	32
+
+struct mfc_port_pool {
+	struct rb_root free_root;
+	struct list_head free_class[MFC_FREE_CLASS_NUM];
+	struct mfc_mem_stats stats;
+};
+
+static struct mfc_port_pool mfc_pool[MFC_MAX_PORT_NUM];
+static struct list_head mfc_inst_mem_head[MFC_MAX_INSTANCE_NUM];
+
+static inline int mfc_free_class(unsigned int size)
+{
+	return fls(size) - 1;
+}
+
+static void mfc_link_free_mem(struct mfc_free_mem *free_node, int port_no)
+{
+	struct mfc_port_pool *pool = &mfc_pool[port_no];
+	struct rb_node **p = &pool->free_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct mfc_free_mem *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct mfc_free_mem, node);
+		if (free_node->start_addr < entry->start_addr)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&free_node->node, parent, p);
+	rb_insert_color(&free_node->node, &pool->free_root);
+
+	list_add(&free_node->list,
+		 &pool->free_class[mfc_free_class(free_node->size)]);
+	pool->stats.free_count++;
+}
+
+static void mfc_unlink_free_mem(struct mfc_free_mem *free_node, int port_no)
+{
+	struct mfc_port_pool *pool = &mfc_pool[port_no];
+
+	rb_erase(&free_node->node, &pool->free_root);
+	list_del(&free_node->list);
+	pool->stats.free_count--;
+}
+
+/* the size of a free extent changed, move it to its new size class */
+static void mfc_reclass_free_mem(struct mfc_free_mem *free_node, int port_no)
+{
+	list_move(&free_node->list,
+		  &mfc_pool[port_no].free_class[mfc_free_class(free_node->size)]);
+}
+
+static unsigned int mfc_largest_free_mem(int port_no)
+{
+	struct mfc_port_pool *pool = &mfc_pool[port_no];
+	struct mfc_free_mem *free_node;
+	unsigned int largest = 0;
+	int class;
+
+	for (class = MFC_FREE_CLASS_NUM - 1; class >= 0; class--) {
+		list_for_each_entry(free_node, &pool->free_class[class], list)
+			largest = max(largest, free_node->size);
+		if (largest)
+			break;
+	}
+
+	return largest;
+}
 
 void mfc_print_mem_list(void)
 {
-	struct list_head *pos;
+	struct rb_node *rb;
 	struct mfc_alloc_mem *alloc_node;
 	struct mfc_free_mem *free_node;
-	int port_no;
+	int port_no, inst_no;
 
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		mfc_info("===== %s port%d list =====\n", __func__,  port_no);
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
+	for (inst_no = 0; inst_no < MFC_MAX_INSTANCE_NUM; inst_no++) {
+		list_for_each_entry(alloc_node, &mfc_inst_mem_head[inst_no], list)
 		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			mfc_info("[alloc_list] inst_no: %d, p_addr: 0x%08x, "
+			mfc_info("[alloc_list] inst_no: %d, port%d, p_addr: 0x%08x, "
 					"u_addr: 0x%p, size: %d\n",
 					alloc_node->inst_no,
+					alloc_node->port_no,
 					alloc_node->p_addr,
 					alloc_node->u_addr,
 					alloc_node->size);
 		}
+	}
 
-		list_for_each(pos, &mfc_free_mem_head[port_no])
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		mfc_info("===== %s port%d list =====\n", __func__,  port_no);
+		for (rb = rb_first(&mfc_pool[port_no].free_root); rb; rb = rb_next(rb))
 		{
-			free_node = list_entry(pos, struct mfc_free_mem, list);
+			free_node = rb_entry(rb, struct mfc_free_mem, node);
 			mfc_info("[free_list] start_addr: 0x%08x size:%d\n",
 					free_node->start_addr , free_node->size);
 		}
 	}
 }
 
-void mfc_merge_fragment(int inst_no)
+ssize_t mfc_print_mem_stats(char *buf, size_t len)
 {
-	struct list_head *pos, *n;
-	struct mfc_free_mem *node1, *node2;
+	struct mfc_mem_stats *stats;
+	unsigned int largest;
 	int port_no;
+	ssize_t n = 0;
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_free_mem_head[port_no])
-		{
-			node1 = list_entry(pos, struct mfc_free_mem, list);
-			node2 = list_entry(n, struct mfc_free_mem, list);
-			if ((node1->start_addr + node1->size) == node2->start_addr) {
-				node2->start_addr = node1->start_addr;
-				node2->size += node1->size;
-				list_del(&(node1->list));
-				kfree(node1);
-			}
-		}
+		stats = &mfc_pool[port_no].stats;
+		largest = mfc_largest_free_mem(port_no);
+		n += scnprintf(buf + n, len - n,
+			"port%d: alloc %u fail %u frag_fail %u free %u "
+			"min_free %u extents %u largest %u fragmentation %u%%\n",
+			port_no, stats->alloc_count, stats->fail_count,
+			stats->frag_fail_count, stats->free_size,
+			stats->min_free_size, stats->free_count, largest,
+			stats->free_size ?
+			100 - (unsigned int)((u64)largest * 100 / stats->free_size) : 0);
 	}
 
-#if defined(DEBUG)
-	mfc_print_mem_list();
-#endif
+	return n;
 }
 
-
-
 static unsigned int mfc_get_free_mem(int alloc_size, int inst_no, int port_no)
 {
-	struct list_head *pos;
+	struct mfc_port_pool *pool = &mfc_pool[port_no];
 	struct mfc_free_mem *free_node, *match_node = NULL;
 	unsigned int alloc_addr = 0;
+	int class;
 
 	mfc_debug("request Size : %d\n", alloc_size);
 
-	if (list_empty(&mfc_free_mem_head[port_no])) {
+	if (alloc_size <= 0) {
+		mfc_err("invalid request size %d\n", alloc_size);
+		goto out_fail;
+	}
+
+	if (RB_EMPTY_ROOT(&pool->free_root)) {
 		mfc_err("all memory is gone\n");
-		return alloc_addr;
+		goto out_fail;
 	}
-	/* find best chunk of memory */
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		free_node = list_entry(pos, struct mfc_free_mem, list);
 
-		if (match_node != NULL) {
+	/*
+	 * find best chunk of memory: anything in a higher class fits, so only
+	 * the request's own class and the first non empty one above it need
+	 * to be looked at
+	 */
+	for (class = mfc_free_class(alloc_size); class < MFC_FREE_CLASS_NUM; class++) {
+		list_for_each_entry(free_node, &pool->free_class[class], list) {
 			if ((free_node->size >= alloc_size) &&
-				(free_node->size < match_node->size))
-				match_node = free_node;
-		} else {
-			if (free_node->size >= alloc_size)
+				(!match_node || free_node->size < match_node->size))
 				match_node = free_node;
 		}
+		if (match_node)
+			break;
 	}
 
+	if (match_node == NULL) {
+		mfc_err("there is no suitable chunk for %d bytes (%u free)\n",
+				alloc_size, pool->stats.free_size);
+		goto out_fail;
+	}
 
-	if (match_node != NULL) {
-		mfc_debug("match : startAddr(0x%08x) size(%d)\n", match_node->start_addr, match_node->size);
+	mfc_debug("match : startAddr(0x%08x) size(%d)\n", match_node->start_addr, match_node->size);
 
-		alloc_addr = match_node->start_addr;
+	alloc_addr = match_node->start_addr;
+	if (match_node->size == alloc_size) {
+		mfc_unlink_free_mem(match_node, port_no);
+		kfree(match_node);
+	} else {
+		/* the tree order is kept, the extent only starts later */
 		match_node->start_addr += alloc_size;
 		match_node->size -= alloc_size;
-
-		if (match_node->size < 0x1)	/* delete match_node. */
-			mfc_err("there is no suitable chunk...[case 0]\n");
-	} else {
-		mfc_err("there is no suitable chunk....[case 1]\n");
-		return 0;
+		mfc_reclass_free_mem(match_node, port_no);
 	}
 
+	pool->stats.alloc_count++;
+	pool->stats.free_size -= alloc_size;
+	pool->stats.min_free_size = min(pool->stats.min_free_size,
+					pool->stats.free_size);
+
 	return alloc_addr;
+
+out_fail:
+	pool->stats.fail_count++;
+	if (alloc_size > 0 && pool->stats.free_size >= alloc_size)
+		pool->stats.frag_fail_count++;
+	return 0;
 }
 
+/* give a range back to its port, merging it with the free neighbours */
+static void mfc_put_free_mem(unsigned int start_addr, unsigned int size, int port_no)
+{
+	struct mfc_port_pool *pool = &mfc_pool[port_no];
+	struct rb_node *rb = pool->free_root.rb_node;
+	struct mfc_free_mem *prev = NULL, *next = NULL, *entry, *free_node;
+
+	/* find the free extents right before and after the range */
+	while (rb) {
+		entry = rb_entry(rb, struct mfc_free_mem, node);
+		if (start_addr < entry->start_addr) {
+			next = entry;
+			rb = rb->rb_left;
+		} else {
+			prev = entry;
+			rb = rb->rb_right;
+		}
+	}
+
+	pool->stats.free_size += size;
+
+	if (prev && (prev->start_addr + prev->size) == start_addr) {
+		prev->size += size;
+		if (next && (prev->start_addr + prev->size) == next->start_addr) {
+			prev->size += next->size;
+			mfc_unlink_free_mem(next, port_no);
+			kfree(next);
+		}
+		mfc_reclass_free_mem(prev, port_no);
+		return;
+	}
+
+	if (next && (start_addr + size) == next->start_addr) {
+		/* the tree order is kept, the extent only starts earlier */
+		next->start_addr = start_addr;
+		next->size += size;
+		mfc_reclass_free_mem(next, port_no);
+		return;
+	}
+
+	free_node = kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
+	if (!free_node) {
+		mfc_err("lost %d bytes at 0x%08x of port%d\n", size, start_addr, port_no);
+		pool->stats.free_size -= size;
+		return;
+	}
+	free_node->start_addr = start_addr;
+	free_node->size = size;
+	mfc_link_free_mem(free_node, port_no);
+}
 
 int mfc_init_buffer(void)
 {
-	struct mfc_free_mem *free_node;
-	int	port_no;
+	struct mfc_port_pool *pool;
+	unsigned int start_addr, size;
+	int port_no, class, inst_no;
+
+	for (inst_no = 0; inst_no < MFC_MAX_INSTANCE_NUM; inst_no++)
+		INIT_LIST_HEAD(&mfc_inst_mem_head[inst_no]);
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		INIT_LIST_HEAD(&mfc_alloc_mem_head[port_no]);
-		INIT_LIST_HEAD(&mfc_free_mem_head[port_no]);
-		/* init free head node */
-		free_node =
-			(struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-		memset(free_node, 0x00, sizeof(struct mfc_free_mem));
+		pool = &mfc_pool[port_no];
+		pool->free_root = RB_ROOT;
+		for (class = 0; class < MFC_FREE_CLASS_NUM; class++)
+			INIT_LIST_HEAD(&pool->free_class[class]);
+		memset(&pool->stats, 0x00, sizeof(struct mfc_mem_stats));
 
 		if (port_no) {
-			free_node->start_addr = mfc_get_port1_buff_paddr();
-			free_node->size = mfc_port1_memsize;
+			start_addr = mfc_get_port1_buff_paddr();
+			size = mfc_port1_memsize;
 		} else {
-			free_node->start_addr = mfc_get_port0_buff_paddr();
-			free_node->size = mfc_port1_memsize -
+			start_addr = mfc_get_port0_buff_paddr();
+			size = mfc_port1_memsize -
 				(mfc_get_port0_buff_paddr() - mfc_get_fw_buff_paddr());
 		}
 
-		list_add_tail(&(free_node->list), &mfc_free_mem_head[port_no]);
+		mfc_put_free_mem(start_addr, size, port_no);
+		pool->stats.min_free_size = pool->stats.free_size;
 	}
 
 #if defined(DEBUG)
@@ -177,22 +322,17 @@ int mfc_init_buffer(void)
 	return 0;
 }
 
-enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
+enum mfc_error_code mfc_release_buffer(struct mfc_inst_ctx *mfc_ctx, unsigned char *u_addr)
 {
-	struct list_head *pos;
-	int port_no;
 	struct mfc_alloc_mem *alloc_node;
 	bool found = false;
 
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
-		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			if (alloc_node->u_addr == u_addr) {
-				mfc_free_alloc_mem(alloc_node, port_no);
-				found = true;
-				break;
-			}
+	list_for_each_entry(alloc_node, &mfc_inst_mem_head[mfc_ctx->mem_inst_no], list)
+	{
+		if (alloc_node->u_addr == u_addr) {
+			mfc_free_alloc_mem(alloc_node);
+			found = true;
+			break;
 		}
 	}
 
@@ -208,45 +348,19 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 
 void mfc_release_all_buffer(int inst_no)
 {
-	struct list_head *pos, *n;
-	int port_no;
-	struct mfc_alloc_mem *alloc_node;
+	struct mfc_alloc_mem *alloc_node, *n;
 
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_alloc_mem_head[port_no]) {
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			if (alloc_node->inst_no == inst_no) {
-				mfc_free_alloc_mem(alloc_node, port_no);
-			}
-		}
-	}
+	list_for_each_entry_safe(alloc_node, n, &mfc_inst_mem_head[inst_no], list)
+		mfc_free_alloc_mem(alloc_node);
 
 #if defined(DEBUG)
 	mfc_print_mem_list();
 #endif
 }
 
-void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
+void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node)
 {
-	struct list_head *pos;
-	struct mfc_free_mem *free_node;
-	struct mfc_free_mem *target_node;
-
-	free_node = (struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-	free_node->start_addr = alloc_node->p_addr;
-	free_node->size = alloc_node->size;
-
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		target_node = list_entry(pos, struct mfc_free_mem, list);
-		if (alloc_node->p_addr < target_node->start_addr)
-			break;
-	}
-
-	if (pos == &mfc_free_mem_head[port_no])
-		list_add_tail(&(free_node->list), &(mfc_free_mem_head[port_no]));
-	else
-		list_add_tail(&(free_node->list), pos);
+	mfc_put_free_mem(alloc_node->p_addr, alloc_node->size, alloc_node->port_no);
 
 	list_del(&(alloc_node->list));
 	kfree(alloc_node);
@@ -254,21 +368,17 @@ void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
 
 enum mfc_error_code mfc_get_phys_addr(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
 {
-	int ret, port_no;
-	struct list_head *pos;
+	int ret;
 	struct mfc_alloc_mem *alloc_node;
 	struct mfc_get_phys_addr_arg *phys_addr_arg;
 
 	phys_addr_arg = (struct mfc_get_phys_addr_arg *)args;
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
-		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			if (alloc_node->u_addr == (unsigned char *)phys_addr_arg->u_addr) {
-				mfc_debug("u_addr(0x%08x), p_addr(0x%08x) is found\n",
-						alloc_node->u_addr, alloc_node->p_addr);
-				goto found;
-			}
+	list_for_each_entry(alloc_node, &mfc_inst_mem_head[mfc_ctx->mem_inst_no], list)
+	{
+		if (alloc_node->u_addr == (unsigned char *)phys_addr_arg->u_addr) {
+			mfc_debug("u_addr(0x%08x), p_addr(0x%08x) is found\n",
+					alloc_node->u_addr, alloc_node->p_addr);
+			goto found;
 		}
 	}
 
@@ -337,8 +447,9 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 
 	alloc_node->size = (int)in_param->buff_size;
 	alloc_node->inst_no = inst_no;
+	alloc_node->port_no = port_no;
 
-	list_add(&(alloc_node->list), &mfc_alloc_mem_head[port_no]);
+	list_add(&(alloc_node->list), &mfc_inst_mem_head[inst_no]);
 	ret = MFCINST_RET_OK;
 
 #if defined(DEBUG)
@@ -9,6 +9,7 @@
  * Change Logs
  *   2009.11.04 - remove mfc_common.[ch]
  *                seperate buffer alloc & set (Key Young, Park)
+ *   per instance allocation lists, free extents indexed by address and size
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -20,6 +21,7 @@
 #define _MFC_BUFFER_MANAGER_H_
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include "mfc_interface.h"
 #include "mfc_opr.h"
 
@@ -27,29 +29,41 @@
 
 /*  Struct Definition */
 struct mfc_alloc_mem  {
-	struct list_head list;     /* strcut list_head for alloc mem        */
+	struct list_head list;     /* link in the instance's alloc list     */
 	unsigned int p_addr;       /* physical address                      */
 	unsigned char *v_addr;     /* virtual address                       */
 	unsigned char *u_addr;     /* virtual address for user mode process */
 	int size;                  /* memory size                           */
 	int inst_no;               /* instance no                           */
+	int port_no;               /* port the memory comes from            */
 };
 
 
 struct mfc_free_mem  {
-	struct list_head list;     /* struct list_head for free mem         */
+	struct rb_node node;       /* port's free tree, sorted by address   */
+	struct list_head list;     /* port's free list for this size class  */
 	unsigned int start_addr;   /* start address of free mem             */
 	unsigned int size;         /* size of free mem                      */
 };
 
 
+struct mfc_mem_stats {
+	unsigned int alloc_count;      /* successful allocations            */
+	unsigned int fail_count;       /* failed allocations                */
+	unsigned int frag_fail_count;  /* failed with enough total free mem */
+	unsigned int free_size;        /* total free memory                 */
+	unsigned int free_count;       /* number of free extents            */
+	unsigned int min_free_size;    /* low watermark of free_size        */
+};
+
+
 /* Function Prototype */
 void mfc_print_mem_list(void);
+ssize_t mfc_print_mem_stats(char *buf, size_t len);
 int mfc_init_buffer(void);
-void mfc_merge_fragment(int inst_no);
 void mfc_release_all_buffer(int inst_no);
-void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no);
-enum mfc_error_code mfc_release_buffer(unsigned char *u_addr);
+void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node);
+enum mfc_error_code mfc_release_buffer(struct mfc_inst_ctx *mfc_ctx, unsigned char *u_addr);
 enum mfc_error_code mfc_get_phys_addr(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args, int port_no);
 
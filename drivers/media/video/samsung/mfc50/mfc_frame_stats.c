@@ -0,0 +1,153 @@
+/*
+ * drivers/media/video/samsung/mfc50/mfc_frame_stats.c
+ *
+ * C file for Samsung MFC (Multi Function Codec - FIMV) driver
+ *
+ * Copyright (c) 2009 Samsung Electronics
+ * http://www.samsungsemi.com/
+ *
+ * Change Logs
+ *   per instance frame accounting
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <asm/div64.h>
+
+#include "mfc_logmsg.h"
+#include "mfc_memory.h"
+#include "mfc_frame_stats.h"
+
+/*
+ * The firmware takes one frame command at a time on channel 0 and the
+ * result registers are shared, so a frame runs in the calling task with
+ * mfc_mutex held from the state check to the read back of its result.
+ * Keeping it there also keeps FREE_BUF or DEC_INIT on the same instance
+ * from slipping in between, and the work runs at the caller's priority.
+ * What is kept per instance is how long the frames took.
+ */
+
+/* all times are in usec */
+struct mfc_frame_stats {
+	unsigned int frames;
+	unsigned int errors;
+	u64 total_run;
+	unsigned int max_run;
+	unsigned int last_run;
+};
+
+struct mfc_frame_inst {
+	struct mfc_inst_ctx *mfc_ctx;
+	struct mfc_frame_stats stats;
+};
+
+static struct mfc_frame_inst mfc_frame_inst[MFC_MAX_INSTANCE_NUM];
+static DEFINE_SPINLOCK(mfc_frame_stats_lock);
+
+static void mfc_frame_account(struct mfc_inst_ctx *mfc_ctx, enum mfc_error_code ret_code, unsigned int run)
+{
+	struct mfc_frame_stats *stats;
+
+	spin_lock(&mfc_frame_stats_lock);
+	stats = &mfc_frame_inst[mfc_ctx->mem_inst_no].stats;
+	stats->frames++;
+	if (ret_code != MFCINST_RET_OK)
+		stats->errors++;
+	stats->total_run += run;
+	stats->max_run = max(stats->max_run, run);
+	stats->last_run = run;
+	spin_unlock(&mfc_frame_stats_lock);
+}
+
+/*
+ * Run one frame of the instance and account for it.  Called with
+ * mfc_mutex held.
+ */
+enum mfc_error_code mfc_run_frame(struct mfc_inst_ctx *mfc_ctx, enum mfc_frame_op op, union mfc_args *args)
+{
+	enum mfc_error_code ret_code;
+	ktime_t start;
+
+	start = ktime_get();
+	if (op == MFC_FRAME_ENCODE)
+		ret_code = mfc_exe_encode(mfc_ctx, args);
+	else
+		ret_code = mfc_exe_decode(mfc_ctx, args);
+
+	mfc_frame_account(mfc_ctx, ret_code, (unsigned int)ktime_us_delta(ktime_get(), start));
+
+	return ret_code;
+}
+
+void mfc_frame_stats_attach(struct mfc_inst_ctx *mfc_ctx)
+{
+	struct mfc_frame_inst *inst = &mfc_frame_inst[mfc_ctx->mem_inst_no];
+
+	spin_lock(&mfc_frame_stats_lock);
+	inst->mfc_ctx = mfc_ctx;
+	memset(&inst->stats, 0, sizeof(inst->stats));
+	spin_unlock(&mfc_frame_stats_lock);
+}
+
+void mfc_frame_stats_detach(struct mfc_inst_ctx *mfc_ctx)
+{
+	struct mfc_frame_inst *inst = &mfc_frame_inst[mfc_ctx->mem_inst_no];
+
+	spin_lock(&mfc_frame_stats_lock);
+	inst->mfc_ctx = NULL;
+	spin_unlock(&mfc_frame_stats_lock);
+}
+
+static unsigned int mfc_frame_avg(u64 total, unsigned int count)
+{
+	if (count == 0)
+		return 0;
+
+	do_div(total, count);
+
+	return (unsigned int)total;
+}
+
+ssize_t mfc_print_frame_stats(char *buf, size_t len)
+{
+	struct mfc_frame_stats stats;
+	int codec_type;
+	int slot;
+	ssize_t n = 0;
+
+	for (slot = 0; slot < MFC_MAX_INSTANCE_NUM; slot++) {
+		spin_lock(&mfc_frame_stats_lock);
+		if (mfc_frame_inst[slot].mfc_ctx == NULL) {
+			spin_unlock(&mfc_frame_stats_lock);
+			continue;
+		}
+		codec_type = mfc_frame_inst[slot].mfc_ctx->MfcCodecType;
+		stats = mfc_frame_inst[slot].stats;
+		spin_unlock(&mfc_frame_stats_lock);
+
+		n += scnprintf(buf + n, len - n,
+			"inst%d: codec %d frames %u errors %u "
+			"run avg %u max %u last %u (usec)\n",
+			slot, codec_type, stats.frames, stats.errors,
+			mfc_frame_avg(stats.total_run, stats.frames),
+			stats.max_run, stats.last_run);
+	}
+
+	return n;
+}
+
+void mfc_frame_stats_init(void)
+{
+	int slot;
+
+	for (slot = 0; slot < MFC_MAX_INSTANCE_NUM; slot++) {
+		mfc_frame_inst[slot].mfc_ctx = NULL;
+		memset(&mfc_frame_inst[slot].stats, 0, sizeof(mfc_frame_inst[slot].stats));
+	}
+}
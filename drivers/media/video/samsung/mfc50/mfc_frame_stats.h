@@ -0,0 +1,34 @@
+/*
+ * drivers/media/video/samsung/mfc50/mfc_frame_stats.h
+ *
+ * Header file for Samsung MFC (Multi Function Codec - FIMV) driver
+ *
+ * Copyright (c) 2009 Samsung Electronics
+ * http://www.samsungsemi.com/
+ *
+ * Change Logs
+ *   per instance frame accounting
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _MFC_FRAME_STATS_H_
+#define _MFC_FRAME_STATS_H_
+
+#include "mfc_interface.h"
+#include "mfc_opr.h"
+
+enum mfc_frame_op {
+	MFC_FRAME_DECODE = 0,
+	MFC_FRAME_ENCODE = 1,
+};
+
+void mfc_frame_stats_init(void);
+void mfc_frame_stats_attach(struct mfc_inst_ctx *mfc_ctx);
+void mfc_frame_stats_detach(struct mfc_inst_ctx *mfc_ctx);
+enum mfc_error_code mfc_run_frame(struct mfc_inst_ctx *mfc_ctx, enum mfc_frame_op op, union mfc_args *args);
+ssize_t mfc_print_frame_stats(char *buf, size_t len);
+
+#endif /* _MFC_FRAME_STATS_H_ */
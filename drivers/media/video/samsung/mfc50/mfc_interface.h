@@ -11,6 +11,7 @@
  *   2009.10.22 - Change codec name VC1AP_DEC -> VC1_DEC (Key Young, Park)
  *   2009.11.04 - get physical address via mfc_allocate_buffer (Key Young, Park)
  *   2009.11.06 - Apply common MFC API (Key Young, Park)
+ *   decode into caller supplied DPBs
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -31,6 +32,8 @@
 #define IOCTL_MFC_FREE_BUF			0x00800011
 #define IOCTL_MFC_GET_PHYS_ADDR			0x00800012
 #define IOCTL_MFC_GET_MMAP_SIZE			0x00800014
+#define IOCTL_MFC_SET_DPB			0x00800015
+#define IOCTL_MFC_RELEASE_DPB			0x00800016
 
 #define IOCTL_MFC_SET_CONFIG			0x00800101
 #define IOCTL_MFC_GET_CONFIG			0x00800102
@@ -94,7 +97,9 @@ enum  ssbsip_mfc_dec_conf {
 	MFC_DEC_GETCONF_CRC_DATA,
 	MFC_DEC_GETCONF_BUF_WIDTH_HEIGHT,
 	FC_DEC_GETCONF_CROP_INFO,
-	MFC_DEC_GETCONF_FRAME_TAG
+	MFC_DEC_GETCONF_FRAME_TAG,
+	MFC_DEC_SETCONF_EXTERNAL_DPB,
+	MFC_DEC_GETCONF_DPB_INFO
 };
 
 enum  ssbsip_mfc_enc_conf {
@@ -302,6 +307,30 @@ struct mfc_mem_free_arg {
 	unsigned int u_addr;
 };
 
+/*
+ * With MFC_DEC_SETCONF_EXTERNAL_DPB set, DEC_INIT stops after parsing the
+ * header and every DPB slot reported by MFC_DEC_GETCONF_DPB_INFO has to be
+ * given with IOCTL_MFC_SET_DPB before the first DEC_EXE.  A plane comes
+ * either from a pmem fd or, when the fd is -1, from a physical address.
+ * Physical addresses need CAP_SYS_RAWIO and must lie in memory reserved
+ * for MFC, FIMC or pmem.
+ */
+struct mfc_dpb_arg {
+	int in_index;                        /* [IN]  DPB slot                                               */
+	int in_luma_fd;                      /* [IN]  pmem fd of the luma (+ MV for H.264) plane, or -1      */
+	unsigned int in_luma_offset;         /* [IN]  offset in in_luma_fd, physical address if fd is -1     */
+	int in_chroma_fd;                    /* [IN]  pmem fd of the chroma plane, or -1                     */
+	unsigned int in_chroma_offset;       /* [IN]  offset in in_chroma_fd, physical address if fd is -1   */
+};
+
+/*
+ * A DPB returned as display buffer by DEC_EXE belongs to the caller until
+ * it is handed back here; the decoder will not write into it meanwhile.
+ */
+struct mfc_dpb_release_arg {
+	unsigned int in_display_Y_addr;      /* [IN]  out_display_Y_addr of DEC_EXE                          */
+};
+
 union mfc_args {
 	struct mfc_enc_init_mpeg4_arg enc_init_mpeg4;
 	struct mfc_enc_init_mpeg4_arg enc_init_h263;
@@ -317,6 +346,9 @@ union mfc_args {
 	struct mfc_mem_alloc_arg mem_alloc;
 	struct mfc_mem_free_arg mem_free;
 	struct mfc_get_phys_addr_arg get_phys_addr;
+
+	struct mfc_dpb_arg dpb;
+	struct mfc_dpb_release_arg dpb_release;
 };
 
 struct mfc_common_args {
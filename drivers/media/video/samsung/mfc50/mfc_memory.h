@@ -102,6 +102,13 @@ unsigned char *mfc_get_port0_buff_vaddr(void);
 unsigned int mfc_get_port1_buff_paddr(void);
 unsigned char *mfc_get_port1_buff_vaddr(void);
 
+/*
+ * buffer addresses are programmed as offsets from the port base in 2KB
+ * units, and each port reaches 256MB above its base
+ */
+#define MFC_PORT_ADDR_ALIGN   (2 * 1024)
+#define MFC_PORT_WINDOW_SIZE  (256 * 1024 * 1024)
+
 extern void __iomem *mfc_sfr_base_vaddr;
 
 #define READL(offset)         readl(mfc_sfr_base_vaddr + (offset))
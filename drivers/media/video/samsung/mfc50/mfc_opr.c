@@ -24,6 +24,7 @@
  *   2009.11.06 - Apply common MFC API (Key Young, Park)
  *   2009.11.06 - memset shared_memory (Key Young, Park)
  *   2009.11.09 - implement packed PB (Key Young, Park)
+ *   decode into caller supplied DPBs (pmem or physical address)
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -35,7 +36,13 @@
 #include <linux/mm.h>
 #include <linux/io.h>
 #include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/bitops.h>
+#include <linux/android_pmem.h>
+#include <linux/capability.h>
 #include <plat/regs-mfc.h>
+#include <plat/media.h>
+#include <mach/media.h>
 #include <asm/cacheflush.h>
 #include <mach/map.h>
 #include <plat/map-s5p.h>
@@ -100,6 +107,7 @@ static enum mfc_error_code mfc_alloc_codec_buffer(struct mfc_inst_ctx *mfc_ctx,
 static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 static enum mfc_error_code mfc_alloc_context_buffer(struct mfc_inst_ctx *mfc_ctx, unsigned int mapped_addr, unsigned int *context_addr, int *size);
 static enum mfc_error_code mfc_alloc_stream_ref_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
+static void mfc_hold_dpb(struct mfc_inst_ctx *mfc_ctx, unsigned int luma_paddr);
 
 static int CheckMPEG4StartCode(unsigned char *src_mem, unsigned int remainSize);
 static int CheckDecStartCode(unsigned char *src_mem, unsigned int nstreamSize, enum ssbsip_mfc_codec_type nCodecType);
@@ -237,8 +245,8 @@ static void mfc_set_dec_stream_buffer(struct mfc_inst_ctx *mfc_ctx, int buf_addr
 
 	port0_base_paddr = mfc_port0_base_paddr;
 
-	/* release buffer */
-	WRITEL(0xffffffff, MFC_SI_CH0_RELEASE_BUFFER);
+	/* release buffer : DPBs not held by the caller */
+	WRITEL(mfc_ctx->dpbAvail, MFC_SI_CH0_RELEASE_BUFFER);
 
 	/* Set stream & desc buffer */
 	WRITEL((buf_addr - port0_base_paddr) >> 11, MFC_SI_CH0_ES_ADDR);
@@ -250,17 +258,11 @@ static void mfc_set_dec_stream_buffer(struct mfc_inst_ctx *mfc_ctx, int buf_addr
 	mfc_debug_L0("stream_paddr: 0x%08x, desc_paddr: 0x%08x\n", buf_addr, buf_addr + CPB_BUF_SIZE);
 }
 
-static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
+/* per DPB sizes, luma includes the MV plane for H.264 */
+static void mfc_calc_dec_frame_size(struct mfc_inst_ctx *mfc_ctx, struct mfc_dec_init_arg *init_arg, struct mfc_frame_buf_arg *buf_size)
 {
-	struct mfc_dec_init_arg *init_arg;
-	enum mfc_error_code ret_code;
-	union mfc_args local_param;
-	struct mfc_frame_buf_arg buf_size;
-	unsigned int luma_size, chroma_size;
 	unsigned int luma_plane_sz, chroma_plane_sz, mv_plane_sz;
 
-	init_arg = (struct mfc_dec_init_arg *)args;
-
 	/* width : 128B align, height : 32B align, size: 8KB align */
 	luma_plane_sz   = ALIGN_TO_128B(init_arg->out_img_width) * ALIGN_TO_32B(init_arg->out_img_height);
 	luma_plane_sz   = ALIGN_TO_8KB(luma_plane_sz);
@@ -268,19 +270,32 @@ static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_c
 	chroma_plane_sz = ALIGN_TO_8KB(chroma_plane_sz);
 	mv_plane_sz     = 0;
 
-	buf_size.luma   = luma_plane_sz;
-	buf_size.chroma = chroma_plane_sz;
+	buf_size->luma   = luma_plane_sz;
+	buf_size->chroma = chroma_plane_sz;
 
 	if (mfc_ctx->MfcCodecType == H264_DEC) {
 		/* width : 128B align, height : 32B align, size: 8KB align */
 		mv_plane_sz = ALIGN_TO_128B(init_arg->out_img_width) * ALIGN_TO_32B(init_arg->out_img_height / 4);
 		mv_plane_sz = ALIGN_TO_8KB(mv_plane_sz);
-		buf_size.luma += mv_plane_sz;
+		buf_size->luma += mv_plane_sz;
 	}
 
 	mfc_ctx->shared_mem.allocated_luma_dpb_size   = luma_plane_sz;
 	mfc_ctx->shared_mem.allocated_chroma_dpb_size = chroma_plane_sz;
 	mfc_ctx->shared_mem.allocated_mv_size         = mv_plane_sz;
+}
+
+static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
+{
+	struct mfc_dec_init_arg *init_arg;
+	enum mfc_error_code ret_code;
+	union mfc_args local_param;
+	struct mfc_frame_buf_arg buf_size;
+	unsigned int luma_size, chroma_size;
+
+	init_arg = (struct mfc_dec_init_arg *)args;
+
+	mfc_calc_dec_frame_size(mfc_ctx, init_arg, &buf_size);
 
 	luma_size = buf_size.luma * mfc_ctx->totalDPBCnt;
 	chroma_size = buf_size.chroma * mfc_ctx->totalDPBCnt;
@@ -343,6 +358,11 @@ static void mfc_set_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx)
 
 	if (mfc_ctx->MfcCodecType == H264_DEC) {
 		for (i = 0; i < mfc_ctx->totalDPBCnt; i++) {
+			if (mfc_ctx->extDPB) {
+				dpb_buff_addr.luma = mfc_ctx->ext_dpb[i].luma_paddr;
+				dpb_buff_addr.chroma = mfc_ctx->ext_dpb[i].chroma_paddr;
+			}
+
 			mfc_debug("DPB[%d] luma_buf_addr   : 0x%08x  luma_buf_size   : %d\n", i, dpb_buff_addr.luma, luma_plane_sz);
 			mfc_debug("DPB[%d] chroma_buf_addr : 0x%08x  chroma_buf_size : %d\n", i, dpb_buff_addr.chroma, chroma_plane_sz);
 			mfc_debug("DPB[%d] mv_buf_addr     : 0x%08x  mv_plane_sz     : %d\n", i, dpb_buff_addr.luma + luma_plane_sz, mv_plane_sz);
@@ -358,6 +378,11 @@ static void mfc_set_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx)
 		}
 	} else {
 		for (i = 0; i < mfc_ctx->totalDPBCnt; i++) {
+			if (mfc_ctx->extDPB) {
+				dpb_buff_addr.luma = mfc_ctx->ext_dpb[i].luma_paddr;
+				dpb_buff_addr.chroma = mfc_ctx->ext_dpb[i].chroma_paddr;
+			}
+
 			mfc_debug("DPB[%d] luma_buf_addr   : 0x%08x  luma_buf_size   : %d\n", i, dpb_buff_addr.luma, luma_plane_sz);
 			mfc_debug("DPB[%d] chroma_buf_addr : 0x%08x  chroma_buf_size : %d\n", i, dpb_buff_addr.chroma, chroma_plane_sz);
 
@@ -1243,6 +1268,34 @@ enum mfc_error_code mfc_exe_encode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 	return ret_code;
 }
 
+static enum mfc_error_code mfc_init_dec_buffer(struct mfc_inst_ctx *mfc_ctx)
+{
+	int nIntrRet;
+	int nReturnErrCode;
+
+	mfc_write_shared_mem(mfc_ctx->shared_mem_vaddr, &(mfc_ctx->shared_mem));
+	WRITEL((mfc_ctx->shared_mem_paddr - mfc_port0_base_paddr), MFC_SI_CH0_HOST_WR_ADR);
+	WRITEL((INIT_BUFFER << 16) | (mfc_ctx->InstNo), MFC_SI_CH0_INST_ID);
+
+	nIntrRet = mfc_wait_for_done(R2H_CMD_INIT_BUFFERS_RET);
+	nReturnErrCode = mfc_return_code();
+	if (nIntrRet == 0) {
+		mfc_err("MFCINST_ERR_DEC_INIT_TIME_OUT..............[#2]\n");
+		return MFCINST_ERR_INTR_TIME_OUT;
+	} else if ((nIntrRet != R2H_CMD_INIT_BUFFERS_RET) && (nReturnErrCode < MFC_WARN_START_NO)) {
+		mfc_err("MFCINST_ERR_DEC_INIT_BUFFER_FAIL ........(Intr Code : %d)\n", nIntrRet);
+		return MFCINST_ERR_DEC_INIT_BUFFER_FAIL;
+	} else if (nIntrRet != R2H_CMD_INIT_BUFFERS_RET) {
+		mfc_warn("MFCINST_WARN_DEC_INIT_BUFFER.........(Intr code: %d)\n", nIntrRet);
+	}
+
+	mfc_ctx->IsStartedIFrame = 0;
+
+	mfc_backup_context(mfc_ctx);
+
+	return MFCINST_RET_OK;
+}
+
 enum mfc_error_code mfc_init_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
 {
 	enum mfc_error_code ret_code;
@@ -1265,6 +1318,7 @@ enum mfc_error_code mfc_init_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 	/* Context setting from input param */
 	mfc_ctx->MfcCodecType = init_arg->in_codec_type;
 	mfc_ctx->IsPackedPB = init_arg->in_packed_PB;
+	mfc_ctx->dpbAvail = 0xffffffff;
 
 	/* OPEN CHANNEL
 	 *	- set open instance using codec_type
@@ -1405,16 +1459,30 @@ enum mfc_error_code mfc_init_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 
 	mfc_set_codec_buffer(mfc_ctx);
 
-	ret_code = mfc_alloc_dec_frame_buffer(mfc_ctx, args);
-	if (ret_code != MFCINST_RET_OK) {
-		/* In case of no instance, we should not release codec instance */
-		if (mfc_ctx->InstNo >= 0)
-			mfc_return_inst_no(mfc_ctx->InstNo, mfc_ctx->MfcCodecType);
+	if (mfc_ctx->extDPB) {
+		if (mfc_ctx->totalDPBCnt > MFC_MAX_DPB_NUM) {
+			mfc_err("MFCINST_ERR_FRM_BUF_SIZE : %d DPBs\n", mfc_ctx->totalDPBCnt);
+			if (mfc_ctx->InstNo >= 0)
+				mfc_return_inst_no(mfc_ctx->InstNo, mfc_ctx->MfcCodecType);
 
-		return ret_code;
-	}
+			return MFCINST_ERR_FRM_BUF_SIZE;
+		}
 
-	mfc_set_dec_frame_buffer(mfc_ctx);
+		mfc_calc_dec_frame_size(mfc_ctx, init_arg, &init_arg->out_frame_buf_size);
+		mfc_ctx->extDPBSet = 0;
+		mfc_ctx->extDPBReady = 0;
+	} else {
+		ret_code = mfc_alloc_dec_frame_buffer(mfc_ctx, args);
+		if (ret_code != MFCINST_RET_OK) {
+			/* In case of no instance, we should not release codec instance */
+			if (mfc_ctx->InstNo >= 0)
+				mfc_return_inst_no(mfc_ctx->InstNo, mfc_ctx->MfcCodecType);
+
+			return ret_code;
+		}
+
+		mfc_set_dec_frame_buffer(mfc_ctx);
+	}
 
 	/*
 	  * Set Available Type
@@ -1439,40 +1507,26 @@ enum mfc_error_code mfc_init_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 #endif
 #endif
 
-	mfc_write_shared_mem(mfc_ctx->shared_mem_vaddr, &(mfc_ctx->shared_mem));
-	WRITEL((mfc_ctx->shared_mem_paddr - mfc_port0_base_paddr), MFC_SI_CH0_HOST_WR_ADR);
-	WRITEL((INIT_BUFFER << 16) | (mfc_ctx->InstNo), MFC_SI_CH0_INST_ID);
+	/* INIT_BUFFER waits for the caller's DPBs, see mfc_set_dpb() */
+	if (mfc_ctx->extDPB)
+		goto out_crop_info;
 
-	nIntrRet = mfc_wait_for_done(R2H_CMD_INIT_BUFFERS_RET);
-	nReturnErrCode = mfc_return_code();
-	if (nIntrRet == 0) {
+	ret_code = mfc_init_dec_buffer(mfc_ctx);
+	if (ret_code != MFCINST_RET_OK) {
 #ifdef ENABLE_DEBUG_DEC_EXE_INTR_ERR
 #if ENABLE_DEBUG_DEC_EXE_INTR_ERR
-		makefile_mfc_decinit_err_info(mfc_ctx, init_arg, 300);
+		if (ret_code == MFCINST_ERR_INTR_TIME_OUT)
+			makefile_mfc_decinit_err_info(mfc_ctx, init_arg, 300);
 #endif
 #endif
-
-		mfc_err("MFCINST_ERR_DEC_INIT_TIME_OUT..............[#2]\n");
 		/* In case of no instance, we should not release codec instance */
 		if (mfc_ctx->InstNo >= 0)
 			mfc_return_inst_no(mfc_ctx->InstNo, mfc_ctx->MfcCodecType);
 
-		return MFCINST_ERR_INTR_TIME_OUT;
-	} else if ((nIntrRet != R2H_CMD_INIT_BUFFERS_RET) && (nReturnErrCode < MFC_WARN_START_NO)) {
-		mfc_err("MFCINST_ERR_DEC_INIT_BUFFER_FAIL ........(Intr Code : %d)\n", nIntrRet);
-		/* In case of no instance, we should not release codec instance */
-		if (mfc_ctx->InstNo >= 0)
-			mfc_return_inst_no(mfc_ctx->InstNo, mfc_ctx->MfcCodecType);
-
-		return MFCINST_ERR_DEC_INIT_BUFFER_FAIL;
-	} else if (nIntrRet != R2H_CMD_INIT_BUFFERS_RET) {
-		mfc_warn("MFCINST_WARN_DEC_INIT_BUFFER.........(Intr code: %d)\n", nIntrRet);
+		return ret_code;
 	}
 
-	mfc_ctx->IsStartedIFrame = 0;
-
-	mfc_backup_context(mfc_ctx);
-
+out_crop_info:
 	mfc_debug("[%d] mfc_init_decode() end\n", current->pid);
 
 	mfc_read_shared_mem(mfc_ctx->shared_mem_vaddr, &(mfc_ctx->shared_mem));
@@ -1635,6 +1689,19 @@ enum mfc_error_code mfc_exe_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 
 	dec_arg = (struct mfc_dec_exe_arg *)args;
 
+	if (mfc_ctx->extDPB) {
+		if (!mfc_ctx->extDPBReady) {
+			mfc_err("MFCINST_ERR_FRM_BUF_INVALID : DPBs are not set\n");
+			return MFCINST_ERR_FRM_BUF_INVALID;
+		}
+
+		/* the firmware needs its minimum DPB count free to decode into */
+		if (hweight32(mfc_ctx->dpbAvail & MFC_DPB_MASK(mfc_ctx->totalDPBCnt)) < mfc_ctx->DPBCnt) {
+			mfc_err("MFCINST_ERR_FRM_BUF_INVALID : too many DPBs held\n");
+			return MFCINST_ERR_FRM_BUF_INVALID;
+		}
+	}
+
 	mfc_ctx->shared_mem.set_frame_tag = dec_arg->in_frametag;
 
 	mfc_write_shared_mem(mfc_ctx->shared_mem_vaddr, &(mfc_ctx->shared_mem));
@@ -1697,11 +1764,280 @@ enum mfc_error_code mfc_exe_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 
 	}
 
+	/* the display buffer belongs to the caller until mfc_release_dpb() */
+	if (mfc_ctx->extDPB && dec_arg->out_display_Y_addr)
+		mfc_hold_dpb(mfc_ctx, dec_arg->out_display_Y_addr);
+
 	mfc_debug_L0("--\n");
 
 	return ret_code;
 }
 
+/* reserved regions a raw DPB address may point into */
+static const struct {
+	int dev_id;
+	int bank;
+} mfc_dpb_raw_regions[] = {
+	{ S5P_MDEV_MFC, 0 },
+	{ S5P_MDEV_MFC, 1 },
+	{ S5P_MDEV_FIMC0, 0 },
+	{ S5P_MDEV_FIMC1, 0 },
+	{ S5P_MDEV_FIMC2, 0 },
+	{ S5P_MDEV_PMEM, 0 },
+	{ S5P_MDEV_PMEM_GPU1, 0 },
+	{ S5P_MDEV_PMEM_ADSP, 0 },
+};
+
+static int mfc_dpb_raw_region_ok(unsigned int paddr, unsigned int size)
+{
+	dma_addr_t base;
+	size_t len;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mfc_dpb_raw_regions); i++) {
+		len = s5p_get_media_memsize_bank(mfc_dpb_raw_regions[i].dev_id,
+				mfc_dpb_raw_regions[i].bank);
+		if (len == 0)
+			continue;
+
+		base = s5p_get_media_memory_bank(mfc_dpb_raw_regions[i].dev_id,
+				mfc_dpb_raw_regions[i].bank);
+		if ((paddr >= base) && (paddr - base <= len) && (size <= len - (paddr - base)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The DPBs are written by the codec and read by the caller: flush before
+ * a slot is handed to the hardware so no dirty line lands on decoded data
+ * later, and invalidate when a display buffer comes back to the caller.
+ */
+static void mfc_dpb_cache_op(struct mfc_inst_ctx *mfc_ctx, struct mfc_ext_dpb *dpb, unsigned int op)
+{
+	unsigned int luma_size, chroma_size;
+
+	luma_size = mfc_ctx->shared_mem.allocated_luma_dpb_size + mfc_ctx->shared_mem.allocated_mv_size;
+	chroma_size = mfc_ctx->shared_mem.allocated_chroma_dpb_size;
+
+	if (dpb->luma_file != NULL)
+		pmem_cache_maint(dpb->luma_file, dpb->luma_offset, luma_size, op);
+	if (dpb->chroma_file != NULL)
+		pmem_cache_maint(dpb->chroma_file, dpb->chroma_offset, chroma_size, op);
+}
+
+static enum mfc_error_code mfc_get_dpb_plane(int fd, unsigned int offset, unsigned int size,
+	unsigned int port_base_paddr, unsigned int *paddr, struct file **filp)
+{
+	unsigned long start, vstart, len;
+	unsigned int fw_paddr;
+
+	*filp = NULL;
+
+	if (fd >= 0) {
+		if (get_pmem_file(fd, &start, &vstart, &len, filp) < 0) {
+			mfc_err("invalid pmem fd %d\n", fd);
+			return MFCINST_ERR_FRM_BUF_INVALID;
+		}
+
+		if ((offset > len) || (size > len - offset)) {
+			mfc_err("plane 0x%x+0x%x exceeds pmem size 0x%lx\n", offset, size, len);
+			goto err_plane;
+		}
+
+		*paddr = start + offset;
+	} else {
+		*paddr = offset;
+
+		/*
+		 * a raw address is only taken from privileged callers and must
+		 * stay inside memory reserved for the media devices
+		 */
+		if (!capable(CAP_SYS_RAWIO)) {
+			mfc_err("raw DPB address needs CAP_SYS_RAWIO\n");
+			return MFCINST_ERR_FRM_BUF_INVALID;
+		}
+
+		if (!mfc_dpb_raw_region_ok(*paddr, size)) {
+			mfc_err("plane 0x%08x+0x%x is not in a reserved region\n", *paddr, size);
+			return MFCINST_ERR_FRM_BUF_INVALID;
+		}
+
+		/* never let a raw address point the codec at its own firmware */
+		fw_paddr = mfc_get_fw_buff_paddr();
+		if ((*paddr < fw_paddr + MFC_FW_TOTAL_BUF_SIZE) && (*paddr + size > fw_paddr)) {
+			mfc_err("plane 0x%08x overlaps MFC firmware\n", *paddr);
+			goto err_plane;
+		}
+	}
+
+	if ((*paddr & (MFC_PORT_ADDR_ALIGN - 1)) || (*paddr < port_base_paddr) ||
+	    (*paddr - port_base_paddr > MFC_PORT_WINDOW_SIZE) ||
+	    (size > MFC_PORT_WINDOW_SIZE - (*paddr - port_base_paddr))) {
+		mfc_err("plane 0x%08x is out of MFC port range (base 0x%08x)\n", *paddr, port_base_paddr);
+		goto err_plane;
+	}
+
+	return MFCINST_RET_OK;
+
+err_plane:
+	if (*filp != NULL) {
+		put_pmem_file(*filp);
+		*filp = NULL;
+	}
+
+	return MFCINST_ERR_FRM_BUF_INVALID;
+}
+
+static void mfc_put_dpb_slot(struct mfc_ext_dpb *dpb)
+{
+	if (dpb->luma_file != NULL)
+		put_pmem_file(dpb->luma_file);
+	if (dpb->chroma_file != NULL)
+		put_pmem_file(dpb->chroma_file);
+
+	memset(dpb, 0, sizeof(*dpb));
+}
+
+enum mfc_error_code mfc_set_dpb(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
+{
+	struct mfc_dpb_arg *dpb_arg;
+	struct mfc_ext_dpb *dpb;
+	unsigned int luma_paddr, chroma_paddr;
+	unsigned int luma_size, chroma_size;
+	struct file *luma_file, *chroma_file;
+	enum mfc_error_code ret_code;
+
+	dpb_arg = (struct mfc_dpb_arg *)args;
+
+	if (!mfc_ctx->extDPB || mfc_ctx->extDPBReady) {
+		mfc_err("MFCINST_ERR_STATE_INVALID : DPBs can't be set now\n");
+		return MFCINST_ERR_STATE_INVALID;
+	}
+
+	if ((dpb_arg->in_index < 0) || (dpb_arg->in_index >= mfc_ctx->totalDPBCnt)) {
+		mfc_err("MFCINST_ERR_INVALID_PARAM : DPB index %d\n", dpb_arg->in_index);
+		return MFCINST_ERR_INVALID_PARAM;
+	}
+
+	luma_size = mfc_ctx->shared_mem.allocated_luma_dpb_size + mfc_ctx->shared_mem.allocated_mv_size;
+	chroma_size = mfc_ctx->shared_mem.allocated_chroma_dpb_size;
+
+	/* luma (and MV) go through port1, chroma through port0 */
+	ret_code = mfc_get_dpb_plane(dpb_arg->in_luma_fd, dpb_arg->in_luma_offset, luma_size,
+			mfc_port1_base_paddr, &luma_paddr, &luma_file);
+	if (ret_code != MFCINST_RET_OK)
+		return ret_code;
+
+	ret_code = mfc_get_dpb_plane(dpb_arg->in_chroma_fd, dpb_arg->in_chroma_offset, chroma_size,
+			mfc_port0_base_paddr, &chroma_paddr, &chroma_file);
+	if (ret_code != MFCINST_RET_OK) {
+		if (luma_file != NULL)
+			put_pmem_file(luma_file);
+		return ret_code;
+	}
+
+	dpb = &mfc_ctx->ext_dpb[dpb_arg->in_index];
+	mfc_put_dpb_slot(dpb);
+	dpb->luma_paddr = luma_paddr;
+	dpb->chroma_paddr = chroma_paddr;
+	dpb->luma_file = luma_file;
+	dpb->chroma_file = chroma_file;
+	dpb->luma_offset = dpb_arg->in_luma_offset;
+	dpb->chroma_offset = dpb_arg->in_chroma_offset;
+
+	mfc_dpb_cache_op(mfc_ctx, dpb, PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
+
+	mfc_ctx->extDPBSet |= (1U << dpb_arg->in_index);
+	if (mfc_ctx->extDPBSet != MFC_DPB_MASK(mfc_ctx->totalDPBCnt))
+		return MFCINST_RET_OK;
+
+	/*
+	 * every slot is known, redo what mfc_init_decode() left out: other
+	 * instances may have used the channel registers since then
+	 */
+	mfc_restore_context(mfc_ctx);
+	mfc_set_codec_buffer(mfc_ctx);
+	WRITEL(((mfc_ctx->sliceEnable << 31) |
+		(mfc_ctx->displayDelay ? ((1 << 30) |
+		(mfc_ctx->displayDelay << 16)) : 0) |
+		mfc_ctx->totalDPBCnt), MFC_SI_CH0_DPB_CONFIG_CTRL);
+	mfc_set_dec_frame_buffer(mfc_ctx);
+
+	ret_code = mfc_init_dec_buffer(mfc_ctx);
+	if (ret_code != MFCINST_RET_OK)
+		return ret_code;
+
+	mfc_ctx->extDPBReady = 1;
+
+	return MFCINST_RET_OK;
+}
+
+static int mfc_find_dpb(struct mfc_inst_ctx *mfc_ctx, unsigned int luma_paddr)
+{
+	int i;
+
+	for (i = 0; i < mfc_ctx->totalDPBCnt; i++) {
+		if (mfc_ctx->ext_dpb[i].luma_paddr == luma_paddr)
+			return i;
+	}
+
+	return -1;
+}
+
+static void mfc_hold_dpb(struct mfc_inst_ctx *mfc_ctx, unsigned int luma_paddr)
+{
+	int i;
+
+	i = mfc_find_dpb(mfc_ctx, luma_paddr);
+	if (i < 0) {
+		mfc_warn("display buffer 0x%08x is not a DPB\n", luma_paddr);
+		return;
+	}
+
+	if (mfc_ctx->ext_dpb[i].hold++ == 0)
+		mfc_dpb_cache_op(mfc_ctx, &mfc_ctx->ext_dpb[i], PMEM_CACHE_INVALIDATE);
+	mfc_ctx->dpbAvail &= ~(1U << i);
+}
+
+enum mfc_error_code mfc_release_dpb(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
+{
+	struct mfc_dpb_release_arg *release_arg;
+	int i;
+
+	release_arg = (struct mfc_dpb_release_arg *)args;
+
+	if (!mfc_ctx->extDPBReady) {
+		mfc_err("MFCINST_ERR_STATE_INVALID : no DPBs are set\n");
+		return MFCINST_ERR_STATE_INVALID;
+	}
+
+	i = mfc_find_dpb(mfc_ctx, release_arg->in_display_Y_addr);
+	if ((i < 0) || (mfc_ctx->ext_dpb[i].hold == 0)) {
+		mfc_err("MFCINST_ERR_INVALID_PARAM : 0x%08x is not held\n", release_arg->in_display_Y_addr);
+		return MFCINST_ERR_INVALID_PARAM;
+	}
+
+	if (--mfc_ctx->ext_dpb[i].hold == 0) {
+		mfc_dpb_cache_op(mfc_ctx, &mfc_ctx->ext_dpb[i], PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
+		mfc_ctx->dpbAvail |= (1U << i);
+	}
+
+	return MFCINST_RET_OK;
+}
+
+void mfc_put_dpb(struct mfc_inst_ctx *mfc_ctx)
+{
+	int i;
+
+	for (i = 0; i < MFC_MAX_DPB_NUM; i++)
+		mfc_put_dpb_slot(&mfc_ctx->ext_dpb[i]);
+
+	mfc_ctx->extDPBSet = 0;
+	mfc_ctx->extDPBReady = 0;
+}
+
 enum mfc_error_code mfc_deinit_hw(struct mfc_inst_ctx *mfc_ctx)
 {
 	mfc_restore_context(mfc_ctx);
@@ -1724,6 +2060,19 @@ enum mfc_error_code mfc_get_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 		get_cnf_arg->out_config_value[1] = READL(MFC_CRC_CHROMA0);
 		break;
 
+	case MFC_DEC_GETCONF_DPB_INFO:
+		if (mfc_ctx->MfcState < MFCINST_STATE_DEC_INITIALIZE) {
+			mfc_err("MFC_DEC_GETCONF_DPB_INFO : state is invalid\n");
+			return MFCINST_ERR_STATE_INVALID;
+		}
+		/* slots, luma (+ MV) and chroma size per slot, slots kept free */
+		get_cnf_arg->out_config_value[0] = mfc_ctx->totalDPBCnt;
+		get_cnf_arg->out_config_value[1] = mfc_ctx->shared_mem.allocated_luma_dpb_size +
+						   mfc_ctx->shared_mem.allocated_mv_size;
+		get_cnf_arg->out_config_value[2] = mfc_ctx->shared_mem.allocated_chroma_dpb_size;
+		get_cnf_arg->out_config_value[3] = mfc_ctx->DPBCnt;
+		break;
+
 	default:
 		mfc_err("invalid config param\n");
 		return MFCINST_ERR_GET_CONF; /* peter, it should be mod. */
@@ -1832,6 +2181,20 @@ enum mfc_error_code mfc_set_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 		mfc_ctx->heightFIMV1 = set_cnf_arg->in_config_value[1];
 		break;
 
+	case MFC_DEC_SETCONF_EXTERNAL_DPB:
+		if (mfc_ctx->MfcState >= MFCINST_STATE_DEC_INITIALIZE) {
+			mfc_err("MFC_DEC_SETCONF_EXTERNAL_DPB : state is invalid\n");
+			return MFCINST_ERR_STATE_INVALID;
+		}
+
+		if ((set_cnf_arg->in_config_value[0] == 0) || (set_cnf_arg->in_config_value[0] == 1)) {
+			mfc_ctx->extDPB = set_cnf_arg->in_config_value[0];
+		} else {
+			mfc_warn("EXTERNAL_DPB should be 0 or 1\n");
+			mfc_ctx->extDPB = 0;
+		}
+		break;
+
 	case MFC_ENC_SETCONF_FRAME_TYPE:
 		if (mfc_ctx->MfcState != MFCINST_STATE_ENC_EXE) {
 			mfc_err("MFC_ENC_SETCONF_FRAME_TYPE : state is invalid\n");
@@ -12,6 +12,7 @@
  *                including suspend & resume fuction. (Key Young, Park)
  *   2009.11.04 - remove mfc_common.[ch]
  *                seperate buffer alloc & set (Key Young, Park)
+ *   caller supplied DPBs with display ownership
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License version 2 as
@@ -71,6 +72,10 @@
 
 #define BOUND_MEMORY_SIZE		921600
 
+/* one bit per DPB in MFC_SI_CH0_RELEASE_BUFFER */
+#define MFC_MAX_DPB_NUM			32
+#define MFC_DPB_MASK(n)			((n) >= MFC_MAX_DPB_NUM ? 0xffffffff : ((1U << (n)) - 1))
+
 enum  mfc_inst_state {
 	MFCINST_STATE_NULL = 0,
 
@@ -144,6 +149,19 @@ enum  mfc_frame_type {
 	MFC_RET_FRAME_B_FRAME = 3
 };
 
+struct file;
+
+/* DPB slot given by the caller in external DPB mode */
+struct mfc_ext_dpb {
+	unsigned int luma_paddr;	/* followed by the MV plane for H.264 */
+	unsigned int chroma_paddr;
+	struct file *luma_file;		/* pmem files pinned while the slot is set */
+	struct file *chroma_file;
+	unsigned int luma_offset;	/* plane offsets within the pmem files */
+	unsigned int chroma_offset;
+	int hold;			/* display references owned by the caller */
+};
+
 struct mfc_inst_ctx {
 	int InstNo;
 	unsigned int DPBCnt;
@@ -174,6 +192,11 @@ struct mfc_inst_ctx {
 	unsigned int shared_mem_vaddr;
 	unsigned int IsStartedIFrame;
 	struct mfc_shared_mem shared_mem;
+	unsigned int extDPB;		/* decode into caller supplied DPBs */
+	unsigned int extDPBSet;		/* slots given so far */
+	unsigned int extDPBReady;	/* all slots given, INIT_BUFFER done */
+	unsigned int dpbAvail;		/* written to MFC_SI_CH0_RELEASE_BUFFER */
+	struct mfc_ext_dpb ext_dpb[MFC_MAX_DPB_NUM];
 };
 
 int mfc_load_firmware(const unsigned char *data, size_t size);
@@ -187,6 +210,9 @@ enum mfc_error_code mfc_exe_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 enum mfc_error_code mfc_get_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 enum mfc_error_code mfc_set_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 enum mfc_error_code mfc_deinit_hw(struct mfc_inst_ctx *mfc_ctx);
+enum mfc_error_code mfc_set_dpb(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
+enum mfc_error_code mfc_release_dpb(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
+void mfc_put_dpb(struct mfc_inst_ctx *mfc_ctx);
 enum mfc_error_code mfc_set_sleep(void);
 enum mfc_error_code mfc_set_wakeup(void);
 
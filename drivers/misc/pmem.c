@@ -19,10 +19,15 @@
 #include <linux/file.h>
 #include <linux/mm.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/debugfs.h>
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -30,6 +35,8 @@
 #define PMEM_MAX_DEVICES 10
 #define PMEM_MAX_ORDER 128
 #define PMEM_MIN_ALLOC PAGE_SIZE
+/* a region of num_entries pages can't hold a block of order BITS_PER_LONG */
+#define PMEM_FREE_ORDERS BITS_PER_LONG
 
 #define PMEM_DEBUG 1
 
@@ -48,6 +55,9 @@
  */
 #define PMEM_FLAGS_SUBMAP 0x1 << 3
 #define PMEM_FLAGS_UNSUBMAP 0x1 << 4
+/* indicates the owner declares its cpu writes with PMEM_DIRTY, cache cleans
+ * only cover the declared ranges */
+#define PMEM_FLAGS_DIRTY_TRACK 0x1 << 5
 
 
 struct pmem_data {
@@ -72,6 +82,9 @@ struct pmem_data {
 	struct file *master_file;
 	/* a list of currently available regions if this is a suballocation */
 	struct list_head region_list;
+	/* range written by the cpu and not cleaned yet, if this isn't a
+	 * suballocation, see PMEM_FLAGS_DIRTY_TRACK */
+	struct pmem_region dirty;
 	/* a linked list of data so we can access them for debugging */
 	struct list_head list;
 #if PMEM_DEBUG
@@ -82,10 +95,22 @@ struct pmem_data {
 struct pmem_bits {
 	unsigned allocated:1;		/* 1 if allocated, 0 if free */
 	unsigned order:7;		/* size of the region in pmem space */
+	struct rb_node node;		/* free_tree[order] node while free */
+};
+
+struct pmem_stats {
+	unsigned long allocs;
+	unsigned long fails;
+	/* failures with enough free memory, but not in one block */
+	unsigned long frag_fails;
+	u64 alloc_ns;
+	u64 max_alloc_ns;
 };
 
 struct pmem_region_node {
 	struct pmem_region region;
+	/* part of the region written by the cpu and not cleaned yet */
+	struct pmem_region dirty;
 	struct list_head list;
 };
 
@@ -144,6 +169,16 @@ struct pmem_info {
 	 * down(pmem_data->sem) => down(bitmap_sem)
 	 */
 	struct rw_semaphore bitmap_sem;
+	/* free blocks of each order, sorted by index in a tree through their
+	 * bitmap entries, bit n of free_orders is set while free_tree[n]
+	 * isn't empty, all protected by bitmap_sem */
+	struct rb_root free_tree[PMEM_FREE_ORDERS];
+	unsigned long nr_free[PMEM_FREE_ORDERS];
+	unsigned long free_orders;
+	/* hand out the lowest free block of an order so that free space
+	 * coalesces at the top of the region */
+	u32 defrag;
+	struct pmem_stats stats;
 
 	long (*ioctl)(struct file *, unsigned int, unsigned long);
 	int (*release)(struct inode *, struct file *);
@@ -232,33 +267,77 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+static void pmem_add_free(int id, int index, int order)
+{
+	struct pmem_bits *bits = &pmem[id].bitmap[index];
+	struct rb_node **p = &pmem[id].free_tree[order].rb_node;
+	struct rb_node *parent = NULL;
+
+	PMEM_ORDER(id, index) = order;
+	bits->allocated = 0;
+
+	/* the bitmap is an array, so entry addresses sort like indexes */
+	while (*p) {
+		parent = *p;
+		if (bits < rb_entry(parent, struct pmem_bits, node))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&bits->node, parent, p);
+	rb_insert_color(&bits->node, &pmem[id].free_tree[order]);
+	pmem[id].nr_free[order]++;
+	__set_bit(order, &pmem[id].free_orders);
+}
+
+static void pmem_del_free(int id, int index)
+{
+	int order = PMEM_ORDER(id, index);
+
+	rb_erase(&pmem[id].bitmap[index].node, &pmem[id].free_tree[order]);
+	if (--pmem[id].nr_free[order] == 0)
+		__clear_bit(order, &pmem[id].free_orders);
+}
+
+static unsigned long pmem_free_pages(int id)
+{
+	unsigned long pages = 0;
+	int order;
+
+	for (order = 0; order < PMEM_FREE_ORDERS; order++)
+		pages += pmem[id].nr_free[order] << order;
+	return pages;
+}
+
 static int pmem_free(int id, int index)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	int buddy, curr = index;
+	int order;
 	DLOG("index %d\n", index);
 
 	if (pmem[id].no_allocator) {
 		pmem[id].allocated = 0;
 		return 0;
 	}
-	/* clean up the bitmap, merging any buddies */
-	pmem[id].bitmap[curr].allocated = 0;
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
 	 * if the buddy is also free merge them
-	 * repeat until the buddy is not free or end of the bitmap is reached
+	 * repeat until the buddy is not free or runs past the end of the
+	 * bitmap, which can happen for the tail of a region that isn't a
+	 * power of two pages
 	 */
-	do {
-		buddy = PMEM_BUDDY_INDEX(id, curr);
-		if (PMEM_IS_FREE(id, buddy) &&
-				PMEM_ORDER(id, buddy) == PMEM_ORDER(id, curr)) {
-			PMEM_ORDER(id, buddy)++;
-			PMEM_ORDER(id, curr)++;
-			curr = min(buddy, curr);
-		} else {
+	order = PMEM_ORDER(id, curr);
+	while (order + 1 < PMEM_FREE_ORDERS) {
+		buddy = curr ^ (1 << order);
+		if (buddy + (1 << order) > pmem[id].num_entries)
 			break;
-		}
-	} while (curr < pmem[id].num_entries);
+		if (!PMEM_IS_FREE(id, buddy) || PMEM_ORDER(id, buddy) != order)
+			break;
+		pmem_del_free(id, buddy);
+		curr = min(buddy, curr);
+		order++;
+	}
+	pmem_add_free(id, curr, order);
 
 	return 0;
 }
@@ -349,6 +428,8 @@ static int pmem_open(struct inode *inode, struct file *file)
 	data->vma = NULL;
 	data->pid = 0;
 	data->master_file = NULL;
+	data->dirty.offset = 0;
+	data->dirty.len = 0;
 #if PMEM_DEBUG
 	data->ref = 0;
 #endif
@@ -376,14 +457,41 @@ static unsigned long pmem_order(unsigned long len)
 	return i;
 }
 
+static int pmem_pick_free(int id, int order)
+{
+	struct rb_root *root = &pmem[id].free_tree[order];
+	struct rb_node *node;
+
+	/* the lowest block is the leftmost, any other is as good as the root */
+	node = pmem[id].defrag ? rb_first(root) : root->rb_node;
+	return rb_entry(node, struct pmem_bits, node) - pmem[id].bitmap;
+}
+
+static void pmem_account_alloc(int id, ktime_t start, int failed,
+			       unsigned long order)
+{
+	struct pmem_stats *stats = &pmem[id].stats;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (failed) {
+		stats->fails++;
+		if (pmem_free_pages(id) >= (1UL << order))
+			stats->frag_fails++;
+		return;
+	}
+	stats->allocs++;
+	stats->alloc_ns += ns;
+	if (ns > stats->max_alloc_ns)
+		stats->max_alloc_ns = ns;
+}
+
 static int pmem_allocate(int id, unsigned long len)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	/* return the corresponding pdata[] entry */
-	int curr = 0;
-	int end = pmem[id].num_entries;
-	int best_fit = -1;
+	int index, curr;
 	unsigned long order = pmem_order(len);
+	ktime_t start;
 
 	if (pmem[id].no_allocator) {
 		DLOG("no allocator");
@@ -393,49 +501,36 @@ static int pmem_allocate(int id, unsigned long len)
 		return len;
 	}
 
-	if (order > PMEM_MAX_ORDER)
+	start = ktime_get();
+	if (order >= PMEM_FREE_ORDERS) {
+		pmem_account_alloc(id, start, 1, 0);
 		return -1;
-	DLOG("order %lx\n", order);
-
-	/* look through the bitmap:
-	 * 	if you find a free slot of the correct order use it
-	 * 	otherwise, use the best fit (smallest with size > order) slot
-	 */
-	while (curr < end) {
-		if (PMEM_IS_FREE(id, curr)) {
-			if (PMEM_ORDER(id, curr) == (unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_ORDER(id, curr) > (unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_ORDER(id, curr) < PMEM_ORDER(id, best_fit)))
-				best_fit = curr;
-		}
-		curr = PMEM_NEXT_INDEX(id, curr);
 	}
+	DLOG("order %lx\n", order);
 
-	/* if best_fit < 0, there are no suitable slots,
-	 * return an error
-	 */
-	if (best_fit < 0) {
+	/* take a block from the smallest non empty order that fits */
+	curr = find_next_bit(&pmem[id].free_orders, PMEM_FREE_ORDERS, order);
+	if (curr >= PMEM_FREE_ORDERS) {
 		printk("pmem: no space left to allocate!\n");
+		pmem_account_alloc(id, start, 1, order);
 		return -1;
 	}
+	index = pmem_pick_free(id, curr);
+	pmem_del_free(id, index);
 
-	/* now partition the best fit:
-	 * 	split the slot into 2 buddies of order - 1
-	 * 	repeat until the slot is of the correct order
+	/* now partition it:
+	 * 	split the block into 2 buddies of order - 1, keep the low one
+	 * 	and free the high one
+	 * 	repeat until the block is of the correct order
 	 */
-	while (PMEM_ORDER(id, best_fit) > (unsigned char)order) {
-		int buddy;
-		PMEM_ORDER(id, best_fit) -= 1;
-		buddy = PMEM_BUDDY_INDEX(id, best_fit);
-		PMEM_ORDER(id, buddy) = PMEM_ORDER(id, best_fit);
+	while (curr > order) {
+		curr--;
+		pmem_add_free(id, index + (1 << curr), curr);
 	}
-	pmem[id].bitmap[best_fit].allocated = 1;
-	return best_fit;
+	PMEM_ORDER(id, index) = order;
+	pmem[id].bitmap[index].allocated = 1;
+	pmem_account_alloc(id, start, 0, order);
+	return index;
 }
 
 static pgprot_t phys_mem_access_prot(struct file *file, pgprot_t vma_prot)
@@ -779,14 +874,221 @@ void put_pmem_file(struct file *file)
 	fput(file);
 }
 
+/* grow a dirty range to also cover offset, len */
+static void pmem_dirty_add(struct pmem_region *dirty, unsigned long offset,
+			   unsigned long len)
+{
+	unsigned long end = offset + len;
+
+	if (!len)
+		return;
+	if (dirty->len) {
+		end = max(end, dirty->offset + dirty->len);
+		offset = min(offset, dirty->offset);
+	}
+	dirty->offset = offset;
+	dirty->len = end - offset;
+}
+
+/* clip offset, len to the dirty range and drop what is about to be cleaned
+ * from it, returns the length left to clean */
+static unsigned long pmem_dirty_take(struct pmem_region *dirty,
+				     unsigned long *offset, unsigned long len)
+{
+	unsigned long start = max(*offset, dirty->offset);
+	unsigned long end = min(*offset + len, dirty->offset + dirty->len);
+
+	if (!dirty->len || start >= end)
+		return 0;
+
+	if (start == dirty->offset && end == dirty->offset + dirty->len) {
+		dirty->len = 0;
+	} else if (start == dirty->offset) {
+		dirty->len -= end - dirty->offset;
+		dirty->offset = end;
+	} else if (end == dirty->offset + dirty->len) {
+		dirty->len = start - dirty->offset;
+	}
+	/* a hole in the middle stays dirty, it'll be cleaned again */
+
+	*offset = start;
+	return end - start;
+}
+
+/* find the dirty range tracking offset, len of the file, if any */
+static struct pmem_region *pmem_find_dirty(struct pmem_data *data,
+					   unsigned long offset,
+					   unsigned long len)
+{
+	struct pmem_region_node *region_node;
+
+	if (!(data->flags & PMEM_FLAGS_DIRTY_TRACK))
+		return NULL;
+	if (!(data->flags & PMEM_FLAGS_CONNECTED))
+		return &data->dirty;
+	list_for_each_entry(region_node, &data->region_list, list) {
+		if (offset >= region_node->region.offset &&
+		    offset + len <= region_node->region.offset +
+				    region_node->region.len)
+			return &region_node->dirty;
+	}
+	return NULL;
+}
+
+static void pmem_do_cache_op(int id, struct pmem_data *data,
+			     unsigned long offset, unsigned long len,
+			     unsigned int op)
+{
+	void *vaddr = pmem_start_vaddr(id, data) + offset;
+	unsigned long paddr = pmem_start_addr(id, data) + offset;
+
+	if (op == (PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE)) {
+		dmac_flush_range(vaddr, vaddr + len);
+		outer_flush_range(paddr, paddr + len);
+	} else if (op & PMEM_CACHE_CLEAN) {
+		dmac_map_area(vaddr, len, DMA_TO_DEVICE);
+		outer_clean_range(paddr, paddr + len);
+	} else if (op & PMEM_CACHE_INVALIDATE) {
+		outer_inv_range(paddr, paddr + len);
+		dmac_map_area(vaddr, len, DMA_FROM_DEVICE);
+	}
+}
+
+/* cache maintenance on offset, len of the file, with the data sem held for
+ * writing. cleans are limited to the dirty range if the file tracks it */
+static void pmem_cache_maint_locked(int id, struct pmem_data *data,
+				    unsigned long offset, unsigned long len,
+				    unsigned int op)
+{
+	struct pmem_region *dirty;
+	unsigned long clean_offset = offset, clean_len = len;
+
+	dirty = pmem_find_dirty(data, offset, len);
+	if (op & PMEM_CACHE_CLEAN) {
+		if (dirty)
+			clean_len = pmem_dirty_take(dirty, &clean_offset, len);
+		else if (data->flags & PMEM_FLAGS_DIRTY_TRACK)
+			/* a submap range outside its regions, nothing to do */
+			clean_len = 0;
+	} else {
+		clean_len = 0;
+		/* the cpu's writes are being discarded */
+		if (dirty)
+			pmem_dirty_take(dirty, &clean_offset, len);
+	}
+
+	if (!(op & PMEM_CACHE_INVALIDATE)) {
+		if (clean_len)
+			pmem_do_cache_op(id, data, clean_offset, clean_len,
+					 PMEM_CACHE_CLEAN);
+		return;
+	}
+
+	if (clean_len == len) {
+		pmem_do_cache_op(id, data, offset, len,
+				 PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
+		return;
+	}
+	/* write back dirty lines before they'd be discarded */
+	if (clean_len)
+		pmem_do_cache_op(id, data, clean_offset, clean_len,
+				 PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
+	pmem_do_cache_op(id, data, offset, len, PMEM_CACHE_INVALIDATE);
+}
+
+/* write the cpu's part of a region back before a client loses it, with the
+ * data sem held for writing */
+static void pmem_clean_region(struct file *file, struct pmem_data *data,
+			      struct pmem_region *region)
+{
+	int id = get_id(file);
+
+	if (pmem[id].cached && !(file->f_flags & O_SYNC))
+		pmem_cache_maint_locked(id, data, region->offset, region->len,
+					PMEM_CACHE_CLEAN);
+}
+
+static int pmem_cache_range_ok(int id, struct pmem_data *data,
+			       unsigned long offset, unsigned long len)
+{
+	unsigned long size = pmem_len(id, data);
+
+	return offset <= size && len <= size - offset;
+}
+
+/**
+ * pmem_cache_maint - clean and/or invalidate part of a pmem file
+ * @file:	pmem file
+ * @offset:	start of the range, relative to the allocation
+ * @len:	length of the range
+ * @op:		PMEM_CACHE_CLEAN and/or PMEM_CACHE_INVALIDATE
+ *
+ * Cleans only touch what was declared dirty if the file tracks its cpu
+ * writes, see PMEM_DIRTY.
+ */
+int pmem_cache_maint(struct file *file, unsigned long offset,
+		     unsigned long len, unsigned int op)
+{
+	struct pmem_data *data;
+	int id;
+
+	if (!is_pmem_file(file) || !has_allocation(file))
+		return -EINVAL;
+	if (op & ~(PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE))
+		return -EINVAL;
+
+	id = get_id(file);
+	data = (struct pmem_data *)file->private_data;
+	if (!pmem[id].cached || file->f_flags & O_SYNC || !len || !op)
+		return 0;
+
+	down_write(&data->sem);
+	if (!pmem_cache_range_ok(id, data, offset, len)) {
+		up_write(&data->sem);
+		return -EINVAL;
+	}
+	pmem_cache_maint_locked(id, data, offset, len, op);
+	up_write(&data->sem);
+	return 0;
+}
+
+/**
+ * pmem_mark_dirty - declare part of a pmem file as written by the cpu
+ * @file:	pmem file
+ * @offset:	start of the range, relative to the allocation
+ * @len:	length of the range
+ *
+ * From then on cleans on the file are limited to the declared ranges.
+ */
+void pmem_mark_dirty(struct file *file, unsigned long offset,
+		     unsigned long len)
+{
+	struct pmem_data *data;
+	struct pmem_region *dirty;
+	int id;
+
+	if (!is_pmem_file(file) || !has_allocation(file))
+		return;
+
+	id = get_id(file);
+	data = (struct pmem_data *)file->private_data;
+
+	down_write(&data->sem);
+	if (pmem_cache_range_ok(id, data, offset, len)) {
+		data->flags |= PMEM_FLAGS_DIRTY_TRACK;
+		dirty = pmem_find_dirty(data, offset, len);
+		if (dirty)
+			pmem_dirty_add(dirty, offset, len);
+	}
+	up_write(&data->sem);
+}
+
 void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 {
 	struct pmem_data *data;
 	int id;
-	void *vaddr;
 	struct pmem_region_node *region_node;
 	struct list_head *elt;
-	void *flush_start, *flush_end;
 
 	if (!is_pmem_file(file) || !has_allocation(file)) {
 		return;
@@ -797,11 +1099,16 @@ void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 	if (!pmem[id].cached || file->f_flags & O_SYNC)
 		return;
 
-	down_read(&data->sem);
-	vaddr = pmem_start_vaddr(id, data);
-	/* if this isn't a submmapped file, flush the whole thing */
+	down_write(&data->sem);
+	/* if this isn't a submmapped file, flush the requested range, or the
+	 * whole thing if there's none */
 	if (unlikely(!(data->flags & PMEM_FLAGS_CONNECTED))) {
-		dmac_flush_range(vaddr, vaddr + pmem_len(id, data));
+		if (!len || !pmem_cache_range_ok(id, data, offset, len)) {
+			offset = 0;
+			len = pmem_len(id, data);
+		}
+		pmem_cache_maint_locked(id, data, offset, len,
+				PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
 		goto end;
 	}
 	/* otherwise, flush the region of the file we are drawing */
@@ -810,14 +1117,15 @@ void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 		if ((offset >= region_node->region.offset) &&
 		    ((offset + len) <= (region_node->region.offset +
 			region_node->region.len))) {
-			flush_start = vaddr + region_node->region.offset;
-			flush_end = flush_start + region_node->region.len;
-			dmac_flush_range(flush_start, flush_end);
+			pmem_cache_maint_locked(id, data,
+				region_node->region.offset,
+				region_node->region.len,
+				PMEM_CACHE_CLEAN | PMEM_CACHE_INVALIDATE);
 			break;
 		}
 	}
 end:
-	up_read(&data->sem);
+	up_write(&data->sem);
 }
 
 static int pmem_connect(unsigned long connect, struct file *file)
@@ -981,6 +1289,8 @@ int pmem_remap(struct pmem_region *region, struct file *file,
 			goto err;
 		}
 		region_node->region = *region;
+		region_node->dirty.offset = 0;
+		region_node->dirty.len = 0;
 		list_add(&region_node->list, &data->region_list);
 	} else if (operation == PMEM_UNMAP) {
 		int found = 0;
@@ -990,6 +1300,8 @@ int pmem_remap(struct pmem_region *region, struct file *file,
 			if (region->len == 0 ||
 			    (region_node->region.offset == region->offset &&
 			    region_node->region.len == region->len)) {
+				pmem_clean_region(file, data,
+						  &region_node->region);
 				list_del(elt);
 				kfree(region_node);
 				found = 1;
@@ -1040,6 +1352,7 @@ static void pmem_revoke(struct file *file, struct pmem_data *data)
 		list_for_each_safe(elt, elt2, &data->region_list) {
 			region_node = list_entry(elt, struct pmem_region_node,
 						 list);
+			pmem_clean_region(file, data, &region_node->region);
 			pmem_unmap_pfn_range(id, data->vma, data,
 					     region_node->region.offset,
 					     region_node->region.len);
@@ -1139,7 +1452,9 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			if (has_allocation(file))
 				return -EINVAL;
 			data = (struct pmem_data *)file->private_data;
+			down_write(&pmem[id].bitmap_sem);
 			data->index = pmem_allocate(id, arg);
+			up_write(&pmem[id].bitmap_sem);
 			break;
 		}
 	case PMEM_CONNECT:
@@ -1156,6 +1471,26 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			flush_pmem_file(file, region.offset, region.len);
 			break;
 		}
+	case PMEM_CACHE_OP:
+		{
+			struct pmem_cache_op cache_op;
+			DLOG("cache op\n");
+			if (copy_from_user(&cache_op, (void __user *)arg,
+					   sizeof(struct pmem_cache_op)))
+				return -EFAULT;
+			return pmem_cache_maint(file, cache_op.offset,
+						cache_op.len, cache_op.op);
+		}
+	case PMEM_DIRTY:
+		{
+			struct pmem_region region;
+			DLOG("dirty\n");
+			if (copy_from_user(&region, (void __user *)arg,
+					   sizeof(struct pmem_region)))
+				return -EFAULT;
+			pmem_mark_dirty(file, region.offset, region.len);
+			break;
+		}
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
@@ -1214,6 +1549,77 @@ static struct file_operations debug_fops = {
 	.read = debug_read,
 	.open = debug_open,
 };
+
+static ssize_t debug_stats_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	int id = (int)file->private_data;
+	struct pmem_stats *stats = &pmem[id].stats;
+	const int debug_bufmax = 2048;
+	char *buffer;
+	unsigned long free, largest = 0;
+	int order, n = 0;
+	ssize_t ret;
+
+	buffer = kmalloc(debug_bufmax, GFP_KERNEL);
+	if (!buffer)
+		return -ENOMEM;
+
+	down_read(&pmem[id].bitmap_sem);
+	free = pmem_free_pages(id);
+	if (pmem[id].free_orders)
+		largest = 1UL << __fls(pmem[id].free_orders);
+
+	n += scnprintf(buffer + n, debug_bufmax - n,
+		       "size: %lu\nfree: %lu\nlargest free: %lu\n"
+		       "fragmentation: %lu%%\n",
+		       pmem[id].size, free * PMEM_MIN_ALLOC,
+		       largest * PMEM_MIN_ALLOC,
+		       free ? 100 - largest * 100 / free : 0);
+	n += scnprintf(buffer + n, debug_bufmax - n,
+		       "allocs: %lu\nfails: %lu\nfragmentation fails: %lu\n"
+		       "avg alloc ns: %llu\nmax alloc ns: %llu\n",
+		       stats->allocs, stats->fails, stats->frag_fails,
+		       stats->allocs ?
+		       div64_u64(stats->alloc_ns, stats->allocs) : 0,
+		       stats->max_alloc_ns);
+	n += scnprintf(buffer + n, debug_bufmax - n, "free blocks by order:");
+	for (order = 0; order < PMEM_FREE_ORDERS; order++)
+		if (pmem[id].nr_free[order])
+			n += scnprintf(buffer + n, debug_bufmax - n, " %d:%lu",
+				       order, pmem[id].nr_free[order]);
+	n += scnprintf(buffer + n, debug_bufmax - n, "\n");
+	up_read(&pmem[id].bitmap_sem);
+
+	ret = simple_read_from_buffer(buf, count, ppos, buffer, n);
+	kfree(buffer);
+	return ret;
+}
+
+static struct file_operations debug_stats_fops = {
+	.read = debug_stats_read,
+	.open = debug_open,
+};
+
+static struct dentry *pmem_debugfs_root;
+
+static void pmem_debugfs_init(int id, const char *name)
+{
+	struct dentry *dir;
+
+	if (!pmem_debugfs_root)
+		pmem_debugfs_root = debugfs_create_dir("pmem", NULL);
+	if (IS_ERR_OR_NULL(pmem_debugfs_root))
+		return;
+
+	dir = debugfs_create_dir(name, pmem_debugfs_root);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+	debugfs_create_file("stats", S_IFREG | S_IRUGO, dir, (void *)id,
+			    &debug_stats_fops);
+	debugfs_create_bool("defrag", S_IRUGO | S_IWUSR, dir,
+			    &pmem[id].defrag);
+}
 #endif
 
 #if 0
@@ -1262,12 +1668,16 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	memset(pmem[id].bitmap, 0, sizeof(struct pmem_bits) *
 					  pmem[id].num_entries);
 
-	for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--) {
-		if ((pmem[id].num_entries) &  1<<i) {
-			PMEM_ORDER(id, index) = i;
+	for (i = 0; i < PMEM_FREE_ORDERS; i++)
+		pmem[id].free_tree[i] = RB_ROOT;
+	for (i = PMEM_FREE_ORDERS - 1; i >= 0; i--) {
+		if ((pmem[id].num_entries) & (1UL << i)) {
+			pmem_add_free(id, index, i);
 			index = PMEM_NEXT_INDEX(id, index);
 		}
 	}
+	/* cached regions are the long lived camera/video/gralloc heaps */
+	pmem[id].defrag = pmem[id].cached;
 
 	if (pmem[id].cached)
 		pmem[id].vbase = ioremap_cached(pmem[id].base,
@@ -1290,6 +1700,8 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 #if PMEM_DEBUG
 	debugfs_create_file(pdata->name, S_IFREG | S_IRUGO, NULL, (void *)id,
 			    &debug_fops);
+	if (!pmem[id].no_allocator)
+		pmem_debugfs_init(id, pdata->name);
 #endif
 	return 0;
 error_cant_remap:
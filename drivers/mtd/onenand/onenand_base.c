@@ -926,6 +926,71 @@ static void onenand_invalidate_bufferram(struct mtd_info *mtd, loff_t addr,
 	}
 }
 
+/**
+ * onenand_readahead_start - [GENERIC] Start loading the next page
+ * @param mtd		MTD data structure
+ * @param addr		address of the page to load
+ *
+ * Sequential readers (yaffs2 scans, application loading) come back for
+ * the page that follows the one they just read, or for its spare area.
+ * Load it into the other BufferRAM while the chip is otherwise idle so
+ * the next read only has to copy it out. The controller clock, if any,
+ * stays enabled until the load has been waited for.
+ */
+static void onenand_readahead_start(struct mtd_info *mtd, loff_t addr)
+{
+	struct onenand_chip *this = mtd->priv;
+
+	if (!(this->options & ONENAND_READAHEAD) ||
+	    ONENAND_IS_4KB_PAGE(this) || ONENAND_IS_2PLANE(this))
+		return;
+
+	/*
+	 * Only plain reads release the chip right after, OTP reads and the
+	 * Flex-OneNAND boundary check issue more commands of their own
+	 */
+	if (this->state != FL_READING)
+		return;
+
+	if (addr >= mtd->size || (addr & (this->writesize - 1)))
+		return;
+
+	/* Don't cross into the second chip of a DDP behind the reader's back */
+	if (ONENAND_IS_DDP(this) && addr == (this->chipsize >> 1))
+		return;
+
+	if (onenand_check_bufferram(mtd, addr))
+		return;
+
+	this->command(mtd, ONENAND_CMD_READ, addr, this->writesize);
+	/* The BufferRAM being loaded no longer holds what it used to */
+	this->bufferram[ONENAND_CURRENT_BUFFERRAM(this)].blockpage = -1;
+	this->readahead = addr;
+}
+
+/**
+ * onenand_readahead_finish - [GENERIC] Complete a pending read ahead
+ * @param mtd		MTD data structure
+ *
+ * Wait for the load started by onenand_readahead_start(). ECC events
+ * are not accounted here: the page is just left invalid so that the
+ * reader that wants it reloads it and sees the error itself.
+ */
+static void onenand_readahead_finish(struct mtd_info *mtd)
+{
+	struct onenand_chip *this = mtd->priv;
+	struct mtd_ecc_stats stats = mtd->ecc_stats;
+	int ret, valid;
+
+	ret = this->wait(mtd, FL_READING);
+	valid = !ret && mtd->ecc_stats.failed == stats.failed &&
+		mtd->ecc_stats.corrected == stats.corrected;
+	mtd->ecc_stats = stats;
+
+	onenand_update_bufferram(mtd, this->readahead, valid);
+	this->readahead = -1;
+}
+
 /**
  * onenand_get_device - [GENERIC] Get chip for selected access
  * @param mtd		MTD device structure
@@ -958,7 +1023,12 @@ static int onenand_get_device(struct mtd_info *mtd, int new_state)
 		schedule();
 		remove_wait_queue(&this->wq, &wait);
 	}
-	if (this->clk && new_state != FL_PM_SUSPENDED)
+	if (this->readahead != -1) {
+		/* The clock was left running for the load */
+		onenand_readahead_finish(mtd);
+		if (this->clk && new_state == FL_PM_SUSPENDED)
+			clk_disable(this->clk);
+	} else if (this->clk && new_state != FL_PM_SUSPENDED)
 		clk_enable(this->clk);
 	return 0;
 }
@@ -973,7 +1043,8 @@ static void onenand_release_device(struct mtd_info *mtd)
 {
 	struct onenand_chip *this = mtd->priv;
 
-	if (this->clk && this->state != FL_PM_SUSPENDED)
+	/* Keep the clock running while a read ahead is in flight */
+	if (this->clk && this->state != FL_PM_SUSPENDED && this->readahead == -1)
 		clk_disable(this->clk);
 
 	/* Release the chip */
@@ -1286,6 +1357,9 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 			ret = 0;
  	}
 
+	if (!ret && len)
+		onenand_readahead_start(mtd, from);
+
 	/*
 	 * Return success, if no ECC failures, else -EBADMSG
 	 * fs driver will take care of that, because
@@ -1363,18 +1437,23 @@ static int onenand_read_oob_nolock(struct mtd_info *mtd, loff_t from,
 		thislen = oobsize - column;
 		thislen = min_t(int, thislen, len);
 
-		this->command(mtd, readcmd, from, mtd->oobsize);
+		/* A whole page load, e.g. a read ahead, brought the spare in too */
+		if (onenand_check_bufferram(mtd, from)) {
+			ret = 0;
+		} else {
+			this->command(mtd, readcmd, from, mtd->oobsize);
 
-		onenand_update_bufferram(mtd, from, 0);
+			onenand_update_bufferram(mtd, from, 0);
 
-		ret = this->wait(mtd, FL_READING);
-		if (unlikely(ret))
-			ret = onenand_recover_lsb(mtd, from, ret);
+			ret = this->wait(mtd, FL_READING);
+			if (unlikely(ret))
+				ret = onenand_recover_lsb(mtd, from, ret);
 
-		if (ret && ret != -EBADMSG) {
-			printk(KERN_ERR "%s: read failed = 0x%x\n",
-				__func__, ret);
-			break;
+			if (ret && ret != -EBADMSG) {
+				printk(KERN_ERR "%s: read failed = 0x%x\n",
+					__func__, ret);
+				break;
+			}
 		}
 
 		if (mode == MTD_OOB_AUTO)
@@ -1399,6 +1478,10 @@ static int onenand_read_oob_nolock(struct mtd_info *mtd, loff_t from,
 
 	ops->oobretlen = read;
 
+	if (!ret && len)
+		onenand_readahead_start(mtd,
+			(from & ~(loff_t)(mtd->writesize - 1)) + mtd->writesize);
+
 	if (ret)
 		return ret;
 
@@ -1717,6 +1800,7 @@ static int onenand_panic_write(struct mtd_info *mtd, loff_t to, size_t len,
 
 	/* Wait for any existing operation to clear */
 	onenand_panic_wait(mtd);
+	this->readahead = -1;
 
 	DEBUG(MTD_DEBUG_LEVEL3, "%s: to = 0x%08x, len = %i\n",
 		__func__, (unsigned int) to, (int) len);
@@ -3923,6 +4007,8 @@ int onenand_scan(struct mtd_info *mtd, int maxchips)
 	int i, ret;
 	struct onenand_chip *this = mtd->priv;
 
+	this->readahead = -1;
+
 	if (!this->read_word)
 		this->read_word = onenand_readw;
 	if (!this->write_word)
@@ -20,6 +20,8 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/onenand.h>
@@ -57,6 +59,8 @@ static int manuf_id	= CONFIG_ONENAND_SIM_MANUFACTURER;
 static int device_id	= CONFIG_ONENAND_SIM_DEVICE_ID;
 static int version_id	= CONFIG_ONENAND_SIM_VERSION_ID;
 static int technology_id = CONFIG_ONENAND_SIM_TECHNOLOGY_ID;
+static int readahead = 1;
+static int benchmark;
 static int boundary[] = {
 	CONFIG_FLEXONENAND_SIM_DIE0_BOUNDARY,
 	CONFIG_FLEXONENAND_SIM_DIE1_BOUNDARY,
@@ -495,6 +499,93 @@ static void flash_exit(struct onenand_flash *flash)
 	kfree(flash->base);
 }
 
+/**
+ * onenand_sim_read_pages - Read pages one at a time like a sequential reader
+ * @mtd:		MTD device structure
+ * @buf:		page sized data buffer
+ * @oob:		oob sized buffer
+ * @pages:		number of pages to read
+ *
+ * Returns the time it took in nanoseconds, or a negative error.
+ */
+static s64 __init onenand_sim_read_pages(struct mtd_info *mtd, u_char *buf,
+					  u_char *oob, int pages)
+{
+	struct onenand_chip *this = mtd->priv;
+	struct mtd_oob_ops ops = {
+		.mode	= MTD_OOB_AUTO,
+		.datbuf	= buf,
+		.oobbuf	= oob,
+	};
+	ktime_t start;
+	int i, ret;
+
+	/* Start cold */
+	for (i = 0; i < MAX_BUFFERRAM; i++)
+		this->bufferram[i].blockpage = -1;
+
+	start = ktime_get();
+	for (i = 0; i < pages; i++) {
+		ops.len = mtd->writesize;
+		ops.ooblen = mtd->oobavail;
+		ret = mtd->read_oob(mtd, (loff_t) i << this->page_shift, &ops);
+		if (ret && ret != -EUCLEAN)
+			return ret;
+	}
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/**
+ * onenand_sim_benchmark - Compare sequential page reads with and without
+ * read ahead
+ * @mtd:		MTD device structure
+ * @pages:		number of pages to read
+ */
+static void __init onenand_sim_benchmark(struct mtd_info *mtd, int pages)
+{
+	struct onenand_chip *this = mtd->priv;
+	u_char *buf, *oob;
+	s64 ns[2];
+	int pass;
+
+	pages = min_t(u64, pages, mtd->size >> this->page_shift);
+
+	buf = kmalloc(mtd->writesize, GFP_KERNEL);
+	oob = kmalloc(mtd->oobsize, GFP_KERNEL);
+	if (!buf || !oob)
+		goto out;
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pass)
+			this->options |= ONENAND_READAHEAD;
+		else
+			this->options &= ~ONENAND_READAHEAD;
+
+		ns[pass] = onenand_sim_read_pages(mtd, buf, oob, pages);
+		if (ns[pass] < 0) {
+			printk(KERN_ERR "onenand_sim: benchmark read failed "
+			       "(%lld)\n", ns[pass]);
+			goto out;
+		}
+	}
+
+	for (pass = 0; pass < 2; pass++)
+		printk(KERN_INFO "onenand_sim: %d pages, read ahead %s: "
+		       "%lld ns, %llu KiB/s\n", pages, pass ? "on" : "off",
+		       ns[pass], div64_u64((u64) pages * mtd->writesize *
+					   (NSEC_PER_SEC >> 10),
+					   max_t(s64, ns[pass], 1)));
+
+out:
+	if (readahead)
+		this->options |= ONENAND_READAHEAD;
+	else
+		this->options &= ~ONENAND_READAHEAD;
+	kfree(oob);
+	kfree(buf);
+}
+
 static int __init onenand_sim_init(void)
 {
 	/* Allocate all 0xff chars pointer */
@@ -528,6 +619,9 @@ static int __init onenand_sim_init(void)
 	info->onenand.base = info->flash.base;
 	info->onenand.priv = &info->flash;
 
+	if (readahead)
+		info->onenand.options |= ONENAND_READAHEAD;
+
 	info->mtd.name = "OneNAND simulator";
 	info->mtd.priv = &info->onenand;
 	info->mtd.owner = THIS_MODULE;
@@ -539,6 +633,9 @@ static int __init onenand_sim_init(void)
 		return -ENXIO;
 	}
 
+	if (benchmark > 0)
+		onenand_sim_benchmark(&info->mtd, benchmark);
+
 	add_mtd_partitions(&info->mtd, info->parts, ARRAY_SIZE(os_partitions));
 
 	return 0;
@@ -555,6 +652,13 @@ static void __exit onenand_sim_exit(void)
 	kfree(info);
 }
 
+module_param(readahead, int, 0);
+MODULE_PARM_DESC(readahead, "Load the next page while a sequential reader "
+		 "is busy (default 1)");
+module_param(benchmark, int, 0);
+MODULE_PARM_DESC(benchmark, "Time N sequential page reads with and without "
+		 "read ahead at load");
+
 module_init(onenand_sim_init);
 module_exit(onenand_sim_exit);
 
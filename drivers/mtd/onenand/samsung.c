@@ -22,6 +22,8 @@
 #include <linux/mtd/onenand.h>
 #include <linux/mtd/partitions.h>
 #include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
 #include <linux/clk.h>
 
 #include <asm/mach/flash.h>
@@ -163,6 +165,17 @@ struct mtd_partition s3c_partition_info[] = {
 #define S5PC110_DMA_DIR_READ		0x0
 #define S5PC110_DMA_DIR_WRITE		0x1
 
+#define S5PC110_INTC_DMA_CLR		0x1004
+#define S5PC110_INTC_DMA_MASK		0x1024
+#define S5PC110_INTC_DMA_STATUS		0x1064
+
+#define S5PC110_INTC_DMA_TD		(1 << 24)
+#define S5PC110_INTC_DMA_TE		(1 << 16)
+
+/* Below this size setting up the DMA costs more than copying */
+#define S5PC110_DMA_MIN_SIZE		512
+#define S5PC110_DMA_TIMEOUT		msecs_to_jiffies(20)
+
 struct s3c_onenand {
 	struct mtd_info	*mtd;
 	struct platform_device	*pdev;
@@ -179,6 +192,14 @@ struct s3c_onenand {
 	void __iomem	*dma_addr;
 	struct resource *dma_res;
 	unsigned long	phys_base;
+	int		dma_irq;	/* -1 if DMA is polled */
+	struct completion dma_done;
+	int		dma_status;	/* INTC_DMA_STATUS of the last DMA */
+	int		dma_hung;	/* engine never went idle, stop using it */
+	void		*bounce_buf;	/* for unaligned or partial DMA */
+	int		(*write_bufferram)(struct mtd_info *mtd, int area,
+				const unsigned char *buffer, int offset,
+				size_t count);	/* generic, non-DMA path */
 #ifdef CONFIG_MTD_PARTITIONS
 	struct mtd_partition *parts;
 #endif
@@ -628,11 +649,119 @@ static int onenand_write_bufferram(struct mtd_info *mtd, int area,
 	return 0;
 }
 
-static int s5pc110_dma_ops(void *dst, void *src, size_t count, int direction)
+static irqreturn_t s5pc110_onenand_irq(int irq, void *dev_id)
+{
+	void __iomem *base = onenand->dma_addr;
+	int status, cmd = 0;
+
+	status = readl(base + S5PC110_INTC_DMA_STATUS);
+	if (!(status & (S5PC110_INTC_DMA_TD | S5PC110_INTC_DMA_TE)))
+		return IRQ_NONE;
+
+	if (likely(status & S5PC110_INTC_DMA_TD))
+		cmd = S5PC110_DMA_TRANS_CMD_TDC;
+	if (unlikely(status & S5PC110_INTC_DMA_TE))
+		cmd = S5PC110_DMA_TRANS_CMD_TEC | S5PC110_DMA_TRANS_CMD_TDC;
+
+	writel(cmd, base + S5PC110_DMA_TRANS_CMD);
+	writel(status, base + S5PC110_INTC_DMA_CLR);
+
+	onenand->dma_status = status;
+	complete(&onenand->dma_done);
+
+	return IRQ_HANDLED;
+}
+
+static int s5pc110_dma_finish(int status)
+{
+	void __iomem *base = onenand->dma_addr;
+
+	if (status & S5PC110_DMA_TRANS_STATUS_TE) {
+		writel(S5PC110_DMA_TRANS_CMD_TEC, base + S5PC110_DMA_TRANS_CMD);
+		writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
+		return -EIO;
+	}
+
+	writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
+
+	return 0;
+}
+
+static int s5pc110_dma_poll(void)
 {
 	void __iomem *base = onenand->dma_addr;
 	int status;
 
+	do {
+		status = readl(base + S5PC110_DMA_TRANS_STATUS);
+	} while (!(status & S5PC110_DMA_TRANS_STATUS_TD));
+
+	return s5pc110_dma_finish(status);
+}
+
+/*
+ * s5pc110_dma_stop - quiesces the engine after a transfer timed out, so that
+ * it neither writes into the buffer once it is unmapped nor completes the
+ * next transfer. There is no abort command, so wait for it to go idle and
+ * stop using DMA altogether if it never does.
+ */
+static int s5pc110_dma_stop(void)
+{
+	void __iomem *base = onenand->dma_addr;
+	unsigned long timeout;
+	int status, late;
+
+	timeout = jiffies + S5PC110_DMA_TIMEOUT;
+	do {
+		status = readl(base + S5PC110_DMA_TRANS_STATUS);
+		if (!(status & S5PC110_DMA_TRANS_STATUS_TB))
+			break;
+		cpu_relax();
+	} while (time_before(jiffies, timeout));
+
+	writel(S5PC110_DMA_TRANS_CMD_TEC | S5PC110_DMA_TRANS_CMD_TDC,
+	       base + S5PC110_DMA_TRANS_CMD);
+	writel(S5PC110_INTC_DMA_TD | S5PC110_INTC_DMA_TE,
+	       base + S5PC110_INTC_DMA_CLR);
+	synchronize_irq(onenand->dma_irq);
+	late = try_wait_for_completion(&onenand->dma_done);
+	INIT_COMPLETION(onenand->dma_done);
+
+	if (status & S5PC110_DMA_TRANS_STATUS_TB) {
+		dev_err(&onenand->pdev->dev,
+			"DMA engine is stuck, disabling it\n");
+		onenand->dma_hung = 1;
+		return -ETIMEDOUT;
+	}
+
+	/* pick up a completion that raced with the timeout */
+	if (late)
+		return onenand->dma_status & S5PC110_INTC_DMA_TE ? -EIO : 0;
+	if (status & S5PC110_DMA_TRANS_STATUS_TE)
+		return -EIO;
+	if (status & S5PC110_DMA_TRANS_STATUS_TD)
+		return 0;
+
+	dev_err(&onenand->pdev->dev, "DMA timed out\n");
+	return -ETIMEDOUT;
+}
+
+static int s5pc110_dma_wait(void)
+{
+	if (!wait_for_completion_timeout(&onenand->dma_done,
+					 S5PC110_DMA_TIMEOUT))
+		return s5pc110_dma_stop();
+
+	if (onenand->dma_status & S5PC110_INTC_DMA_TE)
+		return -EIO;
+
+	return 0;
+}
+
+static int s5pc110_dma_ops(void *dst, void *src, size_t count, int direction)
+{
+	void __iomem *base = onenand->dma_addr;
+
 	writel(src, base + S5PC110_DMA_SRC_ADDR);
 	writel(dst, base + S5PC110_DMA_DST_ADDR);
 
@@ -647,34 +776,22 @@ static int s5pc110_dma_ops(void *dst, void *src, size_t count, int direction)
 	writel(count, base + S5PC110_DMA_TRANS_SIZE);
 	writel(direction, base + S5PC110_DMA_TRANS_DIR);
 
-	writel(S5PC110_DMA_TRANS_CMD_TR, base + S5PC110_DMA_TRANS_CMD);
+	if (onenand->dma_irq >= 0)
+		INIT_COMPLETION(onenand->dma_done);
 
-	do {
-		status = readl(base + S5PC110_DMA_TRANS_STATUS);
-	} while (!(status & S5PC110_DMA_TRANS_STATUS_TD));
-
-	if (status & S5PC110_DMA_TRANS_STATUS_TE) {
-		writel(S5PC110_DMA_TRANS_CMD_TEC, base + S5PC110_DMA_TRANS_CMD);
-		writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
-		return -EIO;
-	}
+	writel(S5PC110_DMA_TRANS_CMD_TR, base + S5PC110_DMA_TRANS_CMD);
 
-	writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
+	if (onenand->dma_irq >= 0)
+		return s5pc110_dma_wait();
 
-	return 0;
+	return s5pc110_dma_poll();
 }
 
-static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
-		unsigned char *buffer, int offset, size_t count)
+static void __iomem *s5pc110_get_bufferram(struct mtd_info *mtd, int area)
 {
 	struct onenand_chip *this = mtd->priv;
-	void __iomem *bufferram;
-	void __iomem *p;
-	void *buf = (void *) buffer;
-	dma_addr_t dma_src, dma_dst;
-	int err;
+	void __iomem *p = this->base + area;
 
-	p = bufferram = this->base + area;
 	if (ONENAND_CURRENT_BUFFERRAM(this)) {
 		if (area == ONENAND_DATARAM)
 			p += this->writesize;
@@ -682,51 +799,148 @@ static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
 			p += mtd->oobsize;
 	}
 
-	if (offset & 3 || (size_t) buf & 3 ||
-		!onenand->dma_addr || count != mtd->writesize)
-		goto normal;
+	return p;
+}
+
+/*
+ * s5pc110_dma_buffer - returns a kernel direct mapped address for 'buf' that
+ * the DMA can use as is, or NULL if it has to go through the bounce buffer.
+ */
+static void *s5pc110_dma_buffer(const void *buf, size_t count)
+{
+	struct page *page;
+
+	if ((size_t) buf & 3)
+		return NULL;
+
+	if (buf < high_memory)
+		return (void *) buf;
 
 	/* Handle vmalloc address */
-	if (buf >= high_memory) {
-		struct page *page;
-
-		if (((size_t) buf & PAGE_MASK) !=
-		    ((size_t) (buf + count - 1) & PAGE_MASK))
-			goto normal;
-		page = vmalloc_to_page(buf);
-		if (!page)
-			goto normal;
-		buf = page_address(page) + ((size_t) buf & ~PAGE_MASK);
+	if (((size_t) buf & PAGE_MASK) !=
+	    ((size_t) (buf + count - 1) & PAGE_MASK))
+		return NULL;
+	page = vmalloc_to_page(buf);
+	if (!page)
+		return NULL;
+	return page_address(page) + ((size_t) buf & ~PAGE_MASK);
+}
+
+/*
+ * s5pc110_dma_transfer - moves 'count' bytes between 'buf' and the BufferRAM
+ * at 'ram' with the DMA engine
+ */
+static int s5pc110_dma_transfer(void __iomem *ram, void *buf, size_t count,
+				int direction)
+{
+	struct onenand_chip *this = onenand->mtd->priv;
+	struct device *dev = &onenand->pdev->dev;
+	enum dma_data_direction dir;
+	dma_addr_t dma_ram, dma_buf;
+	int err;
+
+	dir = direction == S5PC110_DMA_DIR_READ ?
+		DMA_FROM_DEVICE : DMA_TO_DEVICE;
+
+	dma_ram = onenand->phys_base + (ram - this->base);
+	dma_buf = dma_map_single(dev, buf, count, dir);
+	if (dma_mapping_error(dev, dma_buf)) {
+		dev_err(dev, "Couldn't map a %d byte buffer for DMA\n", count);
+		return -ENOMEM;
 	}
 
-	/* DMA routine */
-	dma_src = onenand->phys_base + (p - this->base);
-	dma_dst = dma_map_single(&onenand->pdev->dev,
-			buf, count, DMA_FROM_DEVICE);
-	if (dma_mapping_error(&onenand->pdev->dev, dma_dst)) {
-		dev_err(&onenand->pdev->dev,
-			"Couldn't map a %d byte buffer for DMA\n", count);
+	if (direction == S5PC110_DMA_DIR_READ)
+		err = s5pc110_dma_ops((void *) dma_buf, (void *) dma_ram,
+				      count, direction);
+	else
+		err = s5pc110_dma_ops((void *) dma_ram, (void *) dma_buf,
+				      count, direction);
+
+	dma_unmap_single(dev, dma_buf, count, dir);
+
+	return err;
+}
+
+static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
+		unsigned char *buffer, int offset, size_t count)
+{
+	struct onenand_chip *this = mtd->priv;
+	void __iomem *bufferram;
+	void __iomem *p;
+	void *buf;
+	int start, len;
+
+	bufferram = this->base + area;
+	p = s5pc110_get_bufferram(mtd, area);
+
+	if (!onenand->dma_addr || onenand->dma_hung ||
+	    count < S5PC110_DMA_MIN_SIZE)
+		goto normal;
+
+	buf = s5pc110_dma_buffer(buffer, count);
+	if (buf && !(offset & 3) && !(count & 3)) {
+		if (!s5pc110_dma_transfer(p + offset, buf, count,
+					  S5PC110_DMA_DIR_READ))
+			return 0;
 		goto normal;
 	}
-	err = s5pc110_dma_ops((void *) dma_dst, (void *) dma_src,
-			count, S5PC110_DMA_DIR_READ);
-	dma_unmap_single(&onenand->pdev->dev, dma_dst, count, DMA_FROM_DEVICE);
 
-	if (!err)
+	if (!onenand->bounce_buf)
+		goto normal;
+
+	/*
+	 * Bounce whatever the DMA can't do directly: read the word aligned
+	 * span around the request, then copy out of cacheable memory.
+	 */
+	start = offset & ~3;
+	len = ALIGN(offset + count, 4) - start;
+	if (!s5pc110_dma_transfer(p + start, onenand->bounce_buf, len,
+				  S5PC110_DMA_DIR_READ)) {
+		memcpy(buffer, onenand->bounce_buf + (offset - start), count);
 		return 0;
+	}
 
 normal:
 	if (count != mtd->writesize) {
 		/* Copy the bufferram to memory to prevent unaligned access */
 		memcpy(this->page_buf, bufferram, mtd->writesize);
 		p = this->page_buf + offset;
-	}
+	} else
+		p += offset;
 
 	memcpy(buffer, p, count);
 
 	return 0;
 }
 
+static int s5pc110_write_bufferram(struct mtd_info *mtd, int area,
+		const unsigned char *buffer, int offset, size_t count)
+{
+	void __iomem *p;
+	void *buf;
+
+	p = s5pc110_get_bufferram(mtd, area);
+
+	/* The BufferRAM side can't be written partially within a word */
+	if (!onenand->dma_addr || onenand->dma_hung ||
+	    count < S5PC110_DMA_MIN_SIZE || offset & 3 || count & 3)
+		goto normal;
+
+	buf = s5pc110_dma_buffer(buffer, count);
+	if (!buf && onenand->bounce_buf) {
+		memcpy(onenand->bounce_buf, buffer, count);
+		buf = onenand->bounce_buf;
+	}
+
+	if (buf && !s5pc110_dma_transfer(p + offset, buf, count,
+					 S5PC110_DMA_DIR_WRITE))
+		return 0;
+
+normal:
+	/* the generic helper keeps odd lengths to word accesses */
+	return onenand->write_bufferram(mtd, area, buffer, offset, count);
+}
+
 static int s5pc110_chip_probe(struct mtd_info *mtd)
 {
 	/* Now just return 0 */
@@ -861,6 +1075,8 @@ static void s3c_onenand_setup(struct mtd_info *mtd)
 		onenand->cmd_map = s5pc1xx_cmd_map;
 		this->read_bufferram = s5pc110_read_bufferram;
 		this->chip_probe = s5pc110_chip_probe;
+		/* Loads run behind the DMA, so keep the next page coming */
+		this->options |= ONENAND_READAHEAD;
 		return;
 	} else {
 		BUG();
@@ -1014,6 +1230,21 @@ static int s3c_onenand_probe(struct platform_device *pdev)
 		}
 
 		onenand->phys_base = onenand->base_res->start;
+
+		init_completion(&onenand->dma_done);
+		onenand->dma_irq = platform_get_irq(pdev, 0);
+		if (onenand->dma_irq >= 0) {
+			/* Unmask the transfer done and error interrupts */
+			writel(readl(onenand->dma_addr + S5PC110_INTC_DMA_MASK) &
+			       ~(S5PC110_INTC_DMA_TD | S5PC110_INTC_DMA_TE),
+			       onenand->dma_addr + S5PC110_INTC_DMA_MASK);
+			if (request_irq(onenand->dma_irq, s5pc110_onenand_irq,
+					IRQF_SHARED, "onenand", onenand)) {
+				dev_info(&pdev->dev, "cannot get DMA irq, "
+					 "polling instead\n");
+				onenand->dma_irq = -1;
+			}
+		}
 	}
 
 	if (onenand_scan(mtd, 1)) {
@@ -1021,6 +1252,15 @@ static int s3c_onenand_probe(struct platform_device *pdev)
 		goto scan_failed;
 	}
 
+	if (onenand->type == TYPE_S5PC110) {
+		/* Not fatal, unaligned requests just won't use the DMA */
+		onenand->bounce_buf = kmalloc(mtd->writesize, GFP_KERNEL);
+
+		/* DMA in front of the generic helper onenand_scan() set up */
+		onenand->write_bufferram = this->write_bufferram;
+		this->write_bufferram = s5pc110_write_bufferram;
+	}
+
 	if (onenand->type != TYPE_S5PC110) {
 		/* S3C doesn't handle subpage write */
 		mtd->subpage_sft = 0;
@@ -1076,6 +1316,8 @@ static int s3c_onenand_probe(struct platform_device *pdev)
 	return 0;
 
 scan_failed:
+	if (onenand->dma_addr && onenand->dma_irq >= 0)
+		free_irq(onenand->dma_irq, onenand);
 	if (onenand->dma_addr)
 		iounmap(onenand->dma_addr);
 dma_ioremap_failed:
@@ -1115,6 +1357,9 @@ static int __devexit s3c_onenand_remove(struct platform_device *pdev)
 	struct onenand_chip *this = mtd->priv;
 
 	onenand_release(mtd);
+	if (onenand->dma_addr && onenand->dma_irq >= 0)
+		free_irq(onenand->dma_irq, onenand);
+	kfree(onenand->bounce_buf);
 	if (onenand->ahb_addr)
 		iounmap(onenand->ahb_addr);
 	if (onenand->ahb_res)
@@ -46,6 +46,7 @@
 #include <mach/regs-clock.h>
 #include <mach/regs-gpio.h>
 #include <mach/adc.h>
+#include <mach/cpu-freq-v210.h>
 #include <plat/gpio-cfg.h>
 #include <linux/android_alarm.h>
 #include "s5pc110_battery.h"
@@ -351,6 +352,8 @@ static int s3c_get_bat_temp(struct chg_data *chg)
 	}
 
 	chg->bat_info.batt_temp = temp;
+	s5pv210_cpufreq_update_temp(temp);
+
 	if (temp >= HIGH_BLOCK_TEMP) {
 		if (health != POWER_SUPPLY_HEALTH_OVERHEAT &&
 		    health != POWER_SUPPLY_HEALTH_UNSPEC_FAILURE)
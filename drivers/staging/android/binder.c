@@ -19,7 +19,9 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/math64.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -28,6 +30,7 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
@@ -36,8 +39,36 @@
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+#define CREATE_TRACE_POINTS
+#include <trace/events/binder.h>
+
+/*
+ * Locking
+ *
+ * binder_main_lock is held for reading by every ioctl and poll, and only
+ * for writing where threads, processes or the context manager come and
+ * go. Holding it for reading therefore keeps every binder_proc and
+ * binder_thread alive, and node->proc stable.
+ *
+ * proc->lock protects everything a process owns: its threads and their
+ * transaction stacks, its buffers, its node and ref trees and the refs
+ * themselves. A transaction also takes the lock of the process it talks
+ * to; two proc->locks are always taken in address order, see
+ * binder_lock_target(). Removal from a todo list only happens under the
+ * lock of the process owning the list.
+ *
+ * proc->inner_lock nests inside any proc->lock and protects the todo
+ * lists of the process and its threads, delivered_death and the counters
+ * and work of the nodes owned by the process. Dead nodes use
+ * binder_dead_nodes_lock instead. No other lock is ever taken under an
+ * inner lock, so at most one is held at a time.
+ *
+ * binder_deferred_lock only protects binder_deferred_list.
+ */
+static DECLARE_RWSEM(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -47,7 +78,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -145,23 +176,69 @@ enum binder_stat_types {
 	BINDER_STAT_COUNT
 };
 
+/*
+ * Counters are bumped from every process without a common lock, and the
+ * threads of one process share its counters, so they are all atomic.
+ */
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
+	atomic_t buffer_cache_hit;
+	atomic_t buffer_cache_miss;
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
+}
+
+/*
+ * Latency histograms, bucket i counts samples of [2^(i-1), 2^i) us and
+ * the last bucket everything above.
+ */
+#define BINDER_LATENCY_BUCKETS	20
+#define BINDER_LATENCY_CODES	32	/* per process */
+
+struct binder_latency_hist {
+	u32 bucket[BINDER_LATENCY_BUCKETS];
+	u32 count;
+	u32 max_us;
+	u64 total_us;
+};
+
+struct binder_code_latency {
+	struct list_head entry;
+	unsigned int code;
+	struct binder_latency_hist reply;
+};
+
+static void binder_latency_add(struct binder_latency_hist *hist, u32 us)
+{
+	int i = min(fls(us), BINDER_LATENCY_BUCKETS - 1);
+
+	hist->bucket[i]++;
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
+static u32 binder_latency_us(ktime_t from, ktime_t to)
+{
+	s64 us = ktime_us_delta(to, from);
+
+	if (us < 0)
+		return 0;
+	return min_t(s64, us, UINT_MAX);
 }
 
 struct binder_transaction_log_entry {
@@ -188,6 +265,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +273,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -210,6 +289,16 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Scheduling state that is carried across a transaction. prio is the
+ * kernel priority (task->normal_prio), so lower is more urgent for both
+ * the fair and the real-time classes.
+ */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -230,6 +319,7 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
+	unsigned sched_policy:2;
 	unsigned min_priority:8;
 	struct list_head async_todo;
 };
@@ -258,8 +348,11 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head cache_entry; /* entry in proc->buffer_cache */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
@@ -273,6 +366,16 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Small buffers are rounded up to one of these size classes and, when
+ * freed, kept mapped on a per-process list instead of going back to the
+ * free tree, so that the next parcel of that size neither searches the
+ * tree nor touches the page tables.
+ */
+#define BINDER_BUFFER_CACHE_MIN_SHIFT	7	/* 128 bytes */
+#define BINDER_BUFFER_CACHE_CLASSES	4	/* 128 bytes .. 1K */
+#define BINDER_BUFFER_CACHE_DEPTH	8
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -281,6 +384,8 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	spinlock_t inner_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -298,6 +403,8 @@ struct binder_proc {
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct list_head buffer_cache[BINDER_BUFFER_CACHE_CLASSES];
+	int buffer_cache_count[BINDER_BUFFER_CACHE_CLASSES];
 
 	struct page **pages;
 	size_t buffer_size;
@@ -305,12 +412,17 @@ struct binder_proc {
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency_hist wakeup_latency;
+	struct binder_latency_hist read_latency;
+	struct binder_latency_hist reply_latency;
+	struct list_head code_latency;
+	int code_latency_count;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_priority default_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -336,6 +448,7 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	ktime_t wakeup_time;
 };
 
 struct binder_transaction {
@@ -352,14 +465,73 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	send_time;
+	ktime_t	read_time;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+/*
+ * Lock @target in addition to @proc, whose lock the caller holds. Returns
+ * 0 if proc->lock had to be dropped to keep the address order, in which
+ * case whatever was looked up under it has to be looked up again.
+ */
+static int binder_lock_target(struct binder_proc *proc,
+			      struct binder_proc *target)
+{
+	if (target == proc)
+		return 1;
+	if (target > proc) {
+		mutex_lock_nested(&target->lock, SINGLE_DEPTH_NESTING);
+		return 1;
+	}
+	if (mutex_trylock(&target->lock))
+		return 1;
+	mutex_unlock(&proc->lock);
+	mutex_lock(&target->lock);
+	mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+	return 0;
+}
+
+static void binder_unlock_target(struct binder_proc *proc,
+				 struct binder_proc *target)
+{
+	if (target != proc)
+		mutex_unlock(&target->lock);
+}
+
+/* Lock two processes, either of which may be NULL, in address order */
+static void binder_lock_procs(struct binder_proc *a, struct binder_proc *b)
+{
+	if (a > b)
+		swap(a, b);
+	if (a)
+		mutex_lock(&a->lock);
+	if (b && b != a)
+		mutex_lock_nested(&b->lock, SINGLE_DEPTH_NESTING);
+}
+
+static void binder_unlock_procs(struct binder_proc *a, struct binder_proc *b)
+{
+	if (a)
+		mutex_unlock(&a->lock);
+	if (b && b != a)
+		mutex_unlock(&b->lock);
+}
+
+/*
+ * The lock protecting the counters and work of @node. Callers that may
+ * free a dead node have to remember the pointer before doing so.
+ */
+static spinlock_t *binder_node_inner_lock(struct binder_node *node)
+{
+	return node->proc ? &node->proc->inner_lock : &binder_dead_nodes_lock;
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -498,21 +670,142 @@ out_unlock:
 	return -EBADF;
 }
 
-static void binder_set_nice(long nice)
+static bool is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+/* nice for the fair classes, rt_priority for the real-time ones */
+static int to_userspace_prio(int policy, int kernel_priority)
+{
+	if (is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - kernel_priority;
+	else
+		return kernel_priority - MAX_RT_PRIO - 20;
+}
+
+static int to_kernel_prio(int policy, int user_priority)
+{
+	if (is_rt_policy(policy))
+		return MAX_USER_RT_PRIO - 1 - user_priority;
+	else
+		return MAX_RT_PRIO + 20 + user_priority;
+}
+
+static void binder_get_priority(struct task_struct *task,
+				struct binder_priority *p)
+{
+	p->sched_policy = task->policy;
+	p->prio = task->normal_prio;
+}
+
+/*
+ * Switch current to the desired policy and priority. With verify set the
+ * request is capped by RLIMIT_RTPRIO and RLIMIT_NICE the same way
+ * sched_setscheduler() and nice() would cap it; restoring a previously
+ * saved priority skips the check.
+ */
+static void binder_do_set_priority(struct binder_priority desired, bool verify)
 {
-	long min_nice;
-	if (can_nice(current, nice)) {
-		set_user_nice(current, nice);
+	struct task_struct *task = current;
+	unsigned int policy = desired.sched_policy;
+	int priority;
+
+	if (task->policy == policy && task->normal_prio == desired.prio)
 		return;
+
+	priority = to_userspace_prio(policy, desired.prio);
+
+	if (verify && is_rt_policy(policy) && !capable(CAP_SYS_NICE)) {
+		unsigned long max_rtprio = task_rlimit(task, RLIMIT_RTPRIO);
+
+		if ((unsigned long)priority > max_rtprio) {
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: rt priority %d not allowed "
+				     "use %lu instead\n", task->pid, priority,
+				     max_rtprio);
+			priority = max_rtprio;
+			/* no real-time budget at all, try the top nice level */
+			if (priority == 0) {
+				policy = SCHED_NORMAL;
+				priority = -20;
+			}
+		}
 	}
-	min_nice = 20 - current->signal->rlim[RLIMIT_NICE].rlim_cur;
-	binder_debug(BINDER_DEBUG_PRIORITY_CAP,
-		     "binder: %d: nice value %ld not allowed use "
-		     "%ld instead\n", current->pid, nice, min_nice);
-	set_user_nice(current, min_nice);
-	if (min_nice < 20)
-		return;
-	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
+
+	if (verify && !is_rt_policy(policy) && !can_nice(task, priority)) {
+		long min_nice = 20 - task_rlimit(task, RLIMIT_NICE);
+
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: nice value %d not allowed use "
+			     "%ld instead\n", task->pid, priority, min_nice);
+		if (min_nice >= 20) {
+			binder_user_error("binder: %d RLIMIT_NICE not set\n",
+					  task->pid);
+			return;
+		}
+		priority = min_nice;
+	}
+
+	if (policy != task->policy || is_rt_policy(policy)) {
+		struct sched_param params;
+
+		params.sched_priority = is_rt_policy(policy) ? priority : 0;
+		sched_setscheduler_nocheck(task, policy, &params);
+	}
+	if (!is_rt_policy(policy))
+		set_user_nice(task, priority);
+}
+
+static void binder_set_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(desired, true);
+}
+
+static void binder_restore_priority(struct binder_priority desired)
+{
+	binder_do_set_priority(desired, false);
+}
+
+/*
+ * Called by the thread that picks up t. A synchronous transaction runs
+ * with the caller's policy and priority, or with the node's minimum if
+ * that is more urgent. A one-way transaction has no caller waiting on
+ * it, so it only ever raises the thread to the node's minimum.
+ */
+static void binder_transaction_priority(struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority node_prio;
+
+	node_prio.sched_policy = node->sched_policy;
+	node_prio.prio = node->min_priority;
+
+	binder_get_priority(current, &t->saved_priority);
+
+	if (t->flags & TF_ONE_WAY) {
+		if (node_prio.prio < t->saved_priority.prio)
+			binder_set_priority(node_prio);
+	} else if (node_prio.prio < t->priority.prio) {
+		binder_set_priority(node_prio);
+	} else {
+		binder_set_priority(t->priority);
+	}
+}
+
+static void binder_init_node_priority(struct binder_node *node, __u32 flags)
+{
+	int policy = (flags & FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+		FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+	s8 priority = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+
+	if (is_rt_policy(policy))
+		priority = clamp_t(s8, priority, 1, MAX_USER_RT_PRIO - 1);
+	else
+		priority = clamp_t(s8, priority, -20, 19);
+
+	node->sched_policy = policy;
+	node->min_priority = to_kernel_prio(policy, priority);
 }
 
 static size_t binder_buffer_size(struct binder_proc *proc,
@@ -705,17 +998,56 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+static size_t binder_buffer_cache_size(int class)
+{
+	return 1 << (BINDER_BUFFER_CACHE_MIN_SHIFT + class);
+}
+
+static int binder_buffer_cache_class(size_t size)
+{
+	if (size > binder_buffer_cache_size(BINDER_BUFFER_CACHE_CLASSES - 1))
+		return -1;
+	if (size <= binder_buffer_cache_size(0))
+		return 0;
+	return fls(size - 1) - BINDER_BUFFER_CACHE_MIN_SHIFT;
+}
+
+static void binder_release_buffer_space(struct binder_proc *proc,
+					struct binder_buffer *buffer,
+					size_t buffer_size);
+
+/* Give the cached buffers back to the free tree */
+static int binder_buffer_cache_flush(struct binder_proc *proc)
+{
+	struct binder_buffer *buffer;
+	int class, count = 0;
+
+	for (class = 0; class < BINDER_BUFFER_CACHE_CLASSES; class++) {
+		while (!list_empty(&proc->buffer_cache[class])) {
+			buffer = list_first_entry(&proc->buffer_cache[class],
+					struct binder_buffer, cache_entry);
+			list_del(&buffer->cache_entry);
+			binder_release_buffer_space(proc, buffer,
+				binder_buffer_size(proc, buffer));
+			count++;
+		}
+		proc->buffer_cache_count[class] = 0;
+	}
+	return count;
+}
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
 					      size_t offsets_size, int is_async)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
+	struct rb_node *best_fit;
 	void *has_page_addr;
 	void *end_page_addr;
-	size_t size;
+	size_t size, alloc_size;
+	int class;
 
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
@@ -740,15 +1072,39 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	class = binder_buffer_cache_class(size);
+	if (class >= 0) {
+		if (!list_empty(&proc->buffer_cache[class])) {
+			buffer = list_first_entry(&proc->buffer_cache[class],
+					struct binder_buffer, cache_entry);
+			list_del(&buffer->cache_entry);
+			proc->buffer_cache_count[class]--;
+			binder_insert_allocated_buffer(proc, buffer);
+			atomic_inc(&binder_stats.buffer_cache_hit);
+			atomic_inc(&proc->stats.buffer_cache_hit);
+			binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+				     "binder: %d: binder_alloc_buf size %zd "
+				     "got cached %p\n", proc->pid, size, buffer);
+			goto out;
+		}
+		atomic_inc(&binder_stats.buffer_cache_miss);
+		atomic_inc(&proc->stats.buffer_cache_miss);
+		alloc_size = binder_buffer_cache_size(class);
+	} else
+		alloc_size = size;
+
+retry:
+	n = proc->free_buffers.rb_node;
+	best_fit = NULL;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
 		buffer_size = binder_buffer_size(proc, buffer);
 
-		if (size < buffer_size) {
+		if (alloc_size < buffer_size) {
 			best_fit = n;
 			n = n->rb_left;
-		} else if (size > buffer_size)
+		} else if (alloc_size > buffer_size)
 			n = n->rb_right;
 		else {
 			best_fit = n;
@@ -756,6 +1112,12 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		}
 	}
 	if (best_fit == NULL) {
+		if (binder_buffer_cache_flush(proc))
+			goto retry;
+		if (alloc_size != size) {
+			alloc_size = size;
+			goto retry;
+		}
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
@@ -772,10 +1134,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
 	if (n == NULL) {
-		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
-			buffer_size = size; /* no room for other buffers */
+		if (alloc_size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+			buffer_size = alloc_size; /* no room for other buffers */
 		else
-			buffer_size = size + sizeof(struct binder_buffer);
+			buffer_size = alloc_size + sizeof(struct binder_buffer);
 	}
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
@@ -788,8 +1150,9 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
-	if (buffer_size != size) {
-		struct binder_buffer *new_buffer = (void *)buffer->data + size;
+	if (buffer_size != alloc_size) {
+		struct binder_buffer *new_buffer = (void *)buffer->data +
+						   alloc_size;
 		list_add(&new_buffer->entry, &buffer->entry);
 		new_buffer->free = 1;
 		binder_insert_free_buffer(proc, new_buffer);
@@ -797,6 +1160,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
+out:
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
@@ -872,6 +1236,7 @@ static void binder_free_buf(struct binder_proc *proc,
 			    struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
+	int class;
 
 	buffer_size = binder_buffer_size(proc, buffer);
 
@@ -897,11 +1262,28 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
+	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
+
+	/* Keep small buffers mapped for the next parcel of their class */
+	class = binder_buffer_cache_class(buffer_size);
+	if (class >= 0 && binder_buffer_cache_size(class) == buffer_size &&
+	    proc->buffer_cache_count[class] < BINDER_BUFFER_CACHE_DEPTH) {
+		list_add(&buffer->cache_entry, &proc->buffer_cache[class]);
+		proc->buffer_cache_count[class]++;
+		return;
+	}
+
+	binder_release_buffer_space(proc, buffer, buffer_size);
+}
+
+static void binder_release_buffer_space(struct binder_proc *proc,
+					struct binder_buffer *buffer,
+					size_t buffer_size)
+{
 	binder_update_page_range(proc, 0,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
 		NULL);
-	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
 		struct binder_buffer *next = list_entry(buffer->entry.next,
@@ -968,11 +1350,13 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
+	/* SCHED_NORMAL at nice 0 until the flat object says otherwise */
+	binder_init_node_priority(node, 0);
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
@@ -982,8 +1366,9 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
-static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+/* Called with binder_node_inner_lock(node) held */
+static int __binder_inc_node(struct binder_node *node, int strong,
+			     int internal, struct list_head *target_list)
 {
 	if (strong) {
 		if (internal) {
@@ -1017,7 +1402,14 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 	return 0;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/*
+ * Called with binder_node_inner_lock(node) held. A node that is still
+ * owned by a process is only freed by that process, from
+ * binder_thread_read(), so that holding proc->lock is enough to keep the
+ * nodes of proc alive.
+ */
+static int __binder_dec_node(struct binder_node *node, int strong,
+			     int internal)
 {
 	if (strong) {
 		if (internal)
@@ -1040,18 +1432,19 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
 			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
+				if (list_empty(&node->work.entry)) {
+					list_add_tail(&node->work.entry,
+						      &node->proc->todo);
+					wake_up_interruptible(&node->proc->wait);
+				}
+				return 0;
 			}
+			list_del_init(&node->work.entry);
+			hlist_del(&node->dead_node);
+			binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+				     "binder: dead node %d deleted\n",
+				     node->debug_id);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1060,6 +1453,29 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	return 0;
 }
 
+static int binder_inc_node(struct binder_node *node, int strong, int internal,
+			   struct list_head *target_list)
+{
+	spinlock_t *lock = binder_node_inner_lock(node);
+	int ret;
+
+	spin_lock(lock);
+	ret = __binder_inc_node(node, strong, internal, target_list);
+	spin_unlock(lock);
+	return ret;
+}
+
+static int binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	spinlock_t *lock = binder_node_inner_lock(node);
+	int ret;
+
+	spin_lock(lock);
+	ret = __binder_dec_node(node, strong, internal);
+	spin_unlock(lock);
+	return ret;
+}
+
 
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
@@ -1103,7 +1519,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1548,11 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spinlock_t *lock = binder_node_inner_lock(node);
+
+		spin_lock(lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1147,8 +1567,11 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	return new_ref;
 }
 
+/* Called with ref->proc->lock held */
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	spinlock_t *lock = binder_node_inner_lock(ref->node);
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
@@ -1156,16 +1579,20 @@ static void binder_delete_ref(struct binder_ref *ref)
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	spin_lock(lock);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		__binder_dec_node(ref->node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	__binder_dec_node(ref->node, 0, 1);
+	spin_unlock(lock);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1245,13 +1672,22 @@ static void binder_pop_transaction(struct binder_thread *target_thread,
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
+/*
+ * Called with no proc->lock held. Each step locks the receiving side of
+ * the transaction, which owns its buffer, and the sending side, whose
+ * transaction stack it is popped from.
+ */
 static void binder_send_failed_reply(struct binder_transaction *t,
 				     uint32_t error_code)
 {
 	struct binder_thread *target_thread;
+	struct binder_proc *to_proc, *from_proc;
 	BUG_ON(t->flags & TF_ONE_WAY);
 	while (1) {
 		target_thread = t->from;
+		to_proc = t->to_proc;
+		from_proc = target_thread ? target_thread->proc : NULL;
+		binder_lock_procs(to_proc, from_proc);
 		if (target_thread) {
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
@@ -1276,6 +1712,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					target_thread->pid,
 					target_thread->return_error);
 			}
+			binder_unlock_procs(to_proc, from_proc);
 			return;
 		} else {
 			struct binder_transaction *next = t->from_parent;
@@ -1286,6 +1723,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 				     t->debug_id);
 
 			binder_pop_transaction(target_thread, t);
+			binder_unlock_procs(to_proc, from_proc);
 			if (next == NULL) {
 				binder_debug(BINDER_DEBUG_DEAD_BINDER,
 					     "binder: reply failed,"
@@ -1375,6 +1813,43 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static struct binder_code_latency *binder_get_code_latency(
+	struct binder_proc *proc, unsigned int code)
+{
+	struct binder_code_latency *cl;
+
+	list_for_each_entry(cl, &proc->code_latency, entry) {
+		if (cl->code == code)
+			return cl;
+	}
+	if (proc->code_latency_count >= BINDER_LATENCY_CODES)
+		return NULL;
+	cl = kzalloc(sizeof(*cl), GFP_KERNEL);
+	if (cl == NULL)
+		return NULL;
+	cl->code = code;
+	list_add_tail(&cl->entry, &proc->code_latency);
+	proc->code_latency_count++;
+	return cl;
+}
+
+/* Called with proc->lock held by the thread replying to t */
+static void binder_record_reply(struct binder_proc *proc,
+				struct binder_transaction *t)
+{
+	struct binder_code_latency *cl;
+	ktime_t now = ktime_get();
+	u32 service_us = binder_latency_us(t->read_time, now);
+	u32 reply_us = binder_latency_us(t->send_time, now);
+
+	binder_latency_add(&proc->reply_latency, reply_us);
+	cl = binder_get_code_latency(proc, t->code);
+	if (cl)
+		binder_latency_add(&cl->reply, reply_us);
+	trace_binder_transaction_replied(t->debug_id, t->code,
+					 service_us, reply_us);
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1388,6 +1863,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct list_head *target_list;
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
+	struct binder_proc *locked_proc = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
 
@@ -1408,7 +1884,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1428,6 +1904,14 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		target_proc = target_thread->proc;
+		/*
+		 * Only this thread can pop in_reply_to and only the release
+		 * of the caller can clear in_reply_to->from, so nothing seen
+		 * so far goes stale if proc->lock has to be dropped here.
+		 */
+		binder_lock_target(proc, target_proc);
+		locked_proc = target_proc;
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1441,8 +1925,8 @@ static void binder_transaction(struct binder_proc *proc,
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
-		target_proc = target_thread->proc;
 	} else {
+retry:
 		if (tr->target.handle) {
 			struct binder_ref *ref;
 			ref = binder_get_ref(proc, tr->target.handle);
@@ -1467,6 +1951,13 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		if (target_proc != locked_proc) {
+			if (locked_proc)
+				binder_unlock_target(proc, locked_proc);
+			locked_proc = target_proc;
+			if (!binder_lock_target(proc, target_proc))
+				goto retry;
+		}
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
@@ -1513,7 +2004,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1542,7 +2033,11 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	binder_get_priority(current, &t->priority);
+	/* a SCHED_IDLE caller must not push the callee into the idle class */
+	if (t->priority.sched_policy == SCHED_IDLE)
+		t->priority.sched_policy = SCHED_NORMAL;
+	t->send_time = ktime_get();
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
@@ -1601,7 +2096,7 @@ static void binder_transaction(struct binder_proc *proc,
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				binder_init_node_priority(node, fp->flags);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1716,6 +2211,13 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	trace_binder_transaction(t->debug_id, reply, proc->pid, thread->pid,
+				 target_proc->pid,
+				 target_thread ? target_thread->pid : 0,
+				 t->code, t->flags);
+	if (reply)
+		binder_record_reply(proc, in_reply_to);
+	spin_lock(&target_proc->inner_lock);
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		binder_pop_transaction(target_thread, in_reply_to);
@@ -1735,10 +2237,14 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
+	spin_unlock(&target_proc->inner_lock);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	spin_lock(&proc->inner_lock);
 	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&proc->inner_lock);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_unlock_target(proc, target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1776,10 +2282,15 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	if (locked_proc)
+		binder_unlock_target(proc, locked_proc);
+
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
+		mutex_unlock(&proc->lock);
 		binder_send_failed_reply(in_reply_to, return_error);
+		mutex_lock(&proc->lock);
 	} else
 		thread->return_error = return_error;
 }
@@ -1796,9 +2307,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1890,8 +2401,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					cookie, node->cookie);
 				break;
 			}
+			spin_lock(&proc->inner_lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					spin_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
@@ -1902,6 +2415,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					spin_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
@@ -1911,7 +2425,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			__binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			spin_unlock(&proc->inner_lock);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
@@ -1958,11 +2473,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
+				spin_lock(&proc->inner_lock);
 				BUG_ON(!buffer->target_node->has_async_transaction);
 				if (list_empty(&buffer->target_node->async_todo))
 					buffer->target_node->has_async_transaction = 0;
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+				spin_unlock(&proc->inner_lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -2080,12 +2597,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->inner_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->inner_lock);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2108,6 +2627,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2120,6 +2640,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
 		} break;
 		case BC_DEAD_BINDER_DONE: {
@@ -2147,6 +2668,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				break;
 			}
 
+			spin_lock(&proc->inner_lock);
 			list_del_init(&death->work.entry);
 			if (death->work.type == BINDER_WORK_DEAD_BINDER_AND_CLEAR) {
 				death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
@@ -2157,6 +2679,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2173,9 +2696,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2202,6 +2725,8 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	int slept;
+	ktime_t wakeup_time;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2230,10 +2755,13 @@ retry:
 	}
 
 
+	slept = 1;
+	wakeup_time = ktime_set(0, 0);
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2244,20 +2772,27 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
-		if (non_block) {
-			if (!binder_has_proc_work(proc, thread))
-				ret = -EAGAIN;
-		} else
+		binder_restore_priority(proc->default_priority);
+		if (binder_has_proc_work(proc, thread))
+			slept = 0;
+		else if (non_block)
+			ret = -EAGAIN;
+		else
 			ret = wait_event_interruptible_exclusive(proc->wait, binder_has_proc_work(proc, thread));
 	} else {
-		if (non_block) {
-			if (!binder_has_thread_work(thread))
-				ret = -EAGAIN;
-		} else
+		if (binder_has_thread_work(thread))
+			slept = 0;
+		else if (non_block)
+			ret = -EAGAIN;
+		else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	/* only a thread that slept has a wakeup to measure */
+	if (slept && !ret)
+		wakeup_time = ktime_get();
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
+	thread->wakeup_time = wakeup_time;
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2271,11 +2806,19 @@ retry:
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
 
+		/*
+		 * Others only ever append to our lists, so w stays at the
+		 * head once proc->inner_lock is dropped.
+		 */
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
-		else {
+		else
+			w = NULL;
+		spin_unlock(&proc->inner_lock);
+		if (w == NULL) {
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
@@ -2299,7 +2842,9 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
+			spin_lock(&proc->inner_lock);
 			list_del(&w->entry);
+			spin_unlock(&proc->inner_lock);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2307,8 +2852,14 @@ retry:
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int strong, weak;
+			void __user *node_ptr = node->ptr;
+			void __user *node_cookie = node->cookie;
+			int node_debug_id = node->debug_id;
+
+			spin_lock(&proc->inner_lock);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2330,36 +2881,42 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				list_del_init(&w->entry);
+				if (!weak && !strong) {
+					rb_erase(&node->rb_node, &proc->nodes);
+					kfree(node);
+				}
+			}
+			spin_unlock(&proc->inner_lock);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(uint32_t);
-				if (put_user(node->ptr, (void * __user *)ptr))
+				if (put_user(node_ptr, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
-				if (put_user(node->cookie, (void * __user *)ptr))
+				if (put_user(node_cookie, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
 				binder_debug(BINDER_DEBUG_USER_REFS,
 					     "binder: %d:%d %s %d u%p c%p\n",
-					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
+					     proc->pid, thread->pid, cmd_name, node_debug_id, node_ptr, node_cookie);
 			} else {
-				list_del_init(&w->entry);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
-						     proc->pid, thread->pid, node->debug_id,
-						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
+						     proc->pid, thread->pid, node_debug_id,
+						     node_ptr, node_cookie);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
-						     proc->pid, thread->pid, node->debug_id, node->ptr,
-						     node->cookie);
+						     proc->pid, thread->pid, node_debug_id, node_ptr,
+						     node_cookie);
 				}
 			}
 		} break;
@@ -2389,11 +2946,16 @@ retry:
 				      death->cookie);
 
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
+				spin_lock(&proc->inner_lock);
 				list_del(&w->entry);
+				spin_unlock(&proc->inner_lock);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
+				spin_lock(&proc->inner_lock);
 				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2407,13 +2969,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2448,6 +3004,23 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		if (cmd == BR_TRANSACTION) {
+			u32 wakeup_us = 0, read_us;
+
+			t->read_time = ktime_get();
+			read_us = binder_latency_us(t->send_time, t->read_time);
+			/* Only count wakeups of threads that slept on it */
+			if (ktime_to_ns(thread->wakeup_time) >
+			    ktime_to_ns(t->send_time)) {
+				wakeup_us = binder_latency_us(t->send_time,
+							thread->wakeup_time);
+				binder_latency_add(&proc->wakeup_latency,
+						   wakeup_us);
+			}
+			binder_latency_add(&proc->read_latency, read_us);
+			trace_binder_transaction_received(t->debug_id,
+							  wakeup_us, read_us);
+		}
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2459,7 +3032,9 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
+		spin_lock(&proc->inner_lock);
 		list_del(&t->work.entry);
+		spin_unlock(&proc->inner_lock);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
@@ -2599,12 +3174,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_main_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2629,6 +3206,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	int exclusive;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2636,7 +3214,17 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	/*
+	 * Thread exit and the context manager change state that other
+	 * processes look at without holding our proc->lock.
+	 */
+	exclusive = cmd == BINDER_THREAD_EXIT || cmd == BINDER_SET_CONTEXT_MGR;
+	if (exclusive)
+		down_write(&binder_main_lock);
+	else {
+		down_read(&binder_main_lock);
+		mutex_lock(&proc->lock);
+	}
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2745,7 +3333,12 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	if (exclusive)
+		up_write(&binder_main_lock);
+	else {
+		mutex_unlock(&proc->lock);
+		up_read(&binder_main_lock);
+	}
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2874,6 +3467,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2885,14 +3479,19 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_get_priority(current, &proc->default_priority);
+	mutex_init(&proc->lock);
+	spin_lock_init(&proc->inner_lock);
+	for (i = 0; i < BINDER_BUFFER_CACHE_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->buffer_cache[i]);
+	INIT_LIST_HEAD(&proc->code_latency);
+	down_write(&binder_main_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	up_write(&binder_main_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2945,6 +3544,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
 	struct binder_transaction *t;
+	struct binder_code_latency *cl, *cl_next;
 	struct rb_node *n;
 	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
 
@@ -3053,6 +3653,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 		vfree(proc->buffer);
 	}
 
+	list_for_each_entry_safe(cl, cl_next, &proc->code_latency, entry)
+		kfree(cl);
+
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -3072,7 +3675,6 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3087,19 +3689,27 @@ static void binder_deferred_func(struct work_struct *work)
 		mutex_unlock(&binder_deferred_lock);
 
 		files = NULL;
-		if (defer & BINDER_DEFERRED_PUT_FILES) {
-			files = proc->files;
-			if (files)
-				proc->files = NULL;
-		}
+		if (defer & (BINDER_DEFERRED_PUT_FILES | BINDER_DEFERRED_FLUSH)) {
+			down_read(&binder_main_lock);
+			mutex_lock(&proc->lock);
+			if (defer & BINDER_DEFERRED_PUT_FILES) {
+				files = proc->files;
+				if (files)
+					proc->files = NULL;
+			}
 
-		if (defer & BINDER_DEFERRED_FLUSH)
-			binder_deferred_flush(proc);
+			if (defer & BINDER_DEFERRED_FLUSH)
+				binder_deferred_flush(proc);
+			mutex_unlock(&proc->lock);
+			up_read(&binder_main_lock);
+		}
 
-		if (defer & BINDER_DEFERRED_RELEASE)
+		if (defer & BINDER_DEFERRED_RELEASE) {
+			down_write(&binder_main_lock);
 			binder_deferred_release(proc); /* frees proc */
+			up_write(&binder_main_lock);
+		}
 
-		mutex_unlock(&binder_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3123,13 +3733,15 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %d:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   to_userspace_prio(t->priority.sched_policy, t->priority.prio),
+		   t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3347,22 +3959,27 @@ static const char *binder_objstat_strings[] = {
 static void print_binder_stats(struct seq_file *m, const char *prefix,
 			       struct binder_stats *stats)
 {
+	int created, deleted, hit, miss;
 	int i;
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int count = atomic_read(&stats->bc[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int count = atomic_read(&stats->br[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3370,12 +3987,19 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		created = atomic_read(&stats->obj_created[i]);
+		deleted = atomic_read(&stats->obj_deleted[i]);
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
+
+	hit = atomic_read(&stats->buffer_cache_hit);
+	miss = atomic_read(&stats->buffer_cache_miss);
+	if (hit || miss)
+		seq_printf(m, "%sbuffer cache: hit %d miss %d\n", prefix,
+			   hit, miss);
 }
 
 static void print_binder_proc_stats(struct seq_file *m,
@@ -3383,7 +4007,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 {
 	struct binder_work *w;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, i;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3416,6 +4040,11 @@ static void print_binder_proc_stats(struct seq_file *m,
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
 
+	count = 0;
+	for (i = 0; i < BINDER_BUFFER_CACHE_CLASSES; i++)
+		count += proc->buffer_cache_count[i];
+	seq_printf(m, "  cached buffers: %d\n", count);
+
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
@@ -3440,7 +4069,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3452,7 +4081,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3463,7 +4092,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3472,7 +4101,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3483,13 +4112,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3499,11 +4128,67 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
+	return 0;
+}
+
+static void print_binder_latency_hist(struct seq_file *m, const char *prefix,
+				      const char *name,
+				      struct binder_latency_hist *hist)
+{
+	int i;
+
+	if (!hist->count)
+		return;
+	seq_printf(m, "%s%s: count %u avg %lluus max %uus\n", prefix, name,
+		   hist->count, div_u64(hist->total_us, hist->count),
+		   hist->max_us);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (!hist->bucket[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "%s  >= %uus: %u\n", prefix,
+				   1 << (i - 1), hist->bucket[i]);
+		else
+			seq_printf(m, "%s  %u-%uus: %u\n", prefix,
+				   i ? 1 << (i - 1) : 0, 1 << i,
+				   hist->bucket[i]);
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct binder_code_latency *cl;
+	struct hlist_node *pos;
+	char name[24];
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		down_write(&binder_main_lock);
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (!proc->read_latency.count)
+			continue;
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency_hist(m, "  ", "wakeup",
+					  &proc->wakeup_latency);
+		print_binder_latency_hist(m, "  ", "read",
+					  &proc->read_latency);
+		print_binder_latency_hist(m, "  ", "reply",
+					  &proc->reply_latency);
+		list_for_each_entry(cl, &proc->code_latency, entry) {
+			snprintf(name, sizeof(name), "code %x reply", cl->code);
+			print_binder_latency_hist(m, "  ", name, &cl->reply);
+		}
+	}
+	if (do_lock)
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3551,6 +4236,7 @@ static struct miscdevice binder_miscdev = {
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
+BINDER_DEBUG_ENTRY(latency);
 BINDER_DEBUG_ENTRY(transaction_log);
 
 static int __init binder_init(void)
@@ -3582,6 +4268,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    NULL,
 				    &binder_transactions_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 		debugfs_create_file("transaction_log",
 				    S_IRUGO,
 				    binder_debugfs_dir_entry_root,
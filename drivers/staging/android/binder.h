@@ -34,9 +34,16 @@ enum {
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
 };
 
+/*
+ * The low byte is the minimum priority a node is served with: a nice
+ * value for SCHED_NORMAL/SCHED_BATCH, an rt_priority for SCHED_FIFO and
+ * SCHED_RR, selected by the policy bits.
+ */
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 3U << FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT,
 };
 
 /*
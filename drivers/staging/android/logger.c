@@ -20,48 +20,127 @@
 #include <linux/sched.h>
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/device.h>
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/mm.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_chunk - a sealed, LZO compressed run of whole entries
+ *
+ * Chunks are immutable once on the archive list. Entries keep the
+ * positions they had in the ring, so readers move through the archive
+ * and into the ring without noticing.
+ */
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_log's archive */
+	size_t			start;	/* position of the first entry */
+	size_t			end;	/* position after the last entry */
+	size_t			clen;	/* compressed length of data */
+	unsigned char		data[0];
+};
+
+struct logger_stats {
+	u64			raw_bytes;	/* entry bytes sealed */
+	u64			compressed_bytes; /* what they compressed to */
+	u64			lost_bytes;	/* overwritten before sealing */
+	u64			compress_ns;
+	u64			decompress_ns;
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * The offsets below are free running positions; logger_offset() turns them
+ * into an index into the buffer. Writers pull the payload in from user space
+ * first, then reserve space and write the entry header under the spinlock
+ * 'lock', copy the payload without holding it and mark the entry committed.
+ * Preemption stays off from reserve to commit, so an entry is only ever
+ * busy while its writer is running. w_off only moves over committed
+ * entries, so everything in [head, w_off) is complete. Readers never take
+ * 'lock': they copy what they want and then check whether 'head' passed
+ * them in the meantime, in which case the copy is thrown away.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	spinlock_t		lock;	/* protects reservations and head */
+	size_t			w_reserve; /* next reservation starts here */
+	size_t			w_off;	/* end of the committed entries */
+	size_t			head;	/* oldest entry, new readers start here */
 	size_t			size;	/* size of the log */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct work_struct	seal_work; /* compresses full chunks */
+	struct mutex		archive_mutex; /* protects everything below */
+	struct list_head	archive; /* sealed chunks, oldest first */
+	size_t			archive_start; /* first archived position */
+	size_t			archive_size; /* compressed bytes held */
+	size_t			sealed;	/* sealing continues from here */
+	unsigned char		*seal_buf; /* NULL if compression is off */
+	unsigned char		*seal_out;
+	void			*seal_wrk;
+	struct logger_stats	stats;
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by its mutex, which only
+ * serializes readers sharing the same file.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
+	struct mutex		mutex;	/* protects r_off and batch */
 	size_t			r_off;	/* current read head offset */
+	int			batch;	/* return many entries per read */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	unsigned char		*chunk_buf; /* last chunk decompressed */
+	size_t			chunk_start;
+	size_t			chunk_end;
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - is position 'a' older than position 'b'? */
+#define logger_before(a, b)	((long)((a) - (b)) < 0)
+
+/*
+ * Values of logger_entry.__pad while an entry sits in the ring. Readers
+ * only ever see committed entries, where it is zero as before.
+ */
+#define LOGGER_ENTRY_COMMITTED	0
+#define LOGGER_ENTRY_BUSY	1	/* payload is still being copied */
+
+/* payloads up to this size are gathered on the stack, larger ones in kmalloc */
+#define LOGGER_STACK_PAYLOAD	256
+
+/*
+ * Entries are sealed LOGGER_CHUNK_SIZE bytes at a time, at most. This is a
+ * quarter of the smallest log, so the sealing work has the rest of the
+ * ring as slack before a writer reclaims what it has not sealed yet.
+ */
+#define LOGGER_CHUNK_SIZE	(16*1024)
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -86,13 +165,12 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
- *
- * Caller needs to hold log->mutex.
+ * get_u16 / set_u16 - access a 16-bit header field at position 'pos',
+ * which may straddle the end of the buffer.
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static __u16 get_u16(struct logger_log *log, size_t pos)
 {
+	size_t off = logger_offset(pos);
 	__u16 val;
 
 	switch (log->size - off) {
@@ -104,29 +182,117 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 		memcpy(&val, log->buffer + off, 2);
 	}
 
-	return sizeof(struct logger_entry) + val;
+	return val;
+}
+
+static void set_u16(struct logger_log *log, size_t pos, __u16 val)
+{
+	size_t off = logger_offset(pos);
+
+	switch (log->size - off) {
+	case 1:
+		memcpy(log->buffer + off, &val, 1);
+		memcpy(log->buffer, ((char *) &val) + 1, 1);
+		break;
+	default:
+		memcpy(log->buffer + off, &val, 2);
+	}
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
- *
- * Caller must hold log->mutex.
+ * get_entry_len - Grabs the length of the entry starting at 'pos'.
+ */
+static __u32 get_entry_len(struct logger_log *log, size_t pos)
+{
+	return sizeof(struct logger_entry) +
+		get_u16(log, pos + offsetof(struct logger_entry, len));
+}
+
+static __u16 get_entry_state(struct logger_log *log, size_t pos)
+{
+	return get_u16(log, pos + offsetof(struct logger_entry, __pad));
+}
+
+static void set_entry_state(struct logger_log *log, size_t pos, __u16 state)
+{
+	set_u16(log, pos + offsetof(struct logger_entry, __pad), state);
+}
+
+/*
+ * ring_start - where 'reader' continues from in the ring. A reader that was
+ * lapped by the writers silently skips ahead to the oldest entry.
+ */
+static size_t ring_start(struct logger_log *log, struct logger_reader *reader)
+{
+	size_t head = ACCESS_ONCE(log->head);
+
+	if (logger_before(reader->r_off, head))
+		return head;
+	return reader->r_off;
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+static inline int logger_compressed(struct logger_log *log)
+{
+	return log->seal_buf != NULL;
+}
+
+/*
+ * log_oldest - the oldest position that can still be read, either from the
+ * archive or from the ring
+ */
+static size_t log_oldest(struct logger_log *log)
+{
+	size_t head = ACCESS_ONCE(log->head);
+	size_t start = ACCESS_ONCE(log->archive_start);
+
+	if (ACCESS_ONCE(log->archive_size) && logger_before(start, head))
+		return start;
+	return head;
+}
+#else
+static inline int logger_compressed(struct logger_log *log)
+{
+	return 0;
+}
+
+static inline size_t log_oldest(struct logger_log *log)
+{
+	return ACCESS_ONCE(log->head);
+}
+#endif
+
+/*
+ * reader_start - where 'reader' continues from, which is in the archive if
+ * the ring has moved past it but a sealed copy is still around
+ */
+static size_t reader_start(struct logger_log *log,
+			   struct logger_reader *reader)
+{
+	size_t oldest = log_oldest(log);
+
+	if (logger_before(reader->r_off, oldest))
+		return oldest;
+	return reader->r_off;
+}
+
+/*
+ * do_read_log_to_user - copies the 'count' bytes at position 'pos' of 'log'
+ * into the user-space buffer 'buf'. Returns 'count' on success.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t pos,
+				   char __user *buf, size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
+	 * the read offset up to 'count' bytes or to the end of the log,
+	 * whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +303,378 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * do_copy_log - copies the 'count' bytes at position 'pos' of 'log' to 'buf'
+ */
+static void do_copy_log(struct logger_log *log, size_t pos,
+			unsigned char *buf, size_t count)
+{
+	size_t off = logger_offset(pos);
+	size_t len;
+
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+static void logger_free_archive(struct logger_log *log)
+{
+	struct logger_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &log->archive, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	log->archive_size = 0;
+}
+
+/*
+ * logger_archive - appends a compressed chunk and drops the oldest ones
+ * once the archive holds more than a ring's worth of compressed data.
+ *
+ * Caller must hold log->archive_mutex.
+ */
+static void logger_archive(struct logger_log *log, struct logger_chunk *chunk)
+{
+	struct logger_chunk *oldest;
+
+	if (!log->archive_size)
+		log->archive_start = chunk->start;
+	list_add_tail(&chunk->list, &log->archive);
+	log->archive_size += chunk->clen;
+
+	while (log->archive_size > log->size) {
+		oldest = list_first_entry(&log->archive, struct logger_chunk,
+					  list);
+		list_del(&oldest->list);
+		log->archive_size -= oldest->clen;
+		kfree(oldest);
+		oldest = list_first_entry(&log->archive, struct logger_chunk,
+					  list);
+		log->archive_start = oldest->start;
+	}
+}
+
+/*
+ * logger_seal_work - compresses committed entries into chunks, running well
+ * ahead of the writers so that the entries are still in the ring when they
+ * are copied out. Whatever a writer reclaims first is counted as lost.
+ */
+static void logger_seal_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log,
+					      seal_work);
+	struct logger_chunk *chunk;
+	size_t start, end, head, w_off, clen;
+	ktime_t t;
+	int ret;
+
+	mutex_lock(&log->archive_mutex);
+
+	while (1) {
+		start = log->sealed;
+		head = ACCESS_ONCE(log->head);
+		if (logger_before(start, head)) {
+			log->stats.lost_bytes += head - start;
+			start = log->sealed = head;
+		}
+		w_off = ACCESS_ONCE(log->w_off);
+		/* pairs with the smp_wmb() in logger_commit() */
+		smp_rmb();
+		if (w_off - start < LOGGER_CHUNK_SIZE)
+			break;
+
+		end = start;
+		while (end != w_off) {
+			size_t len = get_entry_len(log, end);
+
+			if (end + len - start > LOGGER_CHUNK_SIZE ||
+			    logger_before(w_off, end + len))
+				break;
+			end += len;
+		}
+		do_copy_log(log, start, log->seal_buf, end - start);
+
+		/* pairs with the smp_wmb() in logger_reserve() */
+		smp_rmb();
+		if (logger_before(start, ACCESS_ONCE(log->head)))
+			continue;
+
+		t = ktime_get();
+		ret = lzo1x_1_compress(log->seal_buf, end - start,
+				       log->seal_out, &clen, log->seal_wrk);
+		log->stats.compress_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+
+		chunk = NULL;
+		if (ret == LZO_E_OK)
+			chunk = kmalloc(sizeof(*chunk) + clen, GFP_KERNEL);
+		if (!chunk) {
+			log->stats.lost_bytes += end - start;
+			log->sealed = end;
+			continue;
+		}
+
+		chunk->start = start;
+		chunk->end = end;
+		chunk->clen = clen;
+		memcpy(chunk->data, log->seal_out, clen);
+		logger_archive(log, chunk);
+
+		log->stats.raw_bytes += end - start;
+		log->stats.compressed_bytes += clen;
+		log->sealed = end;
+	}
+
+	mutex_unlock(&log->archive_mutex);
+}
+
+/*
+ * logger_load_chunk - decompresses the chunk holding the reader's position
+ * into reader->chunk_buf. If the position is no longer archived the reader
+ * is moved to the next thing there is to read instead.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_load_chunk(struct logger_log *log,
+			     struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+	size_t len;
+	ktime_t t;
+	int ret = 0;
+
+	if (!reader->chunk_buf) {
+		reader->chunk_buf = vmalloc(LOGGER_CHUNK_SIZE);
+		if (!reader->chunk_buf)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&log->archive_mutex);
+
+	list_for_each_entry(chunk, &log->archive, list)
+		if (logger_before(reader->r_off, chunk->end))
+			break;
+
+	if (&chunk->list == &log->archive) {
+		reader->r_off = ACCESS_ONCE(log->head);
+		goto out;
+	}
+
+	if (logger_before(reader->r_off, chunk->start))
+		reader->r_off = chunk->start;
+
+	t = ktime_get();
+	len = LOGGER_CHUNK_SIZE;
+	ret = lzo1x_decompress_safe(chunk->data, chunk->clen,
+				    reader->chunk_buf, &len);
+	log->stats.decompress_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+
+	if (ret != LZO_E_OK || len != chunk->end - chunk->start) {
+		printk(KERN_ERR "logger: bad chunk in log '%s', skipping\n",
+		       log->misc.name);
+		reader->chunk_start = reader->chunk_end = 0;
+		reader->r_off = chunk->end;
+		ret = 0;
+		goto out;
+	}
+
+	reader->chunk_start = chunk->start;
+	reader->chunk_end = chunk->end;
+
+out:
+	mutex_unlock(&log->archive_mutex);
+
+	return ret;
+}
+
+static inline int reader_has_chunk(struct logger_reader *reader)
+{
+	return reader->chunk_start != reader->chunk_end &&
+		!logger_before(reader->r_off, reader->chunk_start) &&
+		logger_before(reader->r_off, reader->chunk_end);
+}
+
+/*
+ * do_read_archive - like do_read_entries(), for a reader that is behind the
+ * ring. Returns zero if the reader was only moved along, in which case the
+ * caller should just look again.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t do_read_archive(struct logger_log *log,
+			       struct logger_reader *reader,
+			       char __user *buf, size_t count)
+{
+	struct logger_entry entry;
+	size_t pos, copied = 0;
+	int ret;
+
+	if (!reader_has_chunk(reader)) {
+		ret = logger_load_chunk(log, reader);
+		if (ret)
+			return ret;
+		if (!reader_has_chunk(reader))
+			return 0;
+	}
+
+	pos = reader->r_off;
+	while (pos != reader->chunk_end) {
+		unsigned char *p = reader->chunk_buf + (pos - reader->chunk_start);
+		size_t len;
+
+		memcpy(&entry, p, sizeof(entry));
+		len = sizeof(entry) + entry.len;
+
+		if (copied + len > count)
+			break;
+
+		if (copy_to_user(buf + copied, p, len))
+			return -EFAULT;
+
+		copied += len;
+		pos += len;
+
+		if (!reader->batch)
+			break;
+	}
+
+	if (!copied && pos != reader->chunk_end)
+		return -EINVAL;
+
+	reader->r_off = pos;
+
+	return copied;
+}
+
+/*
+ * archive_entry_len - length of the archived entry at the reader's position,
+ * or zero if it has to look elsewhere.
+ *
+ * Caller must hold reader->mutex.
+ */
+static long archive_entry_len(struct logger_log *log,
+			      struct logger_reader *reader)
+{
+	struct logger_entry entry;
+	int ret;
+
+	if (!reader_has_chunk(reader)) {
+		ret = logger_load_chunk(log, reader);
+		if (ret)
+			return ret;
+		if (!reader_has_chunk(reader))
+			return 0;
+	}
+
+	memcpy(&entry, reader->chunk_buf + (reader->r_off - reader->chunk_start),
+	       sizeof(entry));
+
+	return sizeof(entry) + entry.len;
+}
+
+static void logger_flush_archive(struct logger_log *log)
+{
+	if (!logger_compressed(log))
+		return;
+
+	mutex_lock(&log->archive_mutex);
+	logger_free_archive(log);
+	log->sealed = ACCESS_ONCE(log->head);
+	mutex_unlock(&log->archive_mutex);
+}
+#else
+static inline ssize_t do_read_archive(struct logger_log *log,
+				      struct logger_reader *reader,
+				      char __user *buf, size_t count)
+{
+	return 0;
+}
+
+static inline long archive_entry_len(struct logger_log *log,
+				     struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline void logger_flush_archive(struct logger_log *log)
+{
+}
+#endif
+
+/*
+ * do_read_entries - copies whole committed entries to 'buf', one entry
+ * unless the reader asked for batched reads. Returns the number of bytes
+ * copied, or -EINVAL if the next entry does not fit.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t do_read_entries(struct logger_log *log,
+			       struct logger_reader *reader,
+			       char __user *buf, size_t count)
+{
+	size_t pos, w_off, start;
+	size_t copied;
+	ssize_t ret;
+
+retry:
+	start = reader_start(log, reader);
+	if (logger_before(start, ACCESS_ONCE(log->head))) {
+		reader->r_off = start;
+		ret = do_read_archive(log, reader, buf, count);
+		if (ret)
+			return ret;
+		goto retry;
+	}
+	w_off = ACCESS_ONCE(log->w_off);
+	/* pairs with the smp_wmb() in logger_commit() */
+	smp_rmb();
+
+	copied = 0;
+	pos = start;
+	while (pos != w_off) {
+		size_t len = get_entry_len(log, pos);
+
+		/* only possible if a writer is overwriting us right now */
+		if (unlikely(logger_before(w_off, pos + len)))
+			break;
+
+		if (copied + len > count)
+			break;
+
+		ret = do_read_log_to_user(log, pos, buf + copied, len);
+		if (ret < 0)
+			return ret;
+
+		copied += len;
+		pos += len;
+
+		if (!reader->batch)
+			break;
+	}
+
+	/*
+	 * Anything a writer reclaimed while we were copying was reclaimed
+	 * by moving head past it first; pairs with the smp_wmb() in
+	 * logger_reserve().
+	 */
+	smp_rmb();
+	if (logger_before(start, ACCESS_ONCE(log->head)))
+		goto retry;
+
+	if (!copied && pos != w_off)
+		return -EINVAL;
+
+	reader->r_off = pos;
+
+	return copied;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -149,7 +682,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in batch mode as many
+ * 	  whole entries as fit in the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -166,9 +700,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		ret = (ACCESS_ONCE(log->w_off) == reader_start(log, reader));
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -189,131 +723,131 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+	ret = do_read_entries(log, reader, buf, count);
+	mutex_unlock(&reader->mutex);
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	/* we raced with a flush */
+	if (!ret)
 		goto start;
-	}
-
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void do_write_log(struct logger_log *log, size_t pos,
+			 const void *buf, size_t count)
 {
-	size_t count = 0;
+	size_t off = logger_offset(pos);
+	size_t len;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	return off;
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_gather - copies the payload of an entry from the user-space
+ * vectors 'iov' into 'buf', which holds 'count' bytes.
+ *
+ * Returns 'count' on success, negative error code on failure.
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static ssize_t logger_gather(unsigned char *buf, const struct iovec *iov,
+			     unsigned long nr_segs, size_t count)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+	size_t copied = 0;
 
-	return 0;
-}
+	while (nr_segs-- > 0 && copied < count) {
+		/* figure out how much of this vector we can keep */
+		size_t len = min_t(size_t, iov->iov_len, count - copied);
 
-/*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
- */
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+		if (copy_from_user(buf + copied, iov->iov_base, len))
+			return -EFAULT;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+		iov++;
+		copied += len;
+	}
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	return copied;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_reserve - reserves room for the entry described by 'header' and
+ * writes the header, marked busy. The oldest entries are reclaimed to make
+ * room; an entry that is still being written can't be, in which case the
+ * log is full of in-flight writes and we fail with -EAGAIN. That takes
+ * writers on every other CPU filling the log at once.
  *
- * The caller needs to hold log->mutex.
+ * Caller must have preemption disabled until logger_commit().
+ *
+ * Returns zero and the position of the entry in 'pos' on success.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static int logger_reserve(struct logger_log *log,
+			  struct logger_entry *header, size_t *pos)
 {
-	size_t len;
+	size_t len = sizeof(struct logger_entry) + header->len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	spin_lock(&log->lock);
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+	while (log->w_reserve + len - log->head > log->size) {
+		if (log->head == log->w_off) {
+			spin_unlock(&log->lock);
+			return -EAGAIN;
+		}
+		log->head += get_entry_len(log, log->head);
+	}
 
-	log->w_off = logger_offset(log->w_off + count);
+	/* readers must see the new head before the old entries change */
+	smp_wmb();
 
+	*pos = log->w_reserve;
+	header->__pad = LOGGER_ENTRY_BUSY;
+	do_write_log(log, *pos, header, sizeof(struct logger_entry));
+	log->w_reserve += len;
+
+	spin_unlock(&log->lock);
+
+	return 0;
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * logger_commit - publishes the entry at 'pos' and moves w_off over every
+ * entry that is now complete. Entries can complete out of order, so the
+ * last writer of a run does the publishing for all of them.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void logger_commit(struct logger_log *log, size_t pos)
 {
-	size_t len;
+	int wake = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	/* the payload must be visible before the entry is */
+	smp_wmb();
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	spin_lock(&log->lock);
 
-	log->w_off = logger_offset(log->w_off + count);
+	set_entry_state(log, pos, LOGGER_ENTRY_COMMITTED);
 
-	return count;
+	while (log->w_off != log->w_reserve &&
+	       get_entry_state(log, log->w_off) != LOGGER_ENTRY_BUSY) {
+		log->w_off += get_entry_len(log, log->w_off);
+		wake = 1;
+	}
+
+	spin_unlock(&log->lock);
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	if (logger_compressed(log) &&
+	    ACCESS_ONCE(log->w_off) - ACCESS_ONCE(log->sealed) >=
+			LOGGER_CHUNK_SIZE)
+		schedule_work(&log->seal_work);
+#endif
+
+	/* wake up any blocked readers */
+	if (wake)
+		wake_up_interruptible(&log->wq);
 }
 
 /*
@@ -325,10 +859,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
+	unsigned char stack_payload[LOGGER_STACK_PAYLOAD];
+	unsigned char *payload;
 	struct timespec now;
-	ssize_t ret = 0;
+	size_t pos;
+	ssize_t ret;
 
 	now = current_kernel_time();
 
@@ -342,41 +878,35 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len <= LOGGER_STACK_PAYLOAD) {
+		payload = stack_payload;
+	} else {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (unlikely(!payload))
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	/* fault the payload in before it can hold up anyone else */
+	ret = logger_gather(payload, iov, nr_segs, header.len);
+	if (unlikely(ret < 0))
+		goto out;
+	header.len = ret;
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
+	preempt_disable();
 
-		iov++;
-		ret += nr;
+	ret = logger_reserve(log, &header, &pos);
+	if (likely(!ret)) {
+		do_write_log(log, pos + sizeof(struct logger_entry),
+			     payload, header.len);
+		logger_commit(log, pos);
+		ret = header.len;
 	}
 
-	mutex_unlock(&log->mutex);
+	preempt_enable();
 
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+out:
+	if (payload != stack_payload)
+		kfree(payload);
 
 	return ret;
 }
@@ -409,12 +939,13 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = log_oldest(log);
+		reader->batch = 0;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		reader->chunk_buf = NULL;
+		reader->chunk_start = reader->chunk_end = 0;
+#endif
 
 		file->private_data = reader;
 	} else
@@ -432,7 +963,9 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		vfree(reader->chunk_buf);
+#endif
 		kfree(reader);
 	}
 
@@ -462,22 +995,62 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (ACCESS_ONCE(log->w_off) != reader_start(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - maps the ring read-only, for readers that parse entries in
+ * place instead of copying them out with read(). See LOGGER_GET_READ_POS.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	size_t size = vma->vm_end - vma->vm_start;
+	size_t off;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EACCES;
+
+	if (vma->vm_pgoff || size > log->size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	/* the buffer is in module space when we are built as a module */
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		void *addr = log->buffer + off;
+		unsigned long pfn;
+
+		if (virt_addr_valid(addr))
+			pfn = page_to_pfn(virt_to_page(addr));
+		else
+			pfn = vmalloc_to_pfn(addr);
+
+		ret = remap_pfn_range(vma, vma->vm_start + off, pfn,
+				      PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_read_pos read_pos;
+	size_t start, pos, w_off;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -488,10 +1061,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		ret = ACCESS_ONCE(log->w_off) - reader_start(log, reader);
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,25 +1071,92 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
+		mutex_lock(&reader->mutex);
+		pos = reader_start(log, reader);
+		if (logger_before(pos, ACCESS_ONCE(log->head))) {
+			reader->r_off = pos;
+			ret = archive_entry_len(log, reader);
+			if (ret) {
+				mutex_unlock(&reader->mutex);
+				break;
+			}
+		}
+		pos = ring_start(log, reader);
+		if (ACCESS_ONCE(log->w_off) != pos) {
+			smp_rmb();
+			ret = get_entry_len(log, pos);
+		} else
 			ret = 0;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
+		/* readers behind head catch up on their own */
+		spin_lock(&log->lock);
 		log->head = log->w_off;
+		spin_unlock(&log->lock);
+		logger_flush_archive(log);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		reader->batch = !!arg;
+		mutex_unlock(&reader->mutex);
+		ret = 0;
+		break;
+	case LOGGER_GET_READ_POS:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		reader->r_off = ring_start(log, reader);
+		read_pos.r_off = reader->r_off;
+		read_pos.w_off = ACCESS_ONCE(log->w_off);
+		read_pos.head = ACCESS_ONCE(log->head);
+		mutex_unlock(&reader->mutex);
+		ret = 0;
+		if (copy_to_user((void __user *)arg, &read_pos,
+				 sizeof(read_pos)))
+			ret = -EFAULT;
+		break;
+	case LOGGER_SET_READ_POS:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		/*
+		 * Only ever move forward, and only to an entry boundary, so
+		 * a bogus position can't desynchronize later reads.
+		 */
+		start = ring_start(log, reader);
+		w_off = ACCESS_ONCE(log->w_off);
+		smp_rmb();
+		pos = start;
+		while (pos != w_off &&
+		       (__s32)((__u32)pos - (__u32)arg) < 0 &&
+		       !logger_before(w_off, pos + get_entry_len(log, pos)))
+			pos += get_entry_len(log, pos);
+		/* if we were lapped meanwhile, the next read starts at head */
+		smp_rmb();
+		if (!logger_before(start, ACCESS_ONCE(log->head)))
+			reader->r_off = pos;
+		mutex_unlock(&reader->mutex);
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -526,6 +1165,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -535,10 +1175,11 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so that
+ * it can be mapped by readers.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -548,8 +1189,8 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
+	.w_reserve = 0, \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -573,6 +1214,118 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+static inline struct logger_log *dev_to_log(struct device *dev)
+{
+	struct miscdevice *misc = dev_get_drvdata(dev);
+
+	return container_of(misc, struct logger_log, misc);
+}
+
+#define LOGGER_STAT_ATTR(_name)						\
+static ssize_t show_##_name(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct logger_log *log = dev_to_log(dev);			\
+	u64 val;							\
+									\
+	mutex_lock(&log->archive_mutex);				\
+	val = log->stats._name;						\
+	mutex_unlock(&log->archive_mutex);				\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);	\
+}									\
+static DEVICE_ATTR(_name, 0444, show_##_name, NULL)
+
+LOGGER_STAT_ATTR(raw_bytes);
+LOGGER_STAT_ATTR(compressed_bytes);
+LOGGER_STAT_ATTR(lost_bytes);
+LOGGER_STAT_ATTR(compress_ns);
+LOGGER_STAT_ATTR(decompress_ns);
+
+/* compressed size in percent of the raw size */
+static ssize_t show_ratio(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct logger_log *log = dev_to_log(dev);
+	u64 ratio = 0;
+
+	mutex_lock(&log->archive_mutex);
+	if (log->stats.raw_bytes)
+		ratio = div64_u64(log->stats.compressed_bytes * 100,
+				  log->stats.raw_bytes);
+	mutex_unlock(&log->archive_mutex);
+	return sprintf(buf, "%llu\n", (unsigned long long)ratio);
+}
+
+static DEVICE_ATTR(ratio, 0444, show_ratio, NULL);
+
+static ssize_t show_archive_bytes(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct logger_log *log = dev_to_log(dev);
+	size_t size;
+
+	mutex_lock(&log->archive_mutex);
+	size = log->archive_size;
+	mutex_unlock(&log->archive_mutex);
+	return sprintf(buf, "%zu\n", size);
+}
+
+static DEVICE_ATTR(archive_bytes, 0444, show_archive_bytes, NULL);
+
+static struct attribute *logger_compress_attrs[] = {
+	&dev_attr_raw_bytes.attr,
+	&dev_attr_compressed_bytes.attr,
+	&dev_attr_lost_bytes.attr,
+	&dev_attr_compress_ns.attr,
+	&dev_attr_decompress_ns.attr,
+	&dev_attr_ratio.attr,
+	&dev_attr_archive_bytes.attr,
+	NULL,
+};
+
+static struct attribute_group logger_compress_group = {
+	.name = "compression",
+	.attrs = logger_compress_attrs,
+};
+
+/*
+ * init_log_compress - sets up sealing for 'log'. Failing here is not fatal,
+ * the log just keeps only what fits in the ring.
+ */
+static void __init init_log_compress(struct logger_log *log)
+{
+	INIT_WORK(&log->seal_work, logger_seal_work);
+	mutex_init(&log->archive_mutex);
+	INIT_LIST_HEAD(&log->archive);
+
+	log->seal_out = kmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE),
+				GFP_KERNEL);
+	log->seal_wrk = vmalloc(LZO1X_1_MEM_COMPRESS);
+	log->seal_buf = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	if (!log->seal_out || !log->seal_wrk || !log->seal_buf)
+		goto err;
+
+	if (sysfs_create_group(&log->misc.this_device->kobj,
+			       &logger_compress_group))
+		goto err;
+
+	return;
+
+err:
+	printk(KERN_ERR "logger: no compression for log '%s'\n",
+	       log->misc.name);
+	kfree(log->seal_buf);
+	vfree(log->seal_wrk);
+	kfree(log->seal_out);
+	log->seal_buf = NULL;
+}
+#else
+static inline void init_log_compress(struct logger_log *log)
+{
+}
+#endif
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
@@ -584,8 +1337,11 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	init_log_compress(log);
+
+	printk(KERN_INFO "logger: created %luK%s log '%s'\n",
+	       (unsigned long) log->size >> 10,
+	       logger_compressed(log) ? " compressed" : "", log->misc.name);
 
 	return 0;
 }
@@ -30,6 +30,19 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * Positions in a log mapped with mmap(). They are free running; the byte
+ * at position p is at offset p & (LOGGER_GET_LOG_BUF_SIZE - 1) of the
+ * mapping. Entries in [r_off, w_off) are complete, but those before the
+ * 'head' of a later LOGGER_GET_READ_POS may have been overwritten while
+ * they were parsed.
+ */
+struct logger_read_pos {
+	__u32		r_off;	/* this reader's position */
+	__u32		w_off;	/* end of the complete entries */
+	__u32		head;	/* oldest entry still in the log */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +58,8 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* many entries per read */
+#define LOGGER_GET_READ_POS		_IOR(__LOGGERIO, 6, struct logger_read_pos)
+#define LOGGER_SET_READ_POS		_IO(__LOGGERIO, 7) /* consume up to pos */
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,23 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in one list per oom_adj value, so picking a victim only
+ * looks at the processes that may be killed. A process is listed when the
+ * driver starts, when it is forked and when its oom_adj is written. Only if
+ * none of the listed ones qualifies, e.g. because the list entry could not
+ * be allocated, are all processes scanned. Write a number of iterations to
+ * /sys/module/lowmemorykiller/parameters/benchmark to time both ways of
+ * selecting a victim; the results and the cost of real shrinker calls are
+ * in /sys/module/lowmemorykiller/parameters/stats.
+ *
+ * Up to max_pending kills may be outstanding at once; each gets a second to
+ * free its memory. With pressure_mode set, the reclaim efficiency and the
+ * allocation stall rate are sampled every pressure_interval ms, and when
+ * either is critical a process is killed as if the minfree levels were
+ * critical_scale percent of what they are, before reclaim stalls for long.
+ * Kill counts and latencies are in /sys/module/lowmemorykiller/parameters/
+ * kill_stats.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +52,14 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,8 +77,61 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-static struct task_struct *lowmem_deathpending;
-static unsigned long lowmem_deathpending_timeout;
+#define LOWMEM_DEATHPENDING_MAX	8
+
+/* A kill whose victim has not been freed yet */
+struct lowmem_death {
+	struct task_struct	*task;
+	unsigned long		timeout;	/* jiffies */
+	ktime_t			killed;
+};
+
+static DEFINE_SPINLOCK(lowmem_death_lock);
+static struct lowmem_death lowmem_deathpending[LOWMEM_DEATHPENDING_MAX];
+static int lowmem_max_pending = 1;
+
+/* Protected by lowmem_death_lock */
+static struct {
+	unsigned long	kills;
+	unsigned long	pressure_kills;	/* ahead of the minfree levels */
+	unsigned long	timeouts;	/* not freed within a second */
+	unsigned long	freed;
+	u64		latency_ns;	/* kill to free, summed over freed */
+	u64		max_latency_ns;
+} lowmem_kill_stats;
+
+/*
+ * A process on the list for its oom_adj and in the hash by its group leader.
+ * Entries go away when the leader is freed or its oom_adj is OOM_DISABLE.
+ */
+struct lowmem_task {
+	struct list_head	list;
+	struct hlist_node	hash;
+	struct task_struct	*task;
+	int			oom_adj;
+};
+
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_ADJUST_MIN + 1)
+#define LOWMEM_HASH_BITS	6
+
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static struct hlist_head lowmem_hash[1 << LOWMEM_HASH_BITS];
+
+struct lowmem_cost {
+	unsigned long	calls;
+	u64		ns;
+};
+
+/*
+ * Shrinker calls that picked from the buckets or had to scan, protected by
+ * lowmem_bucket_lock
+ */
+static struct lowmem_cost lowmem_bucket_cost;
+static struct lowmem_cost lowmem_scan_cost;
+/* last benchmark, in ns per selection */
+static unsigned long lowmem_bench_bucket_ns;
+static unsigned long lowmem_bench_scan_ns;
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -68,54 +146,400 @@ static struct notifier_block task_nb = {
 	.notifier_call	= task_notify_func,
 };
 
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data);
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static struct hlist_head *lowmem_hash_head(struct task_struct *task)
+{
+	return &lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)];
+}
+
+/* Called with lowmem_bucket_lock held */
+static struct lowmem_task *lowmem_find_task(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(lt, node, lowmem_hash_head(task), hash)
+		if (lt->task == task)
+			return lt;
+	return NULL;
+}
+
+/* Called with lowmem_bucket_lock held */
+static void lowmem_remove_task(struct lowmem_task *lt)
+{
+	list_del(&lt->list);
+	hlist_del(&lt->hash);
+	kfree(lt);
+}
+
+/*
+ * lowmem_track_task - moves 'task' to the bucket of its current oom_adj,
+ * using 'new' if it is not listed yet. Returns 'new' if it was not used.
+ *
+ * Called with lowmem_bucket_lock held.
+ */
+static struct lowmem_task *lowmem_track_task(struct task_struct *task,
+					     struct lowmem_task *new)
+{
+	struct lowmem_task *lt;
+	int oom_adj = ACCESS_ONCE(task->signal->oom_adj);
+
+	lt = lowmem_find_task(task);
+	if (oom_adj == OOM_DISABLE) {
+		if (lt)
+			lowmem_remove_task(lt);
+	} else if (lt) {
+		if (lt->oom_adj != oom_adj) {
+			list_move_tail(&lt->list,
+				       &lowmem_buckets[oom_adj - OOM_ADJUST_MIN]);
+			lt->oom_adj = oom_adj;
+		}
+	} else if (new && !(task->flags & PF_EXITING)) {
+		new->task = task;
+		new->oom_adj = oom_adj;
+		list_add_tail(&new->list,
+			      &lowmem_buckets[oom_adj - OOM_ADJUST_MIN]);
+		hlist_add_head(&new->hash, lowmem_hash_head(task));
+		new = NULL;
+	}
+
+	return new;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	struct lowmem_task *lt;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&lowmem_death_lock, flags);
+	for (i = 0; i < LOWMEM_DEATHPENDING_MAX; i++) {
+		struct lowmem_death *death = &lowmem_deathpending[i];
+		u64 ns;
+
+		if (death->task != task)
+			continue;
+		ns = ktime_to_ns(ktime_sub(ktime_get(), death->killed));
+		lowmem_kill_stats.freed++;
+		lowmem_kill_stats.latency_ns += ns;
+		if (ns > lowmem_kill_stats.max_latency_ns)
+			lowmem_kill_stats.max_latency_ns = ns;
+		death->task = NULL;
+	}
+	spin_unlock_irqrestore(&lowmem_death_lock, flags);
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	lt = lowmem_find_task(task);
+	if (lt)
+		lowmem_remove_task(lt);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
 
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
+	struct task_struct *task;
+	struct lowmem_task *new = NULL;
+	unsigned long flags;
+
+	rcu_read_lock();
+	task = ACCESS_ONCE(((struct task_struct *)data)->group_leader);
+	get_task_struct(task);
+	rcu_read_unlock();
+
+	if ((int)val != OOM_DISABLE)
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+
+	/*
+	 * The bucket follows the oom_adj read under the lock rather than
+	 * 'val', so a write racing with the fork notification leaves the
+	 * process where the last of them put it.
+	 */
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	new = lowmem_track_task(task, new);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	/* not needed, or no memory: the scan will still find the task */
+	kfree(new);
+	put_task_struct(task);
+
+	return NOTIFY_OK;
+}
+
+/*
+ * lowmem_may_kill - retires kills that timed out and checks whether another
+ * one may be started.
+ */
+static int lowmem_may_kill(void)
+{
+	unsigned long flags;
+	int i, pending = 0;
+
+	spin_lock_irqsave(&lowmem_death_lock, flags);
+	for (i = 0; i < LOWMEM_DEATHPENDING_MAX; i++) {
+		struct lowmem_death *death = &lowmem_deathpending[i];
+
+		if (!death->task)
+			continue;
+		if (time_after(jiffies, death->timeout)) {
+			lowmem_kill_stats.timeouts++;
+			death->task = NULL;
+			continue;
+		}
+		pending++;
+	}
+	spin_unlock_irqrestore(&lowmem_death_lock, flags);
+
+	return pending < min(lowmem_max_pending, LOWMEM_DEATHPENDING_MAX);
+}
+
+static int lowmem_is_dying(struct task_struct *p)
+{
+	unsigned long flags;
+	int i, ret = 0;
+
+	spin_lock_irqsave(&lowmem_death_lock, flags);
+	for (i = 0; i < LOWMEM_DEATHPENDING_MAX; i++)
+		if (lowmem_deathpending[i].task == p)
+			ret = 1;
+	spin_unlock_irqrestore(&lowmem_death_lock, flags);
+
+	return ret;
+}
+
+/*
+ * lowmem_candidate - checks whether 'p' beats the current selection. Returns
+ * 1 and updates the selection if it does.
+ */
+static int lowmem_candidate(struct task_struct *p, int min_adj,
+			    struct task_struct **selected,
+			    int *selected_tasksize, int *selected_oom_adj)
+{
+	struct mm_struct *mm;
+	struct signal_struct *sig;
+	int oom_adj;
 	int tasksize;
+
+	if (lowmem_is_dying(p))
+		return 0;
+
+	task_lock(p);
+	mm = p->mm;
+	sig = p->signal;
+	if (!mm || !sig) {
+		task_unlock(p);
+		return 0;
+	}
+	oom_adj = sig->oom_adj;
+	if (oom_adj < min_adj) {
+		task_unlock(p);
+		return 0;
+	}
+	tasksize = get_mm_rss(mm);
+	task_unlock(p);
+	if (tasksize <= 0)
+		return 0;
+	if (*selected) {
+		if (oom_adj < *selected_oom_adj)
+			return 0;
+		if (oom_adj == *selected_oom_adj &&
+		    tasksize <= *selected_tasksize)
+			return 0;
+	}
+	*selected = p;
+	*selected_tasksize = tasksize;
+	*selected_oom_adj = oom_adj;
+	return 1;
+}
+
+/*
+ * lowmem_select_bucket - picks the largest process from the highest
+ * non-empty bucket at or above min_adj.
+ *
+ * Called with lowmem_bucket_lock held.
+ */
+static struct task_struct *lowmem_select_bucket(int min_adj, int *tasksize,
+						int *oom_adj)
+{
+	struct task_struct *selected = NULL;
+	struct lowmem_task *lt;
+	int adj;
+
+	if (min_adj < OOM_ADJUST_MIN)
+		min_adj = OOM_ADJUST_MIN;
+
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		list_for_each_entry(lt, &lowmem_buckets[adj - OOM_ADJUST_MIN],
+				    list) {
+			/*
+			 * A write can land just before its notification moves
+			 * the process, so check the current oom_adj.
+			 */
+			lowmem_candidate(lt->task, adj, &selected,
+					 tasksize, oom_adj);
+		}
+	}
+
+	return selected;
+}
+
+/*
+ * lowmem_select_scan - picks the victim among all processes.
+ *
+ * Called with tasklist_lock held.
+ */
+static struct task_struct *lowmem_select_scan(int min_adj, int *tasksize,
+					      int *oom_adj)
+{
+	struct task_struct *selected = NULL;
+	struct task_struct *p;
+
+	*oom_adj = min_adj;
+	for_each_process(p)
+		lowmem_candidate(p, min_adj, &selected, tasksize, oom_adj);
+
+	return selected;
+}
+
+static void lowmem_account(struct lowmem_cost *cost, ktime_t start)
+{
+	cost->calls++;
+	cost->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * lowmem_kill - kills 'selected' if a pending death slot is free. Returns 0
+ * if it had to leave it alone.
+ */
+static int lowmem_kill(struct task_struct *selected, int tasksize,
+		       int oom_adj, int pressure)
+{
+	struct lowmem_death *death = NULL;
+	unsigned long flags;
+	int i;
+
+	lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+		     selected->pid, selected->comm, oom_adj, tasksize);
+
+	spin_lock_irqsave(&lowmem_death_lock, flags);
+	for (i = 0; i < min(lowmem_max_pending, LOWMEM_DEATHPENDING_MAX); i++) {
+		if (!lowmem_deathpending[i].task) {
+			death = &lowmem_deathpending[i];
+			break;
+		}
+	}
+	if (death) {
+		death->task = selected;
+		death->timeout = jiffies + HZ;
+		death->killed = ktime_get();
+		lowmem_kill_stats.kills++;
+		if (pressure)
+			lowmem_kill_stats.pressure_kills++;
+	}
+	spin_unlock_irqrestore(&lowmem_death_lock, flags);
+
+	if (!death)
+		return 0;
+
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d%s\n",
+		     selected->pid, selected->comm, oom_adj, tasksize,
+		     pressure ? ", pressure" : "");
+	force_sig(SIGKILL, selected);
+	return 1;
+}
+
+/*
+ * lowmem_min_adj - the lowest oom_adj that may be killed with the given
+ * amount of free memory, with the minfree levels scaled to 'scale' percent
+ */
+static int lowmem_min_adj(int other_free, int other_file, int scale)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
 	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		size_t minfree = lowmem_minfree[i] * scale / 100;
+
+		if (other_free < minfree && other_file < minfree)
+			return lowmem_adj[i];
+	}
+	return OOM_ADJUST_MAX + 1;
+}
+
+/*
+ * lowmem_kill_one - selects and kills a process with an oom_adj of at least
+ * 'min_adj'. Returns its size in pages, or 0 if nothing was killed.
+ */
+static int lowmem_kill_one(int min_adj, int pressure)
+{
+	struct task_struct *selected;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int killed = 0;
+	unsigned long flags;
+	ktime_t start;
+
+	start = ktime_get();
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	selected = lowmem_select_bucket(min_adj, &selected_tasksize,
+					&selected_oom_adj);
+	if (selected) {
+		killed = lowmem_kill(selected, selected_tasksize,
+				     selected_oom_adj, pressure);
+		lowmem_account(&lowmem_bucket_cost, start);
+	}
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	if (!selected) {
+		read_lock(&tasklist_lock);
+		selected = lowmem_select_scan(min_adj, &selected_tasksize,
+					      &selected_oom_adj);
+		if (selected)
+			killed = lowmem_kill(selected, selected_tasksize,
+					     selected_oom_adj, pressure);
+		read_unlock(&tasklist_lock);
+
+		spin_lock_irqsave(&lowmem_bucket_lock, flags);
+		lowmem_account(&lowmem_scan_cost, start);
+		spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+	}
+
+	return killed ? selected_tasksize : 0;
+}
+
+static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	int rem = 0;
+	int min_adj;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
 	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
+	 * If we already have as many deaths outstanding as
+	 * we allow, then bail out right away; indicating to
+	 * vmscan that we have nothing further to offer on
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+	if (!lowmem_may_kill())
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	min_adj = lowmem_min_adj(other_free, other_file, 100);
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -129,55 +553,11 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
-	}
+	rem -= lowmem_kill_one(min_adj, 0);
+
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -186,17 +566,333 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* fewer scanned pages per sample say nothing about reclaim efficiency */
+#define LOWMEM_PRESSURE_MIN_SCAN	(SWAP_CLUSTER_MAX * 16)
+#define LOWMEM_PRESSURE_MIN_INTERVAL	10	/* ms */
+
+static int lowmem_pressure_mode;
+static unsigned int lowmem_pressure_interval = 100;	/* ms */
+static unsigned int lowmem_critical_pressure = 90;	/* % not reclaimed */
+static unsigned int lowmem_critical_stalls = 50;	/* stalls per second */
+static unsigned int lowmem_critical_scale = 150;	/* % of minfree */
+
+static unsigned int lowmem_pressure;
+static unsigned int lowmem_stall_rate;
+static unsigned long lowmem_last_scanned;
+static unsigned long lowmem_last_reclaimed;
+static unsigned long lowmem_last_stalls;
+static unsigned long lowmem_last_sample;
+
+static struct delayed_work lowmem_pressure_work;
+
+static void lowmem_pressure_read(unsigned long *scanned,
+				 unsigned long *reclaimed,
+				 unsigned long *stalls)
+{
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	int i;
+
+	all_vm_events(events);
+
+	*reclaimed = 0;
+	for (i = PGREFILL_MOVABLE + 1; i <= PGSTEAL_MOVABLE; i++)
+		*reclaimed += events[i];
+	/* kswapd and direct reclaim */
+	*scanned = 0;
+	for (i = PGSTEAL_MOVABLE + 1; i <= PGSCAN_DIRECT_MOVABLE; i++)
+		*scanned += events[i];
+	*stalls = events[ALLOCSTALL];
+}
+
+/*
+ * lowmem_pressure_sample - computes the share of scanned pages that reclaim
+ * failed to free and the rate of direct reclaim stalls since the last
+ * sample, and kills ahead of the minfree levels if either is critical.
+ */
+static void lowmem_pressure_sample(struct work_struct *work)
+{
+	unsigned long scanned, reclaimed, stalls, elapsed;
+	int other_free, other_file, min_adj;
+
+	lowmem_pressure_read(&scanned, &reclaimed, &stalls);
+	elapsed = jiffies_to_msecs(jiffies - lowmem_last_sample);
+
+	scanned -= lowmem_last_scanned;
+	reclaimed -= lowmem_last_reclaimed;
+	if (scanned >= LOWMEM_PRESSURE_MIN_SCAN)
+		lowmem_pressure = 100 - min(reclaimed, scanned) * 100 / scanned;
+	else
+		lowmem_pressure = 0;
+	lowmem_stall_rate = elapsed ?
+		(stalls - lowmem_last_stalls) * MSEC_PER_SEC / elapsed : 0;
+
+	lowmem_pressure_read(&lowmem_last_scanned, &lowmem_last_reclaimed,
+			     &lowmem_last_stalls);
+	lowmem_last_sample = jiffies;
+
+	if ((lowmem_pressure >= lowmem_critical_pressure ||
+	     lowmem_stall_rate >= lowmem_critical_stalls) &&
+	    lowmem_may_kill()) {
+		other_free = global_page_state(NR_FREE_PAGES);
+		other_file = global_page_state(NR_FILE_PAGES) -
+			global_page_state(NR_SHMEM);
+		min_adj = lowmem_min_adj(other_free, other_file,
+					 lowmem_critical_scale);
+		lowmem_print(3, "lowmem pressure %u, stalls %u/s, "
+			     "ofree %d %d, ma %d\n", lowmem_pressure,
+			     lowmem_stall_rate, other_free, other_file,
+			     min_adj);
+		if (min_adj <= OOM_ADJUST_MAX)
+			lowmem_kill_one(min_adj, 1);
+	}
+
+	if (lowmem_pressure_mode)
+		schedule_delayed_work(&lowmem_pressure_work,
+			msecs_to_jiffies(lowmem_pressure_interval));
+}
+
+/* a no-op if the sampler is already queued */
+static void lowmem_pressure_start(void)
+{
+	lowmem_pressure_read(&lowmem_last_scanned, &lowmem_last_reclaimed,
+			     &lowmem_last_stalls);
+	lowmem_last_sample = jiffies;
+	schedule_delayed_work(&lowmem_pressure_work,
+			      msecs_to_jiffies(lowmem_pressure_interval));
+}
+
+static int lowmem_initialized;
+
+static int lowmem_set_pressure_mode(const char *val, struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_bool(val, kp);
+	if (ret)
+		return ret;
+	/* the sampler stops on its own once the mode is cleared */
+	if (lowmem_pressure_mode && lowmem_initialized)
+		lowmem_pressure_start();
+	return 0;
+}
+
+static int lowmem_set_pressure_interval(const char *val,
+				       struct kernel_param *kp)
+{
+	unsigned long interval;
+	int ret;
+
+	ret = strict_strtoul(val, 0, &interval);
+	if (ret < 0)
+		return ret;
+	if (interval < LOWMEM_PRESSURE_MIN_INTERVAL || interval > UINT_MAX)
+		return -EINVAL;
+	lowmem_pressure_interval = interval;
+	return 0;
+}
+
+static int lowmem_get_pressure(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "pressure %u stalls %u/s",
+		       lowmem_pressure, lowmem_stall_rate);
+}
+
+module_param_call(pressure_mode, lowmem_set_pressure_mode, param_get_bool,
+		  &lowmem_pressure_mode, S_IRUGO | S_IWUSR);
+module_param_call(pressure_interval, lowmem_set_pressure_interval,
+		  param_get_uint, &lowmem_pressure_interval, S_IRUGO | S_IWUSR);
+module_param_named(critical_pressure, lowmem_critical_pressure, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(critical_stalls, lowmem_critical_stalls, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(critical_scale, lowmem_critical_scale, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_call(pressure, NULL, lowmem_get_pressure, NULL, S_IRUGO);
+
+static void __init lowmem_pressure_init(void)
+{
+	INIT_DELAYED_WORK_DEFERRABLE(&lowmem_pressure_work,
+				     lowmem_pressure_sample);
+	lowmem_initialized = 1;
+	if (lowmem_pressure_mode)
+		lowmem_pressure_start();
+}
+
+static void lowmem_pressure_exit(void)
+{
+	lowmem_pressure_mode = 0;
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+}
+#else
+static inline void lowmem_pressure_init(void)
+{
+}
+
+static inline void lowmem_pressure_exit(void)
+{
+}
+#endif
+
+/*
+ * lowmem_benchmark - times 'val' victim selections each way, as if all
+ * processes with an oom_adj of 0 or more could be killed. Nothing is killed.
+ */
+static int lowmem_benchmark(const char *val, struct kernel_param *kp)
+{
+	unsigned long iterations, i;
+	int tasksize, oom_adj;
+	unsigned long flags;
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	ret = strict_strtoul(val, 0, &iterations);
+	if (ret < 0)
+		return ret;
+	if (!iterations)
+		return -EINVAL;
+
+	ns = 0;
+	for (i = 0; i < iterations; i++) {
+		start = ktime_get();
+		spin_lock_irqsave(&lowmem_bucket_lock, flags);
+		lowmem_select_bucket(0, &tasksize, &oom_adj);
+		spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+		ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		cond_resched();
+	}
+	lowmem_bench_bucket_ns = div64_u64(ns, iterations);
+
+	ns = 0;
+	for (i = 0; i < iterations; i++) {
+		start = ktime_get();
+		read_lock(&tasklist_lock);
+		lowmem_select_scan(0, &tasksize, &oom_adj);
+		read_unlock(&tasklist_lock);
+		ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		cond_resched();
+	}
+	lowmem_bench_scan_ns = div64_u64(ns, iterations);
+
+	lowmem_print(1, "lowmem benchmark: bucket %lu ns, scan %lu ns\n",
+		     lowmem_bench_bucket_ns, lowmem_bench_scan_ns);
+	return 0;
+}
+
+static unsigned long lowmem_avg_ns(struct lowmem_cost *cost)
+{
+	return cost->calls ? div64_u64(cost->ns, cost->calls) : 0;
+}
+
+static int lowmem_get_kill_stats(char *buffer, struct kernel_param *kp)
+{
+	unsigned long flags;
+	unsigned long avg_us;
+	int ret;
+
+	spin_lock_irqsave(&lowmem_death_lock, flags);
+	avg_us = lowmem_kill_stats.freed ?
+		div64_u64(lowmem_kill_stats.latency_ns,
+			  lowmem_kill_stats.freed * NSEC_PER_USEC) : 0;
+	ret = sprintf(buffer,
+		      "kills %lu pressure %lu timeouts %lu\n"
+		      "latency avg %lu us max %lu us",
+		      lowmem_kill_stats.kills,
+		      lowmem_kill_stats.pressure_kills,
+		      lowmem_kill_stats.timeouts, avg_us,
+		      (unsigned long)div_u64(lowmem_kill_stats.max_latency_ns,
+					     NSEC_PER_USEC));
+	spin_unlock_irqrestore(&lowmem_death_lock, flags);
+
+	return ret;
+}
+
+static int lowmem_set_max_pending(const char *val, struct kernel_param *kp)
+{
+	long pending;
+	int ret;
+
+	ret = strict_strtol(val, 0, &pending);
+	if (ret < 0)
+		return ret;
+	/* with no slot at all nothing could ever be killed */
+	if (pending < 1 || pending > LOWMEM_DEATHPENDING_MAX)
+		return -EINVAL;
+	lowmem_max_pending = pending;
+	return 0;
+}
+
+static int lowmem_get_stats(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer,
+		       "bucket %lu calls %lu ns\n"
+		       "scan %lu calls %lu ns\n"
+		       "benchmark bucket %lu ns scan %lu ns",
+		       lowmem_bucket_cost.calls,
+		       lowmem_avg_ns(&lowmem_bucket_cost),
+		       lowmem_scan_cost.calls,
+		       lowmem_avg_ns(&lowmem_scan_cost),
+		       lowmem_bench_bucket_ns, lowmem_bench_scan_ns);
+}
+
+/*
+ * lowmem_track_existing - lists the processes that were started before the
+ * driver. Later ones are listed by the oom_adj notifier when they fork.
+ */
+static void __init lowmem_track_existing(void)
+{
+	struct task_struct *p;
+	struct lowmem_task *new = NULL;
+	unsigned long flags;
+
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		if (!p->mm)
+			continue;
+		if (!new)
+			new = kmalloc(sizeof(*new), GFP_ATOMIC);
+		if (!new)
+			break;
+		spin_lock_irqsave(&lowmem_bucket_lock, flags);
+		new = lowmem_track_task(p, new);
+		spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+	}
+	read_unlock(&tasklist_lock);
+
+	kfree(new);
+}
+
 static int __init lowmem_init(void)
 {
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
 	task_free_register(&task_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
+	lowmem_track_existing();
 	register_shrinker(&lowmem_shrinker);
+	lowmem_pressure_init();
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_task *lt, *tmp;
+	unsigned long flags;
+	int i;
+
+	lowmem_pressure_exit();
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 	task_free_unregister(&task_nb);
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		list_for_each_entry_safe(lt, tmp, &lowmem_buckets[i], list)
+			lowmem_remove_task(lt);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +901,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_call(benchmark, lowmem_benchmark, NULL, NULL, S_IWUSR);
+module_param_call(stats, NULL, lowmem_get_stats, NULL, S_IRUGO);
+module_param_call(max_pending, lowmem_set_max_pending, param_get_int,
+		  &lowmem_max_pending, S_IRUGO | S_IWUSR);
+module_param_call(kill_stats, NULL, lowmem_get_kill_stats, NULL, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -32,6 +32,7 @@
 #include <plat/clock.h>
 #include <plat/cpu-freq.h>
 #include <plat/media.h>
+#include <mach/busfreq.h>
 #ifdef CONFIG_HAS_WAKELOCK
 #include <linux/wakelock.h>
 #include <linux/earlysuspend.h>
@@ -123,7 +124,9 @@ static irqreturn_t s3cfb_irq_frame(int irq, void *data)
 }
 static void s3cfb_set_window(struct s3cfb_global *ctrl, int id, int enable)
 {
+	struct s3c_platform_fb *pdata = to_fb_plat(ctrl->dev);
 	struct s3cfb_window *win = ctrl->fb[id]->par;
+	int i, nr_enabled = 0;
 
 	if (enable) {
 		s3cfb_window_on(ctrl, id);
@@ -132,6 +135,18 @@ static void s3cfb_set_window(struct s3cfb_global *ctrl, int id, int enable)
 		s3cfb_window_off(ctrl, id);
 		win->enabled = 0;
 	}
+
+	/* Blending several windows needs the full bus bandwidth */
+	for (i = 0; i < pdata->nr_wins; i++) {
+		win = ctrl->fb[i]->par;
+		if (win->enabled)
+			nr_enabled++;
+	}
+
+	if (nr_enabled > 1)
+		s5pv210_busfreq_lock(BUSFREQ_FB);
+	else
+		s5pv210_busfreq_unlock(BUSFREQ_FB);
 }
 static int s3cfb_init_global(struct s3cfb_global *ctrl)
 {
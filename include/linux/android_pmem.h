@@ -34,6 +34,21 @@
  */
 #define PMEM_GET_TOTAL_SIZE	_IOW(PMEM_IOCTL_MAGIC, 7, unsigned int)
 #define PMEM_CACHE_FLUSH	_IOW(PMEM_IOCTL_MAGIC, 8, unsigned int)
+/* Cleans and/or invalidates an explicit range of the file, pass a
+ * pmem_cache_op struct
+ */
+#define PMEM_CACHE_OP		_IOW(PMEM_IOCTL_MAGIC, 9, unsigned int)
+/* Declares a range (pmem_region struct) of the file as written by the CPU.
+ * Once a file has declared a dirty range, cache cleans on it only cover
+ * the declared ranges, so every CPU write must be declared from then on.
+ */
+#define PMEM_DIRTY		_IOW(PMEM_IOCTL_MAGIC, 10, unsigned int)
+
+/* pmem_cache_op.op flags */
+/* write back, the CPU wrote the range and a device is going to read it */
+#define PMEM_CACHE_CLEAN	0x1
+/* discard, a device wrote the range and the CPU is going to read it */
+#define PMEM_CACHE_INVALIDATE	0x2
 
 struct android_pmem_platform_data
 {
@@ -57,6 +72,12 @@ struct pmem_region {
 	unsigned long len;
 };
 
+struct pmem_cache_op {
+	unsigned long offset;
+	unsigned long len;
+	unsigned int op;
+};
+
 #ifdef CONFIG_ANDROID_PMEM
 int is_pmem_file(struct file *file);
 int get_pmem_file(int fd, unsigned long *start, unsigned long *vstart,
@@ -65,6 +86,10 @@ int get_pmem_user_addr(struct file *file, unsigned long *start,
 		       unsigned long *end);
 void put_pmem_file(struct file* file);
 void flush_pmem_file(struct file *file, unsigned long start, unsigned long len);
+int pmem_cache_maint(struct file *file, unsigned long offset,
+		     unsigned long len, unsigned int op);
+void pmem_mark_dirty(struct file *file, unsigned long offset,
+		     unsigned long len);
 int pmem_setup(struct android_pmem_platform_data *pdata,
 	       long (*ioctl)(struct file *, unsigned int, unsigned long),
 	       int (*release)(struct inode *, struct file *));
@@ -81,6 +106,11 @@ static inline int get_pmem_user_addr(struct file *file, unsigned long *start,
 static inline void put_pmem_file(struct file* file) { return; }
 static inline void flush_pmem_file(struct file *file, unsigned long start,
 				   unsigned long len) { return; }
+static inline int pmem_cache_maint(struct file *file, unsigned long offset,
+				   unsigned long len, unsigned int op)
+				   { return -ENOSYS; }
+static inline void pmem_mark_dirty(struct file *file, unsigned long offset,
+				   unsigned long len) { return; }
 static inline int pmem_setup(struct android_pmem_platform_data *pdata,
 	      long (*ioctl)(struct file *, unsigned int, unsigned long),
 	      int (*release)(struct inode *, struct file *)) { return -ENOSYS; }
@@ -54,6 +54,7 @@ struct onenand_bufferram {
  * @writesize:		[INTERN] a real page size
  * @bufferram_index:	[INTERN] BufferRAM index
  * @bufferram:		[INTERN] BufferRAM info
+ * @readahead:		[INTERN] page being loaded ahead of the reader, or -1
  * @readw:		[REPLACEABLE] hardware specific function for read short
  * @writew:		[REPLACEABLE] hardware specific function for write short
  * @command:		[REPLACEABLE] hardware specific function for writing
@@ -103,6 +104,7 @@ struct onenand_chip {
 
 	unsigned int		bufferram_index;
 	struct onenand_bufferram	bufferram[MAX_BUFFERRAM];
+	loff_t			readahead;
 	struct clk		*clk;
 
 	int (*command)(struct mtd_info *mtd, int cmd, loff_t address, size_t len);
@@ -183,6 +185,7 @@ struct onenand_chip {
 #define ONENAND_HAS_2PLANE		(0x0004)
 #define ONENAND_HAS_4KB_PAGE		(0x0008)
 #define ONENAND_SKIP_UNLOCK_CHECK	(0x0100)
+#define ONENAND_READAHEAD		(0x0200)
 #define ONENAND_PAGEBUF_ALLOC		(0x1000)
 #define ONENAND_OOBBUF_ALLOC		(0x2000)
 
@@ -87,6 +87,14 @@ enum v4l2_photometry_mode {
 #define V4L2_CID_IMAGE_EFFECT_CR	(V4L2_CID_PRIVATE_BASE + 19)
 #define V4L2_CID_RESERVED_MEM_BASE_ADDR	(V4L2_CID_PRIVATE_BASE + 20)
 #define V4L2_CID_FIMC_VERSION		(V4L2_CID_PRIVATE_BASE + 21)
+/* m2m: jobs to queue before starting, and (fimc id << 8 | ctx) to chain to */
+#define V4L2_CID_FIMC_BATCH		(V4L2_CID_PRIVATE_BASE + 51)
+#define V4L2_CID_FIMC_CHAIN		(V4L2_CID_PRIVATE_BASE + 52)
+/* capture: preview to the overlay window and its frame counters */
+#define V4L2_CID_FIMC_PREVIEW		(V4L2_CID_PRIVATE_BASE + 61)
+#define V4L2_CID_FIMC_PREVIEW_DELIVERED	(V4L2_CID_PRIVATE_BASE + 62)
+#define V4L2_CID_FIMC_PREVIEW_DROPPED	(V4L2_CID_PRIVATE_BASE + 63)
+#define V4L2_CID_FIMC_PREVIEW_LATE	(V4L2_CID_PRIVATE_BASE + 67)
 
 #define V4L2_CID_STREAM_PAUSE			(V4L2_CID_PRIVATE_BASE + 53)
 
@@ -0,0 +1,98 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_TRACE_BINDER_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_BINDER_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(binder_transaction,
+
+	TP_PROTO(int debug_id, int reply, int from_proc, int from_thread,
+		 int to_proc, int to_thread, unsigned int code,
+		 unsigned int flags),
+
+	TP_ARGS(debug_id, reply, from_proc, from_thread, to_proc, to_thread,
+		code, flags),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	int,		reply		)
+		__field(	int,		from_proc	)
+		__field(	int,		from_thread	)
+		__field(	int,		to_proc		)
+		__field(	int,		to_thread	)
+		__field(	unsigned int,	code		)
+		__field(	unsigned int,	flags		)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->reply = reply;
+		__entry->from_proc = from_proc;
+		__entry->from_thread = from_thread;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->code = code;
+		__entry->flags = flags;
+	),
+
+	TP_printk("transaction=%d reply=%d from=%d:%d dest=%d:%d code=0x%x flags=0x%x",
+		  __entry->debug_id, __entry->reply,
+		  __entry->from_proc, __entry->from_thread,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->code, __entry->flags)
+);
+
+TRACE_EVENT(binder_transaction_received,
+
+	TP_PROTO(int debug_id, unsigned int wakeup_us, unsigned int read_us),
+
+	TP_ARGS(debug_id, wakeup_us, read_us),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	unsigned int,	wakeup_us	)
+		__field(	unsigned int,	read_us		)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->wakeup_us = wakeup_us;
+		__entry->read_us = read_us;
+	),
+
+	TP_printk("transaction=%d wakeup_us=%u read_us=%u",
+		  __entry->debug_id, __entry->wakeup_us, __entry->read_us)
+);
+
+TRACE_EVENT(binder_transaction_replied,
+
+	TP_PROTO(int debug_id, unsigned int code, unsigned int service_us,
+		 unsigned int reply_us),
+
+	TP_ARGS(debug_id, code, service_us, reply_us),
+
+	TP_STRUCT__entry(
+		__field(	int,		debug_id	)
+		__field(	unsigned int,	code		)
+		__field(	unsigned int,	service_us	)
+		__field(	unsigned int,	reply_us	)
+	),
+
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->code = code;
+		__entry->service_us = service_us;
+		__entry->reply_us = reply_us;
+	),
+
+	TP_printk("transaction=%d code=0x%x service_us=%u reply_us=%u",
+		  __entry->debug_id, __entry->code,
+		  __entry->service_us, __entry->reply_us)
+);
+
+#endif /* _TRACE_BINDER_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -67,6 +67,32 @@ TRACE_EVENT(power_end,
 
 );
 
+TRACE_EVENT(cpu_frequency_transition,
+
+	TP_PROTO(unsigned int old_freq, unsigned int new_freq,
+		 unsigned int latency_us, unsigned int pll_changing),
+
+	TP_ARGS(old_freq, new_freq, latency_us, pll_changing),
+
+	TP_STRUCT__entry(
+		__field(	u32,		old_freq	)
+		__field(	u32,		new_freq	)
+		__field(	u32,		latency_us	)
+		__field(	u32,		pll_changing	)
+	),
+
+	TP_fast_assign(
+		__entry->old_freq = old_freq;
+		__entry->new_freq = new_freq;
+		__entry->latency_us = latency_us;
+		__entry->pll_changing = pll_changing;
+	),
+
+	TP_printk("old_freq=%u new_freq=%u latency_us=%u pll_changing=%u",
+		  __entry->old_freq, __entry->new_freq,
+		  __entry->latency_us, __entry->pll_changing)
+);
+
 #endif /* _TRACE_POWER_H */
 
 /* This part must be outside protection */
@@ -65,6 +65,7 @@
 #include <linux/perf_event.h>
 #include <linux/posix-timers.h>
 #include <linux/user-return-notifier.h>
+#include <linux/oom.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -1301,6 +1302,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	spin_unlock(&current->sighand->siglock);
 	write_unlock_irq(&tasklist_lock);
 	proc_fork_connector(p);
+	/* a new process inherits its parent's oom_adj */
+	if (!(clone_flags & CLONE_THREAD) && p->mm)
+		oom_adj_changed(p, p->signal->oom_adj);
 	cgroup_post_fork(p);
 	perf_event_fork(p);
 	return p;
@@ -0,0 +1,477 @@
+/* $(CROSS_COMPILE)cc -Wall -O2 -I../../drivers/staging/android -o binder_stress binder_stress.c */
+
+/*
+ * binder_stress.c -- binder transaction rate benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Runs a number of client/server process pairs, each client making
+ * synchronous calls to its own server as fast as it can, and reports
+ * the total number of transactions per second. Pairs never talk to each
+ * other, so the rate should grow with the number of pairs (up to the
+ * number of CPUs) unless the driver serializes unrelated processes.
+ *
+ * The parent process acts as a minimal context manager to hand each
+ * client a handle to its server, so it cannot run while servicemanager
+ * holds that role: stop the Android runtime first.
+ *
+ *	binder_stress [-p pairs] [-s payload bytes] [-t seconds]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_PAYLOAD	4096
+
+enum {
+	CODE_REGISTER = 1,	/* server -> manager: object, pair index */
+	CODE_LOOKUP,		/* client -> manager: pair index */
+	CODE_PING,		/* client -> server */
+};
+
+struct register_msg {
+	struct flat_binder_object obj;
+	int pair;
+};
+
+struct result {
+	unsigned long count;
+	double seconds;
+};
+
+static int binder_fd = -1;
+static unsigned char out[1024];	/* commands for the next write */
+static size_t out_len;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void put(const void *p, size_t len)
+{
+	if (out_len + len > sizeof(out)) {
+		fprintf(stderr, "command buffer overflow\n");
+		exit(1);
+	}
+	memcpy(out + out_len, p, len);
+	out_len += len;
+}
+
+static void put_cmd(uint32_t cmd, const void *arg, size_t len)
+{
+	put(&cmd, sizeof(cmd));
+	if (len)
+		put(arg, len);
+}
+
+static void put_txn(uint32_t cmd, size_t handle, unsigned code,
+		    const void *data, size_t size, const size_t *offsets,
+		    size_t nr_offsets)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	txn.data_size = size;
+	txn.offsets_size = nr_offsets * sizeof(size_t);
+	txn.data.ptr.buffer = data;
+	txn.data.ptr.offsets = offsets;
+	put_cmd(cmd, &txn, sizeof(txn));
+}
+
+static void binder_open(void)
+{
+	struct binder_version version;
+
+	binder_fd = open("/dev/binder", O_RDWR);
+	if (binder_fd < 0)
+		die("/dev/binder");
+	if (ioctl(binder_fd, BINDER_VERSION, &version) < 0)
+		die("BINDER_VERSION");
+	if (version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			version.protocol_version,
+			BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, binder_fd, 0) ==
+	    MAP_FAILED)
+		die("mmap");
+}
+
+static int write_read(void *in, size_t in_size, size_t *in_len)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	bwr.write_size = out_len;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long) out;
+	bwr.read_size = in_size;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long) in;
+
+	do {
+		ret = ioctl(binder_fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	out_len = 0;
+	if (in_len)
+		*in_len = bwr.read_consumed;
+	return 0;
+}
+
+static void flush(void)
+{
+	if (out_len && write_read(NULL, 0, NULL))
+		die("BINDER_WRITE_READ");
+}
+
+/*
+ * Sends the pending commands and reads until 'want' (BR_TRANSACTION or
+ * BR_REPLY) arrives, answering reference count requests on the way.
+ * The driver always ends a read with the transaction it returns.
+ */
+static void wait_for(uint32_t want, struct binder_transaction_data *txn)
+{
+	uint32_t in[256];
+	size_t len;
+
+	for (;;) {
+		unsigned char *p, *end;
+
+		if (write_read(in, sizeof(in), &len))
+			die("BINDER_WRITE_READ");
+
+		p = (unsigned char *) in;
+		end = p + len;
+		while (p < end) {
+			uint32_t cmd = *(uint32_t *) p;
+			void *arg = p + sizeof(cmd);
+
+			p += sizeof(cmd) + _IOC_SIZE(cmd);
+
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+			case BR_RELEASE:
+			case BR_DECREFS:
+				break;
+			case BR_INCREFS:
+				put_cmd(BC_INCREFS_DONE, arg,
+					sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_ACQUIRE:
+				put_cmd(BC_ACQUIRE_DONE, arg,
+					sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				if (cmd != want) {
+					fprintf(stderr, "unexpected %s\n",
+						cmd == BR_REPLY ?
+						"reply" : "transaction");
+					exit(1);
+				}
+				memcpy(txn, arg, sizeof(*txn));
+				return;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				fprintf(stderr, "transaction failed\n");
+				exit(1);
+			case BR_ERROR:
+				fprintf(stderr, "binder error %d\n",
+					*(int *) arg);
+				exit(1);
+			default:
+				fprintf(stderr, "unknown command %#x\n", cmd);
+				exit(1);
+			}
+		}
+	}
+}
+
+static void acquire(signed long handle)
+{
+	int desc = handle;
+
+	put_cmd(BC_ACQUIRE, &desc, sizeof(desc));
+}
+
+static void free_buffer(struct binder_transaction_data *txn)
+{
+	put_cmd(BC_FREE_BUFFER, &txn->data.ptr.buffer, sizeof(void *));
+}
+
+/* Replies at once: 'data' needs to outlive only this call */
+static void reply(struct binder_transaction_data *txn, const void *data,
+		  size_t size, const size_t *offsets, size_t nr_offsets)
+{
+	free_buffer(txn);
+	put_txn(BC_REPLY, 0, 0, data, size, offsets, nr_offsets);
+	flush();
+}
+
+static void gate_wait(int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) != 1)
+		die("gate");
+}
+
+static void gate_open(int fd, int n)
+{
+	while (n--)
+		if (write(fd, "", 1) != 1)
+			die("gate");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void server(int pair)
+{
+	static const size_t offsets[] = { 0 };
+	struct binder_transaction_data txn;
+	struct register_msg msg;
+	int status = 0;
+
+	binder_open();
+	put_cmd(BC_ENTER_LOOPER, NULL, 0);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.flags = 0x7f;	/* lowest minimum priority */
+	msg.obj.binder = &msg;
+	msg.pair = pair;
+	put_txn(BC_TRANSACTION, 0, CODE_REGISTER, &msg, sizeof(msg),
+		offsets, 1);
+	wait_for(BR_REPLY, &txn);
+	free_buffer(&txn);
+
+	for (;;) {
+		wait_for(BR_TRANSACTION, &txn);
+		reply(&txn, &status, sizeof(status), NULL, 0);
+	}
+}
+
+static void client(int pair, size_t payload, int seconds, int gate,
+		   int start, int results)
+{
+	static unsigned char data[MAX_PAYLOAD];
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	struct result res;
+	double end;
+	size_t handle;
+
+	gate_wait(gate);
+	binder_open();
+
+	put_txn(BC_TRANSACTION, 0, CODE_LOOKUP, &pair, sizeof(pair), NULL, 0);
+	wait_for(BR_REPLY, &txn);
+	if (txn.data_size < sizeof(obj) || txn.offsets_size < sizeof(size_t)) {
+		fprintf(stderr, "pair %d: lookup failed\n", pair);
+		exit(1);
+	}
+	memcpy(&obj, txn.data.ptr.buffer, sizeof(obj));
+	handle = obj.handle;
+	acquire(handle);
+	free_buffer(&txn);
+	flush();
+
+	gate_wait(start);
+
+	res.count = 0;
+	res.seconds = now();
+	end = res.seconds + seconds;
+	do {
+		put_txn(BC_TRANSACTION, handle, CODE_PING, data, payload,
+			NULL, 0);
+		wait_for(BR_REPLY, &txn);
+		free_buffer(&txn);
+		res.count++;
+	} while (now() < end);
+	res.seconds = now() - res.seconds;
+
+	if (write(results, &res, sizeof(res)) != sizeof(res))
+		die("results");
+	exit(0);
+}
+
+static signed long handles[MAX_PAIRS];
+
+static void manager_register(int pairs)
+{
+	struct binder_transaction_data txn;
+	struct register_msg msg;
+	int i, status = 0;
+
+	for (i = 0; i < pairs; i++) {
+		wait_for(BR_TRANSACTION, &txn);
+		if (txn.code != CODE_REGISTER || txn.data_size < sizeof(msg)) {
+			fprintf(stderr, "bad registration\n");
+			exit(1);
+		}
+		memcpy(&msg, txn.data.ptr.buffer, sizeof(msg));
+		if (msg.pair < 0 || msg.pair >= pairs) {
+			fprintf(stderr, "bad registration\n");
+			exit(1);
+		}
+		handles[msg.pair] = msg.obj.handle;
+		/* keep the reference once the buffer is freed */
+		acquire(msg.obj.handle);
+		reply(&txn, &status, sizeof(status), NULL, 0);
+	}
+}
+
+static void manager_lookup(int pairs)
+{
+	static const size_t offsets[] = { 0 };
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	int i, pair;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_HANDLE;
+	for (i = 0; i < pairs; i++) {
+		wait_for(BR_TRANSACTION, &txn);
+		if (txn.code != CODE_LOOKUP || txn.data_size < sizeof(pair)) {
+			fprintf(stderr, "bad lookup\n");
+			exit(1);
+		}
+		memcpy(&pair, txn.data.ptr.buffer, sizeof(pair));
+		if (pair < 0 || pair >= pairs) {
+			fprintf(stderr, "bad lookup\n");
+			exit(1);
+		}
+		obj.handle = handles[pair];
+		reply(&txn, &obj, sizeof(obj), offsets, 1);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-p pairs] [-s payload bytes] "
+		"[-t seconds]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int pairs = 1, seconds = 5;
+	size_t payload = 64;
+	int server_gate[2], client_gate[2], start_gate[2], results[2];
+	pid_t servers[MAX_PAIRS], clients[MAX_PAIRS];
+	unsigned long total = 0;
+	double seconds_sum = 0;
+	struct result res;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "p:s:t:")) != -1) {
+		switch (c) {
+		case 'p':
+			pairs = atoi(optarg);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (pairs < 1 || pairs > MAX_PAIRS || payload > MAX_PAYLOAD ||
+	    seconds < 1)
+		usage(argv[0]);
+
+	if (pipe(server_gate) || pipe(client_gate) || pipe(start_gate) ||
+	    pipe(results))
+		die("pipe");
+
+	/* children open the driver themselves, after the manager exists */
+	for (i = 0; i < pairs; i++) {
+		servers[i] = fork();
+		if (servers[i] < 0)
+			die("fork");
+		if (!servers[i]) {
+			gate_wait(server_gate[0]);
+			server(i);
+		}
+
+		clients[i] = fork();
+		if (clients[i] < 0)
+			die("fork");
+		if (!clients[i])
+			client(i, payload, seconds, client_gate[0],
+			       start_gate[0], results[1]);
+	}
+
+	binder_open();
+	if (ioctl(binder_fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR");
+	put_cmd(BC_ENTER_LOOPER, NULL, 0);
+
+	gate_open(server_gate[1], pairs);
+	manager_register(pairs);
+	gate_open(client_gate[1], pairs);
+	manager_lookup(pairs);
+	gate_open(start_gate[1], pairs);
+
+	for (i = 0; i < pairs; i++) {
+		if (read(results[0], &res, sizeof(res)) != sizeof(res))
+			die("results");
+		total += res.count;
+		seconds_sum += res.seconds;
+	}
+
+	for (i = 0; i < pairs; i++) {
+		kill(servers[i], SIGTERM);
+		waitpid(servers[i], NULL, 0);
+		waitpid(clients[i], NULL, 0);
+	}
+
+	printf("%d pairs, %zu byte payload: %lu transactions, %.0f/s\n",
+	       pairs, payload, total, total / (seconds_sum / pairs));
+
+	return 0;
+}